@@ -14,13 +14,13 @@
 #include <QDateTime>
 #include <QDir>
 #include <QDebug>
-#include <QRegularExpression>
-#include <QEventLoop>
 #include <QSettings>
 #include <QStandardPaths>
+#include <QElapsedTimer>
 #include <utility>  // for std::pair
 #include <windows.h>
 #include <winuser.h>
+#include <mmsystem.h>
 
 const QPoint arona::BUTTON_HALL_TO_CAFE1 = QPoint(118, 960);
 const QPoint arona::BUTTON_CAFE1_TO_CAFE2 = QPoint(230, 134);
@@ -33,7 +33,6 @@ arona::arona(QWidget *parent)
     , capturingHandleIndex(1)
     , waitingForMouseRelease(false)
     , isRunning(false)
-    , shouldStop(false)
     , captureTimer(nullptr)
     , schedulerTimer(nullptr)
     , countdownTimer(nullptr)
@@ -87,6 +86,11 @@ arona::arona(QWidget *parent)
     connect(reloadTemplatesButton, &QPushButton::clicked, this, &arona::onReloadTemplatesButtonClicked);
     connect(logButton, &QPushButton::clicked, this, &arona::onLogButtonClicked);
     connect(aboutButton, &QPushButton::clicked, this, &arona::onAboutButtonClicked);
+    // 引擎线程的日志、按钮状态经队列连接回到GUI线程
+    connect(this, &arona::logRequested, this, &arona::appendLog, Qt::QueuedConnection);
+    connect(this, &arona::runningStateChanged, this, &arona::updateStartButtonState, Qt::QueuedConnection);
+    // 其他窗口释放全局输入时唤醒排队中的脚本协程
+    inputArbiter.setChangedListener([this]() { inputArbiterChanged.notify(); });
 
     // 加载位置模板
     loadPositionTemplates();
@@ -97,6 +101,15 @@ arona::arona(QWidget *parent)
     // 加载学生头像模板（二值化）
     loadStudentAvatarTemplates();
     
+    // 加载调试截图设置
+    loadDebugImageSettings();
+    
+    // 加载过渡耗时模型
+    loadTransitionModel();
+    
+    // 加载摸头设置
+    loadHeadpatSettings();
+    
     // 加载保存的定时参数设置
     loadTimerSettings();
     
@@ -129,9 +142,24 @@ arona::arona(QWidget *parent)
 
 arona::~arona()
 {
+    // 等待引擎线程退出（各窗口的脚本协程使用下面将要销毁的截图来源）
+    stopToken.cancel();
+    if (engineThread) {
+        engineThread->wait();
+        delete engineThread;
+        timeEndPeriod(1);
+    }
+    // 脚本协程被取消后尚未发出的输入事件仍会使用下面的录制和截图表
+    inputScheduler.stop();
+    
     if (captureTimer) {
         delete captureTimer;
     }
+    // 先停止截图线程，再关闭录制和销毁截图来源
+    qDeleteAll(captureWorkers);
+    qDeleteAll(frameSignals);
+    qDeleteAll(sessionRecorders);
+    qDeleteAll(captureSources);
 }
 
 void arona::setupUi()
@@ -448,6 +476,7 @@ void arona::setupUi()
     debugTypeComboBox->addItem("截图调试");
     debugTypeComboBox->addItem("点击调试");
     debugTypeComboBox->addItem("按键调试");
+    debugTypeComboBox->addItem("性能测试");
     debugTypeComboBox->setStyleSheet("QComboBox { "
                                     "border: 2px solid #66CCFF; "
                                     "border-radius: 3px; "
@@ -602,8 +631,38 @@ void arona::setupUi()
     this->setMenuBar(menubar);
 }
 
+// 窗口任务开始时复制的本窗口配置，运行期间脚本只读这份副本
+// （运行期间设置对话框和定时任务也不会修改原配置，见engineThread的检查）
+struct ScriptConfig {
+    TimerTaskConfig task;
+    QStringList students;               // 邀请学生列表
+    QHash<QString, bool> forceInvite;   // 学生名称 -> 是否强制邀请
+    bool hasSweepConfig = false;
+    WindowSweepConfig sweep;
+};
+
+// 窗口任务的上下文（ScriptRuntime::context），各窗口的协程在同一个线程上交错执行，不能使用thread_local
+struct ScriptWindow {
+    QString tag;            // 日志中标明来源
+    ScriptConfig config;
+};
+
+// 当前协程所处理的窗口（不在窗口任务中时为空）
+static ScriptWindow *scriptWindow()
+{
+    return static_cast<ScriptWindow *>(ScriptRuntime::context());
+}
+
 void arona::appendLog(const QString &message, const QString &level)
 {
+    // 引擎线程中的日志转到GUI线程输出
+    if (QThread::currentThread() != thread()) {
+        ScriptWindow *window = scriptWindow();
+        QString tagged = window ? QString("[%1] %2").arg(window->tag, message) : message;
+        emit logRequested(tagged, level);
+        return;
+    }
+    
     // 获取当前时间
     QString currentTime = QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss");
     
@@ -687,6 +746,9 @@ void arona::onstartButtonClicked()
     if (isRunning) {
         // 当前正在运行，点击按钮则停止
         stopScript();
+    } else if (engineThread) {
+        // 停止后引擎线程还没有退出，不修改脚本正在使用的任务配置
+        appendLog("脚本正在停止，请稍候", "WARNING");
     } else {
         // 当前未运行，点击按钮则启动
         // 清空currentTaskConfig
@@ -700,6 +762,12 @@ void arona::onstartButtonClicked()
 
 void arona::onCaptureHandleButtonPressed()
 {
+    // 引擎线程正在读取窗口句柄和标题
+    if (engineThread) {
+        appendLog("脚本运行中，请停止后再抓取窗口句柄", "WARNING");
+        return;
+    }
+    
     capturingHandleIndex = 1;
     waitingForMouseRelease = true;
     isCapturingHandle = true;
@@ -715,6 +783,12 @@ void arona::onCaptureHandleButtonPressed()
 
 void arona::onCaptureHandle2ButtonPressed()
 {
+    // 引擎线程正在读取窗口句柄和标题
+    if (engineThread) {
+        appendLog("脚本运行中，请停止后再抓取窗口句柄", "WARNING");
+        return;
+    }
+    
     capturingHandleIndex = 2;
     waitingForMouseRelease = true;
     isCapturingHandle = true;
@@ -727,6 +801,12 @@ void arona::onCaptureHandle2ButtonPressed()
 
 void arona::onCaptureHandle3ButtonPressed()
 {
+    // 引擎线程正在读取窗口句柄和标题
+    if (engineThread) {
+        appendLog("脚本运行中，请停止后再抓取窗口句柄", "WARNING");
+        return;
+    }
+    
     capturingHandleIndex = 3;
     waitingForMouseRelease = true;
     isCapturingHandle = true;
@@ -744,6 +824,12 @@ void arona::captureWindowHandle(int handleIndex)
     // 恢复鼠标样式
     QApplication::restoreOverrideCursor();
     
+    // 松开鼠标到这里执行之间可能已经启动了脚本（定时任务），此时不修改窗口句柄
+    if (engineThread) {
+        appendLog("脚本运行中，未更新窗口句柄", "WARNING");
+        return;
+    }
+    
     // 获取当前鼠标位置
     POINT pt;
     GetCursorPos(&pt);
@@ -808,9 +894,11 @@ void arona::captureWindowHandle(int handleIndex)
             parentTitleStr = "(无标题父窗口)";
         }
         
-        // 存储句柄和父窗口标题
+        // 存储句柄和父窗口标题（重新抓取的窗口需要重新识别服务器版本）
         gameHandles[handleIndex - 1] = hwnd;
         gameWindowTitles[handleIndex - 1] = parentTitleStr;
+        screenRecognizer.resetWindowVariant(parentTitleStr);
+        screenRecognizer.resetRoiCache(parentTitleStr);
         
         // 更新对应的输入框，显示父窗口标题而不是句柄值
         QLineEdit *targetEdit = nullptr;
@@ -904,11 +992,21 @@ void arona::onSelectBgButtonClicked()
 
 void arona::onReloadTemplatesButtonClicked()
 {
+    // 引擎线程正在使用模板进行识别
+    if (engineThread) {
+        appendLog("脚本运行中，请停止后再重新加载模板", "WARNING");
+        return;
+    }
+    
     appendLog("========== 开始重新加载模板 ==========", "INFO");
     
     // 重新加载学生头像模板
     loadStudentAvatarTemplates();
     
+    // 重新读取调试截图设置（可在运行时开关）
+    loadDebugImageSettings();
+    loadHeadpatSettings();
+    
     // 更新邀请学生对话框的学生列表（如果对话框存在）
     if (studentInviteDialog) {
         // 重新加载可用学生列表
@@ -962,97 +1060,300 @@ void arona::setBackgroundImage(const QString &imagePath)
      }
 }
 
-QImage arona::captureWindow(HWND hwnd)
+QImage arona::captureWindow(HWND hwnd, qint64 *capturedAt)
 {
     // 检查窗口是否有效
     if (!IsWindow(hwnd)) {
         appendLog("窗口句柄无效", "ERROR");
+        stopCaptureWorker(hwnd);
+        QMutexLocker locker(&captureMutex);
+        delete captureSources.take(hwnd);
         return QImage();
     }
     
-    // 获取窗口矩形区域
-    RECT rect;
-    if (!GetWindowRect(hwnd, &rect)) {
-        appendLog("获取窗口矩形失败", "ERROR");
-        return QImage();
+    CaptureWorker *worker;
+    SessionRecorder *recorder;
+    qint64 inputAt;
+    {
+        QMutexLocker locker(&captureMutex);
+        worker = captureWorkers.value(hwnd);
+        recorder = sessionRecorders.value(hwnd);
+        inputAt = lastInputAt.value(hwnd);
+    }
+    
+    // 后台截图线程运行时取最新一帧：帧通常在前面的延时中已经截好，不再在引擎线程上等待PrintWindow
+    // 这里不等待（等待会阻塞同一线程上的其他窗口），输入之后的新帧由调用方先co_await waitForFrame
+    if (worker) {
+        CaptureWorker::Frame frame = worker->latestFrame();
+        if (frame.isNull()) {
+            appendLog(worker->lastError(), "ERROR");
+        } else if (frame.startedAt < inputAt && !stopToken.isCancelled()) {
+            // 截图线程在等待时间内没有截到输入之后的画面（截图变慢或失败），这一帧可能还是输入之前的画面
+            // 截图来源只能由截图线程访问，不能在这里直接截图，只记录日志，由调用方的重试处理
+            appendLog(QString("[%1] 未截到输入之后的新帧，使用%2ms前开始截取的旧帧")
+                      .arg(windowKeyForHandle(hwnd))
+                      .arg(CaptureWorker::clockMs() - frame.startedAt), "WARNING");
+        }
+        if (capturedAt) {
+            *capturedAt = frame.startedAt;
+        }
+        return frame.image;
     }
     
-    int width = rect.right - rect.left;
-    int height = rect.bottom - rect.top;
-    
-    // 获取窗口DC
-    HDC hdcWindow = GetDC(hwnd);
-    if (!hdcWindow) {
-        appendLog("获取窗口DC失败", "ERROR");
-        return QImage();
+    ICaptureSource *source = captureSourceFor(hwnd);
+    const qint64 startedAt = CaptureWorker::clockMs();
+    QImage image = source->capture();
+    if (image.isNull()) {
+        appendLog(source->lastError(), "ERROR");
+    } else if (recorder) {
+        recorder->recordFrame(image, startedAt);
     }
-    HDC hdcMemDC = CreateCompatibleDC(hdcWindow);
-    if (!hdcMemDC) {
-        appendLog("创建内存DC失败", "ERROR");
-        ReleaseDC(hwnd, hdcWindow);
-        return QImage();
+    if (capturedAt) {
+        *capturedAt = startedAt;
     }
-    HBITMAP hbmScreen = CreateCompatibleBitmap(hdcWindow, width, height);
-    if (!hbmScreen) {
-        appendLog("创建兼容位图失败", "ERROR");
-        DeleteDC(hdcMemDC);
-        ReleaseDC(hwnd, hdcWindow);
-        return QImage();
+    return image;
+}
+
+RoiFrame arona::captureRegions(HWND hwnd, const QVector<QRect> &rois, qint64 *capturedAt)
+{
+    // 与captureWindow相同，但只把需要的ROI复制出来，整帧立即回到帧池
+    if (!IsWindow(hwnd)) {
+        appendLog("窗口句柄无效", "ERROR");
+        stopCaptureWorker(hwnd);
+        QMutexLocker locker(&captureMutex);
+        delete captureSources.take(hwnd);
+        return RoiFrame();
     }
-    SelectObject(hdcMemDC, hbmScreen);
-    // 复制窗口内容到内存DC
-    PrintWindow(hwnd, hdcMemDC, PW_RENDERFULLCONTENT);
     
-    // 创建QPixmap
-    QPixmap pixmap = QPixmap::fromImage(QImage::fromHBITMAP(hbmScreen));
+    // 后台截图线程运行时从最新一帧中复制ROI（帧本身由截图线程持有，不额外截图）
+    // 录制时需要整帧，同样先截取整帧再复制ROI
+    bool fullFrame;
+    {
+        QMutexLocker locker(&captureMutex);
+        fullFrame = captureWorkers.contains(hwnd) || sessionRecorders.contains(hwnd);
+    }
+    if (fullFrame) {
+        return RoiFrame::fromImage(captureWindow(hwnd, capturedAt), rois);
+    }
     
-    // 清理
-    DeleteObject(hbmScreen);
-    DeleteDC(hdcMemDC);
-    ReleaseDC(hwnd, hdcWindow);
-
-    return pixmap.toImage();
+    ICaptureSource *source = captureSourceFor(hwnd);
+    if (capturedAt) {
+        *capturedAt = CaptureWorker::clockMs();
+    }
+    RoiFrame frame = source->captureRegions(rois);
+    if (frame.isNull()) {
+        appendLog(source->lastError(), "ERROR");
+    }
+    return frame;
 }
 
-QString arona::calculateImageHash(const QImage& image, const QRect& roi)
+ICaptureSource *arona::captureSourceFor(HWND hwnd)
 {
-    QImage targetImage = image;
-    
-    // 如果指定了ROI区域，则裁剪图像
-    if (!roi.isNull() && roi.isValid()) {
-        targetImage = image.copy(roi);
+    QMutexLocker locker(&captureMutex);
+    ICaptureSource *&source = captureSources[hwnd];
+    if (source) {
+        return source;
     }
     
-    // 转换为灰度并缩放为8x8像素进行哈希计算
-    QImage grayImage = targetImage.convertToFormat(QImage::Format_Grayscale8);
-    QImage hashImage = grayImage.scaled(8, 8, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+#if DEBUG_MODE
+    // 调试：配置了回放目录时，用录制好的画面代替窗口截图（点击等操作仍然发送到窗口）
+    QString configPath = QCoreApplication::applicationDirPath() + "/arona_config.ini";
+    QSettings settings(configPath, QSettings::IniFormat);
+    QString replayDirectory = settings.value("Debug/ReplayDirectory").toString();
+    if (!replayDirectory.isEmpty()) {
+        ReplayCaptureSource *replay = new ReplayCaptureSource(replayDirectory, true);
+        if (replay->isValid()) {
+            appendLog(QString("使用回放截图: %1（%2帧）").arg(replayDirectory).arg(replay->frameCount()), "WARNING");
+            source = replay;
+            return source;
+        }
+        appendLog(replay->lastError(), "ERROR");
+        delete replay;
+    }
+#endif
     
-    // 计算平均像素值
-    qint64 totalValue = 0;
-    for (int y = 0; y < 8; ++y) {
-        for (int x = 0; x < 8; ++x) {
-            totalValue += qGray(hashImage.pixel(x, y));
+    // 每个窗口保留一个截图上下文，DIB位图在多次截图之间复用，返回的图像直接引用DIB内存
+    // 帧池为4帧：后台截图时最新帧缓冲的两个槽位、识别代码持有的一帧、正在截取的一帧
+    source = new WindowCapture(hwnd, 4);
+    return source;
+}
+
+void arona::startCaptureWorker(HWND hwnd)
+{
+    if (!IsWindow(hwnd)) {
+        return;
+    }
+    {
+        QMutexLocker locker(&captureMutex);
+        if (captureWorkers.contains(hwnd)) {
+            return;
         }
     }
-    qint64 avgValue = totalValue / 64;
     
-    // 生成64位哈希值
-    QString hash;
-    for (int y = 0; y < 8; ++y) {
-        for (int x = 0; x < 8; ++x) {
-            int pixelValue = qGray(hashImage.pixel(x, y));
-            hash += (pixelValue >= avgValue) ? "1" : "0";
+    QString configPath = QCoreApplication::applicationDirPath() + "/arona_config.ini";
+    QSettings settings(configPath, QSettings::IniFormat);
+    int intervalMs = settings.value("Capture/WorkerIntervalMs", CAPTURE_WORKER_INTERVAL_MS).toInt();
+    if (intervalMs <= 0) {
+        return;  // 关闭后台截图，退回在GUI线程上同步截图
+    }
+    
+    CaptureWorker *worker = new CaptureWorker(captureSourceFor(hwnd), intervalMs);
+    QMutexLocker locker(&captureMutex);
+    worker->setRecorder(sessionRecorders.value(hwnd));
+    ScriptSignal *&frameSignal = frameSignals[hwnd];
+    if (!frameSignal) {
+        frameSignal = new ScriptSignal;
+    }
+    ScriptSignal *signal = frameSignal;
+    worker->setFrameListener([signal]() { signal->notify(); });
+    worker->start();
+    captureWorkers.insert(hwnd, worker);
+    lastInputAt.insert(hwnd, CaptureWorker::clockMs());
+}
+
+void arona::stopCaptureWorker(HWND hwnd)
+{
+    CaptureWorker *worker;
+    {
+        QMutexLocker locker(&captureMutex);
+        worker = captureWorkers.take(hwnd);
+    }
+    if (!worker) {
+        return;
+    }
+    worker->stop();
+    if (worker->framesFailed() > 0) {
+        appendLog(QString("后台截图：成功%1帧，失败%2帧（%3）")
+                 .arg(worker->framesCaptured())
+                 .arg(worker->framesFailed())
+                 .arg(worker->lastError()), "WARNING");
+    }
+    delete worker;
+}
+
+ScriptTask<bool> arona::waitForFrame(HWND hwnd)
+{
+    // 输入之后的画面要等截图线程截到新帧（由输入引起的界面变化在那之前的帧中还看不到），最多等待CAPTURE_WORKER_WAIT_MS
+    // 等待期间挂起，同一线程上的其他窗口继续执行；超时后captureWindow使用旧帧并记录警告
+    const qint64 deadline = CaptureWorker::clockMs() + CAPTURE_WORKER_WAIT_MS;
+    for (;;) {
+        CaptureWorker *worker;
+        ScriptSignal *signal;
+        qint64 inputAt;
+        {
+            QMutexLocker locker(&captureMutex);
+            worker = captureWorkers.value(hwnd);
+            signal = frameSignals.value(hwnd);
+            inputAt = lastInputAt.value(hwnd);
+        }
+        if (!worker) {
+            co_return !stopToken.isCancelled();
+        }
+        
+        // 帧只在检查时持有（挂起期间持有会占用截图来源的帧池）
+        const quint64 seen = signal->generation();
+        const qint64 startedAt = worker->latestFrame().startedAt;
+        if (startedAt > 0 && startedAt >= inputAt) {
+            co_return true;
+        }
+        const qint64 remaining = deadline - CaptureWorker::clockMs();
+        if (remaining <= 0) {
+            co_return !stopToken.isCancelled();
+        }
+        co_await signal->wait(int(remaining), seen);
+        if (stopToken.isCancelled()) {
+            co_return false;
+        }
+    }
+}
+
+void arona::startSessionRecording(HWND hwnd, int handleIndex)
+{
+    {
+        QMutexLocker locker(&captureMutex);
+        if (sessionRecorders.contains(hwnd)) {
+            return;
         }
     }
     
-    return hash;
+    QString configPath = QCoreApplication::applicationDirPath() + "/arona_config.ini";
+    QSettings settings(configPath, QSettings::IniFormat);
+    if (!settings.value("Recording/Enabled", false).toBool()) {
+        return;
+    }
+    QString directory = settings.value("Recording/Directory",
+                                       QCoreApplication::applicationDirPath() + "/recordings").toString();
+    QString path = QString("%1/%2_window%3.arec")
+                       .arg(directory)
+                       .arg(QDateTime::currentDateTime().toString("yyyyMMdd_HHmmss"))
+                       .arg(handleIndex + 1);
+    
+    SessionRecorder *recorder = new SessionRecorder(settings.value("Recording/KeyframeInterval", 60).toInt());
+    if (!recorder->open(path)) {
+        appendLog(recorder->lastError(), "ERROR");
+        delete recorder;
+        return;
+    }
+    {
+        QMutexLocker locker(&captureMutex);
+        sessionRecorders.insert(hwnd, recorder);
+    }
+    appendLog(QString("开始录制: %1").arg(path), "INFO");
+}
+
+void arona::stopSessionRecording(HWND hwnd)
+{
+    SessionRecorder *recorder;
+    {
+        QMutexLocker locker(&captureMutex);
+        recorder = sessionRecorders.take(hwnd);
+    }
+    if (!recorder) {
+        return;
+    }
+    recorder->close();
+    appendLog(QString("录制完成: %1帧（差分%2帧，丢弃%3帧），%4 MB")
+             .arg(recorder->framesWritten())
+             .arg(recorder->deltaFrames())
+             .arg(recorder->framesDropped())
+             .arg(recorder->bytesWritten() / 1048576.0, 0, 'f', 1), "INFO");
+    QString error = recorder->lastError();
+    if (!error.isEmpty()) {
+        appendLog(error, "ERROR");
+    }
+    delete recorder;
+}
+
+void arona::markInput(HWND hwnd, SessionInputEvent::Type type, int x, int y, int x2, int y2, int value)
+{
+    QMutexLocker locker(&captureMutex);
+    lastInputAt[hwnd] = CaptureWorker::clockMs();
+    if (SessionRecorder *recorder = sessionRecorders.value(hwnd)) {
+        recorder->recordInput(type, x, y, x2, y2, value);
+    }
+}
+
+quint64 arona::calculateImageHash(const QImage& image, const QRect& roi)
+{
+    // 直接在原图上计算ROI的平均哈希（不裁剪、不缩放、不分配内存）
+    // 模板加载时同样使用该内核，保证模板哈希与运行时哈希的计算方式一致
+    return ImageKernels::averageHash(image, roi);
+}
+
+int arona::loadHashTolerance(QSettings &settings, const QString &templateName)
+{
+    // 配置格式: [HashTolerance] Default=4, Hall_JP=6 ...（键为去掉坐标前缀的模板名）
+    return ScreenRecognizer::toleranceFromSettings(settings, templateName);
 }
 
 void arona::loadPositionTemplates()
 {
-    positionTemplates.clear();
+    screenRecognizer.clearPositionTemplates();
 
-    // 加载位置模板
+    QString configPath = QCoreApplication::applicationDirPath() + "/arona_config.ini";
+    QSettings settings(configPath, QSettings::IniFormat);
+
+    // 加载位置模板，文件名在加载时解析为 位置名 -> {ROI, 哈希, 服务器变体} 的索引
     QDir dir(":/images/position_templates");
     if (!dir.exists()) {
         appendLog("位置模板目录不存在", "ERROR");
@@ -1062,22 +1363,30 @@ void arona::loadPositionTemplates()
     foreach (QString file, files) {
         QString filePath = dir.filePath(file);
         QImage image = QImage(filePath);
-        QString hash = calculateImageHash(image);
         QString fileName = file.split(".").first();
-        positionTemplates.insert(fileName, hash);
+        quint64 hash = calculateImageHash(image);
+        int tolerance = loadHashTolerance(settings, fileName);
+        if (!screenRecognizer.addPositionTemplate(fileName, image.size(), hash, tolerance)) {
+            appendLog(QString("位置模板文件名格式错误，已跳过: %1").arg(file), "WARNING");
+            continue;
+        }
+        qDebug() << "位置模板: " << fileName
+                 << ", 哈希值: " << QString::number(hash, 16).rightJustified(16, '0')
+                 << ", 容差: " << tolerance;
     }
 
-    appendLog(QString("位置模板加载完成，共加载%1个模板").arg(positionTemplates.size()), "SUCCESS");
-    foreach (QString filePath, positionTemplates.keys()) {
-        qDebug() << "位置模板: " << filePath << ", 哈希值: " << positionTemplates[filePath];
-    }
+    screenRecognizer.buildClassifier();
+    appendLog(QString("位置模板加载完成，共加载%1个模板").arg(screenRecognizer.positionTemplateCount()), "SUCCESS");
 }
 
 void arona::loadpositionReadyTemplates()
 {
-    positionReadyTemplates.clear();
+    screenRecognizer.clearReadyTemplates();
+
+    QString configPath = QCoreApplication::applicationDirPath() + "/arona_config.ini";
+    QSettings settings(configPath, QSettings::IniFormat);
 
-    // 加载位置就绪模板
+    // 加载位置就绪模板，按ROI左上角建立索引
     QDir dir(":/images/position_ready");
     if (!dir.exists()) {
         appendLog("位置就绪模板目录不存在", "ERROR");
@@ -1087,12 +1396,14 @@ void arona::loadpositionReadyTemplates()
     foreach (QString file, files) {
         QString filePath = dir.filePath(file);
         QImage image = QImage(filePath);
-        QString hash = calculateImageHash(image);
         QString fileName = file.split(".").first();
-        positionReadyTemplates.insert(fileName, hash);
+        if (!screenRecognizer.addReadyTemplate(fileName, image.size(), calculateImageHash(image), loadHashTolerance(settings, fileName))) {
+            appendLog(QString("位置就绪模板文件名格式错误，已跳过: %1").arg(file), "WARNING");
+        }
     }
 
-    appendLog(QString("位置就绪模板加载完成，共加载%1个模板").arg(positionReadyTemplates.size()), "SUCCESS");
+    screenRecognizer.buildClassifier();
+    appendLog(QString("位置就绪模板加载完成，共加载%1个模板").arg(screenRecognizer.readyTemplateCount()), "SUCCESS");
 }
 
 void arona::loadStudentAvatarTemplates()
@@ -1124,15 +1435,12 @@ void arona::loadStudentAvatarTemplates()
             QImage image(filePath);
             
             if (!image.isNull()) {
-                // 二值化图像
-                QVector<bool> binaryData = binarizeImage(image, backgroundColor);
-                
                 // 去掉文件扩展名作为学生名称
                 QString studentName = file.left(file.lastIndexOf('.'));
                 
                 // 存储二值化数据及尺寸信息
                 StudentTemplate tmpl;
-                tmpl.binaryData = binaryData;
+                tmpl.bits = binarizeImage(image, backgroundColor);
                 tmpl.width = image.width();
                 tmpl.height = image.height();
                 binarizedStudentTemplates.insert(studentName, tmpl);
@@ -1169,12 +1477,9 @@ void arona::loadStudentAvatarTemplates()
                 QImage image(filePath);
                 
                 if (!image.isNull()) {
-                    // 二值化图像
-                    QVector<bool> binaryData = binarizeImage(image, backgroundColor);
-                    
                     // 存储二值化数据及尺寸信息
                     StudentTemplate tmpl;
-                    tmpl.binaryData = binaryData;
+                    tmpl.bits = binarizeImage(image, backgroundColor);
                     tmpl.width = image.width();
                     tmpl.height = image.height();
                     binarizedStudentTemplates.insert(studentName, tmpl);
@@ -1204,178 +1509,131 @@ void arona::loadStudentAvatarTemplates()
     }
 }
 
-QVector<bool> arona::binarizeImage(const QImage &image, const QRgb &backgroundColor)
+ImageKernels::BitImage arona::binarizeImage(const QImage &image, const QRgb &backgroundColor, const QRect &roi)
 {
     // 将图像二值化：背景色为0，其他颜色为1
-    // 允许一定的颜色容差（RGB各分量±10）
-    const int tolerance = 10;
-    
-    int width = image.width();
-    int height = image.height();
-    QVector<bool> binaryData(width * height);
-    
-    int bgR = qRed(backgroundColor);
-    int bgG = qGreen(backgroundColor);
-    int bgB = qBlue(backgroundColor);
-    
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            QRgb pixel = image.pixel(x, y);
-            int r = qRed(pixel);
-            int g = qGreen(pixel);
-            int b = qBlue(pixel);
-            
-            // 检查是否接近背景色
-            bool isBackground = (qAbs(r - bgR) <= tolerance) &&
-                               (qAbs(g - bgG) <= tolerance) &&
-                               (qAbs(b - bgB) <= tolerance);
-            
-            binaryData[y * width + x] = !isBackground;  // 背景为0，其他为1
-        }
-    }
-    
-    return binaryData;
+    // 允许一定的颜色容差（RGB各分量±10），结果按行打包为64位字，每行单独对齐
+    return ImageKernels::binarize(image, roi, backgroundColor, BINARIZE_TOLERANCE);
 }
 
-int arona::calculateHammingDistance(const QVector<bool> &binary1, const QVector<bool> &binary2)
+int arona::calculateHammingDistance(const ImageKernels::BitImage &binary1, const ImageKernels::BitImage &binary2, int budget)
 {
-    // 计算两个二值化数据的汉明距离（不同位的数量）
-    if (binary1.size() != binary2.size()) {
-        return -1;  // 大小不匹配
-    }
-    
-    int distance = 0;
-    for (int i = 0; i < binary1.size(); i++) {
-        if (binary1[i] != binary2[i]) {
-            distance++;
-        }
-    }
-    
-    return distance;
+    // 计算两个二值化数据的汉明距离（不同位的数量），使用POPCNT逐字统计
+    // 距离超过budget后提前结束，此时返回值只保证大于budget；尺寸不匹配返回-1
+    return ImageKernels::hammingDistance(binary1, binary2, budget);
 }
 
-bool arona::compareImagesByHamming(const QImage &image, const QVector<bool> &templateBinary, 
-                                   int width, int height, const QRgb &backgroundColor, double threshold)
+bool arona::compareImagesByHamming(const QImage &image, const StudentTemplate &templateData,
+                                   const QRgb &backgroundColor, double threshold)
 {
     // 检查尺寸
-    if (image.width() != width || image.height() != height) {
+    if (image.width() != templateData.width || image.height() != templateData.height) {
         return false;
     }
     
     // 二值化待识别图像
-    QVector<bool> imageBinary = binarizeImage(image, backgroundColor);
+    ImageKernels::BitImage imageBinary = binarizeImage(image, backgroundColor);
     
-    // 计算汉明距离
-    int distance = calculateHammingDistance(imageBinary, templateBinary);
+    // 相似度 = 1 - 汉明距离/总像素数，换算成允许的最大距离后可以提前结束比较
+    int totalPixels = templateData.width * templateData.height;
+    int budget = ImageKernels::hammingBudget(totalPixels, threshold);
+    int distance = calculateHammingDistance(imageBinary, templateData.bits, budget);
     
-    if (distance < 0) {
+    if (distance < 0 || distance > budget) {
         return false;
     }
     
-    // 计算相似度 (1 - 汉明距离/总像素数)
-    int totalPixels = width * height;
     double similarity = 1.0 - (double)distance / totalPixels;
     appendLog(QString("汉明距离: %1, 总像素: %2, 相似度: %3")
                  .arg(distance)
                  .arg(totalPixels)
                  .arg(similarity, 0, 'f', 4), "INFO");
-    
-    if (similarity >= threshold) {
-        // appendLog(QString("汉明距离: %1, 总像素: %2, 相似度: %3")
-        //          .arg(distance)
-        //          .arg(totalPixels)
-        //          .arg(similarity, 0, 'f', 4), "INFO");
-        return true;
-    }
-    
-    return false;
+    return true;
 }
 
-QString arona::recognizeCurrentPosition(QImage screenshot, QString targetPosition)
+void arona::loadDebugImageSettings()
 {
-    // 构建需要尝试匹配的位置变体列表
-    // 支持多服务器版本：原版、日服(_JP)、韩服(_KR)、台服(_TW)、反和谐(_AC)等
-    QStringList positionVariants;
-    positionVariants << targetPosition;  // 首先尝试原版
-    
-    // 添加可能的服务器变体后缀
-    QStringList serverSuffixes = {"_JP", "_KR", "_TW", "_CN", "_AC"};
-    for (const QString &suffix : serverSuffixes) {
-        positionVariants << (targetPosition + suffix);
-    }
-    
-    // 循环遍历所有的位置模板
-    for (auto it = positionTemplates.begin(); it != positionTemplates.end(); ++it) {
-        QString key = it.key();
-        QString templateHash = it.value();
-        
-        // 解析键中的坐标信息 - 格式: "(x,y)描述"
-        static const QRegularExpression regex("\\((\\d+),(\\d+)\\)(.*)");
-        QRegularExpressionMatch match = regex.match(key);
-
-        if (match.hasMatch()) {
-            int x = match.captured(1).toInt();
-            int y = match.captured(2).toInt();
-            QString description = match.captured(3);
-
-            // 检查描述是否匹配任何一个变体（支持多服务器版本）
-            bool isTargetPosition = false;
-            QString matchedVariant;
-            for (const QString &variant : positionVariants) {
-                if (description == variant) {
-                    isTargetPosition = true;
-                    matchedVariant = variant;
-                    break;
-                }
-            }
+    QString configPath = QCoreApplication::applicationDirPath() + "/arona_config.ini";
+    QSettings settings(configPath, QSettings::IniFormat);
 
-            if (isTargetPosition)
-            {
-                // 从截图中截取对应的区域 (36x36像素)
-                QRect region(x, y, 36, 36);
-                qDebug() << "截取区域: " << region;
+    debugImages.setEnabled(settings.value("DebugImages/Enabled", true).toBool());
+    debugImages.setDirectory(settings.value("DebugImages/Directory", "screenshots").toString());
+    saveAvatarImages = settings.value("DebugImages/SaveAvatars", false).toBool();
+
+    // 识别失败时自动保存的截图：按类别限速，内容相同的只保存一次
+    DebugImageSink::Policy automatic;
+    automatic.minIntervalMs = settings.value("DebugImages/MinIntervalMs", 2000).toInt();
+    debugImages.setDefaultPolicy(automatic);
+
+    // 头像调试截图每次扫描保存一组，只去重不限速
+    DebugImageSink::Policy avatars;
+    debugImages.setPolicy("student_avatar", avatars);
+
+    // 调试按钮手动触发的截图：每次都保存
+    DebugImageSink::Policy manual;
+    manual.dedupe = false;
+    debugImages.setPolicy("student", manual);
+    debugImages.setPolicy("fullscreen", manual);
+    debugImages.setPolicy("clickArea", manual);
+}
 
-                // 检查区域是否在截图范围内
-                if (!screenshot.rect().contains(region))
-                {
-                    qDebug() << "区域超出游戏窗口范围，跳过:" << key;
-                    continue;  // 改为continue，继续尝试其他变体
-                }
+void arona::loadTransitionModel()
+{
+    QString configPath = QCoreApplication::applicationDirPath() + "/arona_config.ini";
+    QSettings settings(configPath, QSettings::IniFormat);
+    adaptiveTransitions = settings.value("Transitions/Adaptive", true).toBool();
+    transitionTimeoutMargin = qMax(1.0, settings.value("Transitions/TimeoutMargin", 2.0).toDouble());
+    
+    // 样本单独保存，不混入用户配置
+    QSettings samples(QCoreApplication::applicationDirPath() + "/arona_transitions.ini", QSettings::IniFormat);
+    transitionModel.load(samples);
+}
 
-                // 截取指定区域
-                QImage regionImage = screenshot.copy(region);
-                if (regionImage.isNull())
-                {
-                    qDebug() << "截取区域失败:" << key;
-                    continue;  // 改为continue，继续尝试其他变体
-                }
+void arona::saveTransitionModel()
+{
+    QSettings samples(QCoreApplication::applicationDirPath() + "/arona_transitions.ini", QSettings::IniFormat);
+    transitionModel.save(samples);
+}
 
-                // 计算该区域的哈希值
-                QString currentHash = calculateImageHash(regionImage);
+void arona::loadHeadpatSettings()
+{
+    QString configPath = QCoreApplication::applicationDirPath() + "/arona_config.ini";
+    QSettings settings(configPath, QSettings::IniFormat);
+    
+    headpatByVision = settings.value("Headpat/Mode", "vision").toString() != "grid";
+    headpatGridFallback = settings.value("Headpat/GridFallback", true).toBool();
+    headpatClickOffsetY = settings.value("Headpat/ClickOffsetY", 80).toInt();
+    
+    HeadpatDetector::Options options;
+    QColor color(settings.value("Headpat/BubbleColor", QColor(options.bubbleColor).name()).toString());
+    if (color.isValid()) {
+        options.bubbleColor = color.rgb();
+    }
+    options.tolerance = settings.value("Headpat/Tolerance", options.tolerance).toInt();
+    options.minSamples = settings.value("Headpat/MinSamples", options.minSamples).toInt();
+    options.maxSamples = settings.value("Headpat/MaxSamples", options.maxSamples).toInt();
+    headpatDetector.setOptions(options);
+}
 
-                // 与模板哈希值进行比较
-                if (currentHash == templateHash)
-                {
-                    qDebug() << "找到匹配的位置模板:" << key;
-                    qDebug() << "匹配的变体:" << matchedVariant;
-                    qDebug() << "返回描述:" << targetPosition;  // 始终返回原始目标位置
-                    return targetPosition; // 返回原始位置信息（不含后缀）
-                }
-            }
-            else {
-                // 保存截图
-                // QString timestamp = QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss");
-                // QString screenshotPath = "screenshots/" + QString("position_%1_%2.png").arg(description).arg(timestamp);
-                // if (regionImage.save(screenshotPath))
-                // {
-                //     qDebug() << "截图保存成功:" << screenshotPath;
-                // }
-                // else
-                // {
-                //     qDebug() << "截图保存失败:" << screenshotPath;
-                // }
-            }
+QString arona::recognizeCurrentPosition(const ScreenState &state, QString targetPosition, const QString &windowKey)
+{
+    // 只检查目标位置的候选模板（原版、日服(_JP)、韩服(_KR)、台服(_TW)、反和谐(_AC)等变体）
+    // 指定窗口时，该窗口的服务器变体识别后只检查对应变体的模板
+    ScreenRecognizer::Variant previousVariant = ScreenRecognizer::VariantDefault;
+    bool wasPinned = !windowKey.isEmpty() && screenRecognizer.windowVariant(windowKey, &previousVariant);
+    
+    const ScreenRecognizer::PositionCandidate *matched = nullptr;
+    int distance = 0;
+    if (screenRecognizer.matchPosition(state, targetPosition, windowKey, &matched, &distance)) {
+        qDebug() << "找到匹配的位置模板:" << matched->key << ", 汉明距离:" << distance;
+        
+        ScreenRecognizer::Variant variant;
+        if (!windowKey.isEmpty() && screenRecognizer.windowVariant(windowKey, &variant) &&
+            (!wasPinned || variant != previousVariant)) {
+            QString suffix = QString::fromLatin1(ScreenRecognizer::variantSuffix(variant));
+            appendLog(QString("[%1] 识别到服务器版本: %2").arg(windowKey).arg(suffix.isEmpty() ? "原版" : suffix.mid(1)), "INFO");
         }
+        return targetPosition;  // 始终返回原始目标位置（不含后缀）
     }
     
     // 没有找到匹配的位置
@@ -1383,61 +1641,74 @@ QString arona::recognizeCurrentPosition(QImage screenshot, QString targetPositio
     return QString();
 }
 
-void arona::enterCafe1FromHall(HWND hwnd)
+QString arona::windowKeyForHandle(HWND hwnd) const
+{
+    int index = gameHandles.indexOf(hwnd);
+    if (index < 0 || hwnd == NULL) {
+        return QString();
+    }
+    return gameWindowTitles[index];
+}
+
+ScriptTask<> arona::enterCafe1FromHall(HWND hwnd)
 {
     // 从大厅进入咖啡厅1
-    click(hwnd, BUTTON_HALL_TO_CAFE1.x(), BUTTON_HALL_TO_CAFE1.y());
+    co_await click(hwnd, BUTTON_HALL_TO_CAFE1.x(), BUTTON_HALL_TO_CAFE1.y());
 }
 
-void arona::enterCafe2FromCafe1(HWND hwnd)
+ScriptTask<> arona::enterCafe2FromCafe1(HWND hwnd)
 {
     // 从咖啡厅1进入咖啡厅2
-    click(hwnd, BUTTON_CAFE1_TO_CAFE2.x(), BUTTON_CAFE1_TO_CAFE2.y());
+    co_await click(hwnd, BUTTON_CAFE1_TO_CAFE2.x(), BUTTON_CAFE1_TO_CAFE2.y());
 }
 
-void arona::enterCafe1FromCafe2(HWND hwnd)
+ScriptTask<> arona::enterCafe1FromCafe2(HWND hwnd)
 {
     // 从咖啡厅2进入大厅
-    click(hwnd, BUTTON_CAFE2_TO_CAFE1.x(), BUTTON_CAFE2_TO_CAFE1.y());
+    co_await click(hwnd, BUTTON_CAFE2_TO_CAFE1.x(), BUTTON_CAFE2_TO_CAFE1.y());
 }
 
-bool arona::inviteStudentByName(HWND hwnd, QStringList studentNames, QString titleStr)
+ScriptTask<bool> arona::inviteStudentByName(HWND hwnd, QStringList studentNames, QString titleStr)
 {
     // 邀请学生进入咖啡厅
     // 点击邀请券，打开邀请界面
-    click(hwnd, BUTTON_INVITATION_TICKET.x(), BUTTON_INVITATION_TICKET.y());
+    co_await click(hwnd, BUTTON_INVITATION_TICKET.x(), BUTTON_INVITATION_TICKET.y());
     
     // 等待邀请界面就绪
-    int retries = 50;
-    while (retries > 0) {
-        delayMs(100);
-        QImage screenshot = captureWindow(hwnd);
-        if (isPositionReady(screenshot, INVITATION_INTERFACE_ROI)) {
-            break;
-        }
-        if (shouldStop) {
+    if (!co_await waitUntil(hwnd, 5000, [&]() { return isRoiReady(hwnd, INVITATION_INTERFACE_ROI); })) {
+        if (stopToken.isCancelled()) {
             appendLog("========== 脚本已停止 ==========917", "WARNING");
-            isRunning = false;
-            updateStartButtonState();
-            return false;
+            co_return false;
         }
-        retries--;
-    }
-
-    if (retries <= 0) {
         appendLog("邀请界面未就绪，超时退出", "WARNING");
-        return false;
-    }
-
-    QImage screenshot = captureWindow(hwnd);
-    if (screenshot.isNull()) {
-        appendLog("截图失败", "ERROR");
-        return false;
+        co_return false;
+    }
+    
+    // 邀请提示框是否显示（只判断是否出现，具体是哪种提示由checkNotice识别）
+    auto noticeShown = [&]() { return isRoiReady(hwnd, INVITATION_NOTICE_ROI); };
+    auto noticeClosed = [&]() { return !noticeShown(); };
+    // 确认邀请后等待邀请界面关闭（同一帧同时判断邀请界面和提示框）
+    const QVector<QRect> invitationRois = screenRecognizer.readyRois(INVITATION_INTERFACE_ROI)
+                                        + screenRecognizer.readyRois(INVITATION_NOTICE_ROI);
+    auto invitationClosed = [&]() {
+        ScreenState state = screenState(hwnd, invitationRois);
+        return !isPositionReady(state, INVITATION_INTERFACE_ROI) && !isPositionReady(state, INVITATION_NOTICE_ROI);
+    };
+
+    // 一次性匹配所有学生（关闭提示框后列表不变，后续学生复用同一次匹配结果）
+    QVector<int> studentPositions;
+    {
+        QImage screenshot = captureWindow(hwnd);
+        if (screenshot.isNull()) {
+            appendLog("截图失败", "ERROR");
+            co_return false;
+        }
+        studentPositions = findStudentsInInvitationInterface(screenshot, studentNames);
     }
     
-    // 查找对应学生
+    // 按优先级依次处理
     for (int i = 0; i < studentNames.size(); i++) {
-        int studentIndex = findStudentInInvitationInterface(screenshot, studentNames[i]);
+        int studentIndex = studentPositions[i];
         if (studentIndex == 0) {
             appendLog(QString("%1已经在咖啡厅了").arg(studentNames[i]), "WARNING");
             continue;
@@ -1445,53 +1716,53 @@ bool arona::inviteStudentByName(HWND hwnd, QStringList studentNames, QString tit
 
         // appendLog(QString("在邀请界面找到%1, 位置: %2").arg(studentNames[i]).arg(studentIndex), "INFO");
 
-        // 点击学生
-        click(hwnd, 1150, studentIndex);
-        delayMs(1500);
+        // 点击学生，等待提示框出现并且弹出动画结束后再识别提示内容
+        co_await click(hwnd, 1150, studentIndex);
+        co_await waitUntil(hwnd, 5000, noticeShown);
+        co_await waitForSettle(hwnd, INVITATION_NOTICE_ROI, "邀请提示");
 
-        QImage inviteImage = captureWindow(hwnd);
-        QString notice = checkNotice(inviteImage, INVITATION_NOTICE_ROI);
+        RoiFrame inviteImage;
+        ScreenState noticeState = screenState(hwnd, screenRecognizer.readyRois(INVITATION_NOTICE_ROI), &inviteImage);
+        QString notice = checkNotice(inviteImage, noticeState, INVITATION_NOTICE_ROI);
         
         // 获取当前学生的强制邀请设置
-        // Key格式: "窗口标题|学生名称"
-        QString forceInviteKey = titleStr + "|" + studentNames[i];
-        bool forceInvite = forceInviteEnabled.value(forceInviteKey, false);
+        bool forceInvite = scriptWindow()->config.forceInvite.value(studentNames[i], false);
         
         if (notice == "(921,223)ChangeClothes" || notice == "(921,223)ChangeClothes_JP") {
             if (forceInvite) {
                 appendLog(QString("%1正穿着另一件衣服，强制邀请").arg(studentNames[i]), "SUCCESS");
-                click(hwnd, 1150, 775);
-                delayMs(2500);
-                return true;
+                co_await click(hwnd, 1150, 775);
+                co_await waitUntil(hwnd, 5000, invitationClosed);
+                co_return true;
             } else {
                 appendLog(QString("%1正穿着另一件衣服，跳过").arg(studentNames[i]), "SUCCESS");
-                click(hwnd, 1317, 260);
+                co_await click(hwnd, 1317, 260);
             }
         }
         else if (notice == "(921,223)NextRoomAndOtherClothes" || notice == "(921,223)NextRoomAndOtherClothes_JP") {
             if (forceInvite) {
                 appendLog(QString("%1正在另一个咖啡厅，并且穿着另一件衣服，强制邀请").arg(studentNames[i]), "SUCCESS");
-                click(hwnd, 1150, 775);
-                delayMs(2500);
-                return true;
+                co_await click(hwnd, 1150, 775);
+                co_await waitUntil(hwnd, 5000, invitationClosed);
+                co_return true;
             } else {
                 appendLog(QString("%1正在另一个咖啡厅，并且穿着另一件衣服，跳过").arg(studentNames[i]), "SUCCESS");
-                click(hwnd, 1317, 260);
+                co_await click(hwnd, 1317, 260);
             }
         }
         else if (notice == "(921,223)NextRoom" || notice == "(921,223)NextRoom_JP") {
             appendLog(QString("%1正在另一个咖啡厅").arg(studentNames[i]), "SUCCESS");
-            click(hwnd, 1317, 260);
+            co_await click(hwnd, 1317, 260);
         }
         else if (notice == "(921,223)Notice" || notice == "(921,223)Notice_JP") {
             appendLog(QString("邀请%1前来咖啡厅").arg(studentNames[i]), "SUCCESS");
 
             // // 调试
-            // return false;
+            // co_return false;
 
-            click(hwnd, 1150, 775);
-            delayMs(2500);
-            return true;
+            co_await click(hwnd, 1150, 775);
+            co_await waitUntil(hwnd, 5000, invitationClosed);
+            co_return true;
         }
         else {
             appendLog(QString("异常位置：%1, 通知：%2").arg(studentNames[i]).arg(notice), "WARNING");
@@ -1499,138 +1770,144 @@ bool arona::inviteStudentByName(HWND hwnd, QStringList studentNames, QString tit
             // appendLog("========== 脚本已停止 ==========1741", "WARNING");
             // isRunning = false;
             // updateStartButtonState();
-            return false;
+            co_return false;
         }
-        delayMs(1000);
+        // 等待提示框关闭再点击下一个学生
+        co_await waitUntil(hwnd, 3000, noticeClosed);
     }
     
-    return false;
+    co_return false;
 }
 
-int arona::findStudentInInvitationInterface(QImage image, QString studentName)
+QVector<arona::InvitationSlot> arona::extractInvitationSlots(const QImage &image)
 {
-    // 查找对应学生
-    // 从(1100, 280)开始向下搜索#77DEFF颜色
-    int studentIndex = 1;
+    // 提取邀请界面中所有学生栏位
+    // 从(1100, 280)开始向下搜索#77DEFF颜色，连续68个像素为标记，标记下方7像素处为168x36的头像
+    QVector<InvitationSlot> slots;
     const int searchX = 1100;
     const int captureX = 732;
     const int startY = 280;
     const int maxY = 830;
+    const int markerLength = 68;     // 标记长度（起点 + 向下连续67个像素）
     const int studentHeight = 36;
-    const int studentWidth = 168;  // 修改为168像素
+    const int studentWidth = 168;
     const int verticalSpacing = 110; // 从当前y位置向下110像素继续搜索
     const int yOffset = 7;           // 找到标记后，向下偏移7像素截取头像
 
+    if (searchX >= image.width()) {
+        return slots;
+    }
+
     // 目标颜色 #77DEFF (RGB: 119, 222, 255)
     QRgb targetColor = qRgb(119, 222, 255);
-
-    int currentY = startY;
-    int foundCount = 0;
-    
-    // 从预加载的二值化模板中获取学生模板
-    if (!binarizedStudentTemplates.contains(studentName)) {
-        appendLog(QString("未找到学生的二值化模板: %1").arg(studentName), "ERROR");
-        return 0;
-    }
-    
-    StudentTemplate templateData = binarizedStudentTemplates[studentName];
-    
-    // appendLog(QString("已找到学生模板: %1, 尺寸: %2x%3, 二值化数据大小: %4")
-    //          .arg(studentName)
-    //          .arg(templateData.width)
-    //          .arg(templateData.height)
-    //          .arg(templateData.binaryData.size()), "INFO");
     
     // 背景色 #F3F7F8
     QRgb backgroundColor = qRgb(243, 247, 248);
 
-    while (currentY <= maxY)
-    {
-        // 检查图像边界
-        if (currentY < 0 || currentY >= image.height() || searchX >= image.width())
-        {
-            break;
+    // 记录当前位置向下连续为目标颜色的像素数，避免对每个起点重复检查67个像素
+    int currentY = startY;
+    int runStart = -1;
+    int lastY = qMin(maxY + markerLength - 1, image.height() - 1);
+    for (int y = startY; y <= lastY; y++) {
+        bool isMarker = image.pixel(searchX, y) == targetColor;
+        if (!isMarker) {
+            runStart = -1;
+            continue;
         }
-
-        // 检查(searchX, currentY)位置的颜色
-        QRgb pixelColor = image.pixel(searchX, currentY);
-
-        // 如果找到目标颜色
-        if (pixelColor == targetColor)
-        {
-            // 向下检查连续67个像素是否都是#77DEFF
-            bool allMatch = true;
-            for (int i = 1; i <= 67; i++)
-            {
-                if (currentY + i >= image.height())
-                {
-                    allMatch = false;
-                    break;
-                }
-                QRgb checkColor = image.pixel(searchX, currentY + i);
-                if (checkColor != targetColor)
-                {
-                    allMatch = false;
-                    break;
-                }
+        if (runStart < 0) {
+            runStart = qMax(y, currentY);
+        }
+        if (y - runStart + 1 < markerLength || runStart > maxY) {
+            continue;
+        }
+        
+        // 找到完整的标记，截取位置在标记起点下方
+        int markerY = runStart;
+        int captureY = markerY - yOffset;
+        if (captureY >= 0 && captureY + studentHeight <= image.height() &&
+            captureX >= 0 && captureX + studentWidth <= image.width()) {
+            // 直接从截图的扫描行二值化头像区域，不复制图像
+            QRect avatarRect(captureX, captureY, studentWidth, studentHeight);
+            InvitationSlot slot;
+            slot.markerY = markerY;
+            slot.bits = binarizeImage(image, backgroundColor, avatarRect);
+            slots.append(slot);
+
+            // 保存头像用于制作模板（默认关闭，关闭时不复制图像）
+            if (saveAvatarImages) {
+                debugImages.submit("student_avatar", image.copy(avatarRect), QString("student_avatar%1.png").arg(slots.size()));
             }
+        }
 
-            // 如果连续67个像素都匹配
-            if (allMatch)
-            {
-                foundCount++;
-
-                // 计算截取位置
-                int captureY = currentY - yOffset;
-
-                // 检查截取区域是否在图像范围内
-                if (captureY >= 0 && captureY + studentHeight <= image.height() &&
-                    captureX >= 0 && captureX + studentWidth <= image.width())
-                {
-
-                    // 截取168x36像素的学生头像
-                    QImage studentImg = image.copy(captureX, captureY, studentWidth, studentHeight);
-                    QString studentPath = QString("screenshots/student_avatar%1.png").arg(studentIndex);
-
-                    // 保存截图用于调试
-                    if (studentImg.save(studentPath))
-                    {
-                        // appendLog(QString("已保存student_avatar_%1: 标记位置(%2, %3), 截取位置(%2, %4)")
-                        //               .arg(studentIndex)
-                        //               .arg(searchX)
-                        //               .arg(currentY)
-                        //               .arg(captureY),
-                        //           "INFO");
-                        studentIndex++;
-                    }
+        // 从标记位置向下110像素继续搜索
+        currentY = markerY + verticalSpacing;
+        runStart = -1;
+        y = currentY - 1;
+    }
 
-                    // 使用汉明距离进行比较（二值化 + 汉明距离）
-                    // 相似度阈值设为0.90，即允许10%的像素不同
-                    if (compareImagesByHamming(studentImg, templateData.binaryData, templateData.width, templateData.height, backgroundColor, 0.90)) {
-                        appendLog(QString("找到匹配的学生: %1").arg(studentName), "SUCCESS");
-                        return currentY;
-                    } else {
-                        // appendLog(QString("学生头像不匹配: %1").arg(studentName), "INFO");
-                    }
-                }
+    return slots;
+}
 
-                // 从当前位置向下110像素继续搜索
-                currentY += verticalSpacing;
+QVector<int> arona::findStudentsInInvitationInterface(const QImage &image, const QStringList &studentNames)
+{
+    // 为邀请列表中的每个学生找到对应的栏位，返回值与studentNames一一对应（标记Y坐标，0表示未找到）
+    // 先提取所有栏位，计算 栏位 x 学生 的汉明距离矩阵，再按学生优先级依次选择距离最小且未被占用的栏位
+    QVector<int> positions(studentNames.size(), 0);
+    QVector<InvitationSlot> slots = extractInvitationSlots(image);
+    if (slots.isEmpty()) {
+        return positions;
+    }
+    
+    // 相似度阈值0.90，即允许10%的像素不同
+    const double threshold = 0.90;
+    const int slotCount = slots.size();
+    const int studentCount = studentNames.size();
+    QVector<int> distances(slotCount * studentCount, -1);  // -1 表示超出阈值或无模板
+    
+    for (int j = 0; j < studentCount; j++) {
+        if (!binarizedStudentTemplates.contains(studentNames[j])) {
+            appendLog(QString("未找到学生的二值化模板: %1").arg(studentNames[j]), "ERROR");
+            continue;
+        }
+        const StudentTemplate &templateData = binarizedStudentTemplates[studentNames[j]];
+        int budget = ImageKernels::hammingBudget(templateData.width * templateData.height, threshold);
+        for (int i = 0; i < slotCount; i++) {
+            int distance = calculateHammingDistance(slots[i].bits, templateData.bits, budget);
+            if (distance >= 0 && distance <= budget) {
+                distances[i * studentCount + j] = distance;
             }
-            else
-            {
-                // 如果不是连续67个像素都匹配，继续向下搜索
-                currentY++;
+        }
+    }
+    
+    // 按优先级分配栏位：同一个栏位只分配给优先级最高的学生
+    QVector<bool> slotTaken(slotCount, false);
+    for (int j = 0; j < studentCount; j++) {
+        int bestSlot = -1;
+        for (int i = 0; i < slotCount; i++) {
+            int distance = distances[i * studentCount + j];
+            if (distance < 0 || slotTaken[i]) {
+                continue;
+            }
+            if (bestSlot < 0 || distance < distances[bestSlot * studentCount + j]) {
+                bestSlot = i;
             }
         }
-        else
-        {
-            // 颜色不匹配，继续向下搜索
-            currentY++;
+        if (bestSlot < 0) {
+            continue;
         }
-    }
-
-    return 0;
+        
+        slotTaken[bestSlot] = true;
+        positions[j] = slots[bestSlot].markerY;
+        const StudentTemplate &templateData = binarizedStudentTemplates[studentNames[j]];
+        int totalPixels = templateData.width * templateData.height;
+        double similarity = 1.0 - (double)distances[bestSlot * studentCount + j] / totalPixels;
+        appendLog(QString("找到匹配的学生: %1（第%2栏，相似度: %3）")
+                 .arg(studentNames[j])
+                 .arg(bestSlot + 1)
+                 .arg(similarity, 0, 'f', 4), "SUCCESS");
+    }
+
+    return positions;
 }
 
 bool arona::compareImagesByOddRows(const QImage &image1, const QImage &image2)
@@ -1693,37 +1970,33 @@ bool arona::compareImagesByOddRows(const QImage &image1, const QImage &image2)
     return true;
 }
 
-QString arona::checkNotice(QImage screenshot, QRect roi)
+QString arona::checkNotice(const RoiFrame &screenshot, const ScreenState &state, QRect roi)
 {
-    QImage noticeImage = screenshot.copy(roi);
-
-    QString hash = calculateImageHash(noticeImage);
-    if (positionReadyTemplates.values().contains(hash)) {
-        qDebug() << "识别到邀请通知,键: " << positionReadyTemplates.key(hash);
-        return positionReadyTemplates.key(hash);
+    // 查找容差范围内距离最近的模板
+    const ScreenState::Match *match = state.nearestAt(roi);
+    if (match) {
+        qDebug() << "识别到邀请通知,键: " << match->key << ", 汉明距离: " << match->distance;
+        return match->key;
     }
     else
     {
-        // 保存截图
+        // 保存截图（仅在识别失败时裁剪，被限速或关闭时不保存）
+        QImage noticeImage = screenshot.copy(roi);
         QString timestamp = QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss");
-        QString screenshotPath = "screenshots/notice_" + timestamp + ".png";
-        if (noticeImage.save(screenshotPath)) {
+        QString screenshotPath = debugImages.submit("notice", noticeImage, "notice_" + timestamp + ".png");
+        if (!screenshotPath.isEmpty()) {
             appendLog(QString("已保存邀请通知截图: %1").arg(screenshotPath), "SUCCESS");
         }
-        else {
-            appendLog("保存邀请通知截图失败", "ERROR");
-        }
     }
 
     return "";
 }
 
-bool arona::isPositionReady(QImage screenshot, QRect roi)
+bool arona::isPositionReady(const ScreenState &state, QRect roi)
 {
     // 检查位置是否就绪
-    QImage positionReady = screenshot.copy(roi);
-
     // 保存截图
+    // QImage positionReady = screenshot.copy(roi);
     // QString timestamp = QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss");
     // QString screenshotPath = "screenshots/position_ready_" + timestamp + ".png";
     // if (positionReady.save(screenshotPath)) {
@@ -1733,23 +2006,82 @@ bool arona::isPositionReady(QImage screenshot, QRect roi)
     //     appendLog("保存位置就绪截图失败", "ERROR");
     // }
     
-    QString hash = calculateImageHash(positionReady);
-    if (positionReadyTemplates.values().contains(hash)) {
-        qDebug() << "位置就绪,键: " << positionReadyTemplates.key(hash);
+    const ScreenState::Match *match = state.nearestAt(roi);
+    if (match) {
+        qDebug() << "位置就绪,键: " << match->key << ", 汉明距离: " << match->distance;
         return true;
     }
 
     // 打印哈希值
-    // qDebug() << "位置就绪哈希值: " << hash;
+    // qDebug() << "位置就绪哈希值: " << QString::number(calculateImageHash(screenshot, roi), 16);
     // for (auto it = positionReadyTemplates.begin(); it != positionReadyTemplates.end(); ++it) {
-    //     qDebug() << "位置就绪模板键: " << it.key() << " 哈希值: " << it.value();
+    //     qDebug() << "位置就绪模板键: " << it.key() << " 哈希值: " << QString::number(it.value().hash, 16);
     // }
     return false;
 }
 
 // ==================== 辅助逻辑函数实现（封装重复逻辑） ====================
 
-bool arona::waitForPosition(HWND hwnd, const QString &targetPosition, int maxRetries, int delayMs, int clickX, int clickY)
+ScreenState arona::screenState(HWND hwnd, const QVector<QRect> &rois, RoiFrame *frame)
+{
+    // 每一帧只做一次classify，位置、就绪和通知的判断都从同一个识别结果中读取
+    // classify只评估截取到的ROI，只截取需要的ROI时开销与单独匹配相同
+    RoiFrame screenshot = captureRegions(hwnd, rois);
+    if (frame) {
+        *frame = screenshot;
+    }
+    return screenRecognizer.classify(screenshot, windowKeyForHandle(hwnd));
+}
+
+bool arona::isAtPosition(HWND hwnd, const QString &position)
+{
+    ScreenState state = screenState(hwnd, screenRecognizer.positionRois(position));
+    return recognizeCurrentPosition(state, position, windowKeyForHandle(hwnd)) == position;
+}
+
+bool arona::isRoiReady(HWND hwnd, const QRect &roi)
+{
+    return isPositionReady(screenState(hwnd, screenRecognizer.readyRois(roi)), roi);
+}
+
+ScriptTask<bool> arona::waitForSettle(HWND hwnd, QRect roi, QString transition, int timeoutMs)
+{
+    // 等待ROI内的动画（弹出、淡入等）结束后再识别或点击，按过渡名称记录稳定耗时
+    SettleDetector detector(roi);
+    const qint64 startedAt = CaptureWorker::clockMs();
+    const bool settled = co_await waitUntil(hwnd, timeoutMs, [&]() {
+        // 按帧开始截取的时刻计时（取到的可能是截图线程稍早截好的一帧）
+        qint64 capturedAt = 0;
+        RoiFrame frame = captureRegions(hwnd, {roi}, &capturedAt);
+        return detector.feed(frame, capturedAt);
+    });
+    if (stopToken.isCancelled()) {
+        co_return false;
+    }
+    
+    // 稳定耗时为画面最后一次变化的时刻，不含确认稳定所需的几帧
+    const qint64 settleMs = settled ? qMax<qint64>(0, detector.unchangedSince() - startedAt)
+                                    : CaptureWorker::clockMs() - startedAt;
+    {
+        QMutexLocker locker(&settleMutex);
+        SettleStats &stats = settleStats[windowKeyForHandle(hwnd)][transition];
+        stats.count++;
+        stats.totalMs += settleMs;
+        stats.maxMs = qMax(stats.maxMs, settleMs);
+        if (!settled) {
+            stats.timeouts++;
+        }
+    }
+    
+    if (!settled) {
+        appendLog(QString("画面未稳定：%1（超过%2ms）").arg(transition).arg(timeoutMs), "WARNING");
+    } else if (settleMs >= SLOW_SETTLE_MS) {
+        appendLog(QString("画面稳定较慢：%1用时%2ms").arg(transition).arg(settleMs), "WARNING");
+    }
+    co_return settled;
+}
+
+ScriptTask<bool> arona::waitForPosition(HWND hwnd, QString targetPosition, int maxRetries, int delayMs, int clickX, int clickY)
 {
     if (targetPosition == "SweepConfirm") 
     {
@@ -1760,154 +2092,294 @@ bool arona::waitForPosition(HWND hwnd, const QString &targetPosition, int maxRet
         appendLog(QString("等待进入位置: %1 ").arg(targetPosition).arg(maxRetries), "INFO");
     }
     
+    // 过渡耗时模型（按窗口和目标位置）：样本足够时超时为p99乘以余量，且不超过固定参数给出的总时长
+    // 过渡从引起它的输入（进入本函数前最后一次发送的输入）开始计时；没有输入记录时从进入本函数开始
+    const QString transitionKey = TransitionModel::key(windowKeyForHandle(hwnd), targetPosition);
+    const TransitionModel::Estimate expected = adaptiveTransitions ? transitionModel.estimate(transitionKey)
+                                                                   : TransitionModel::Estimate();
+    const qint64 startedAt = CaptureWorker::clockMs();
+    qint64 causedAt;
+    {
+        QMutexLocker locker(&captureMutex);
+        causedAt = lastInputAt.value(hwnd, 0);
+    }
+    const bool hasCause = causedAt > 0 && causedAt <= startedAt;
+    if (!hasCause) {
+        causedAt = startedAt;
+    }
+    qint64 deadline = startedAt + qint64(maxRetries) * delayMs;
+    if (expected.isWarm()) {
+        deadline = qMin(deadline, qMax<qint64>(startedAt + TRANSITION_MIN_TIMEOUT_MS,
+                                               causedAt + qint64(expected.p99 * transitionTimeoutMargin)));
+    }
+    
+    auto isAtTarget = [&]() { return isAtPosition(hwnd, targetPosition); };
+    
     int retries = maxRetries;
+    bool isReached = false;
+    bool firstCheck = false;
     while (retries > 0)
     {
         // 检查是否需要停止
-        if (shouldStop) {
+        if (stopToken.isCancelled()) {
             appendLog("========== 脚本已停止 ==========1159", "WARNING");
-            isRunning = false;
-            updateStartButtonState();
-            return false;
+            co_return false;
         }
 
-        // 截图并识别当前位置
-        QImage screenshot = captureWindow(hwnd);
-        QString currentPosition = recognizeCurrentPosition(screenshot, targetPosition);
-        
-        if (currentPosition == targetPosition)
+        // 识别输入之后的画面
+        co_await waitForFrame(hwnd);
+        if (isAtTarget())
         {
-            // 点击游戏窗口边缘（防止超时）
-            if (targetPosition != "SweepConfirm")
-            {
-                click(hwnd, clickX, clickY);
-                delayMsWithCheck(500);
-            }
-            return true;
+            isReached = true;
+            firstCheck = retries == maxRetries;
+            break;
+        }
+        const qint64 remaining = deadline - CaptureWorker::clockMs();
+        if (remaining <= 0)
+        {
+            break;
         }
 
         if (targetPosition != "SweepConfirm")
         {
             // 点击游戏窗口边缘（防止超时）
-            click(hwnd, clickX, clickY);
+            co_await click(hwnd, clickX, clickY);
         }
 
-        // 延时并检查停止信号
-        if (!delayMsWithCheck(delayMs)) {
+        // 延时期间每到一帧新画面就重新识别，进入目标位置后立即返回，不必等完整的延时
+        if (co_await waitUntil(hwnd, int(qMin<qint64>(delayMs, remaining)), isAtTarget, expected, causedAt))
+        {
+            isReached = true;
+            break;
+        }
+        if (stopToken.isCancelled()) {
             appendLog("========== 脚本已停止 ==========1179", "WARNING");
-            isRunning = false;
-            updateStartButtonState();
-            return false;
+            co_return false;
         }
 
         retries--;
     }
     
+    if (isReached)
+    {
+        // 第一次检查就已到达且没有输入记录时，过渡在开始观察之前就已完成，耗时未知，不记录（否则是0ms样本）
+        const qint64 elapsedMs = CaptureWorker::clockMs() - causedAt;
+        if ((hasCause || !firstCheck) && elapsedMs > 0) {
+            transitionModel.record(transitionKey, elapsedMs);
+        }
+        // 点击游戏窗口边缘（防止超时）
+        if (targetPosition != "SweepConfirm")
+        {
+            co_await click(hwnd, clickX, clickY);
+            co_await this->delayMs(500);  // 参数delayMs遮蔽了成员函数
+        }
+        co_return true;
+    }
+    
     // 超时失败
     if (targetPosition == "SweepConfirm") 
     {
+        // 没有可挑战次数时本来就不会出现，超时是正常结果，不计入过渡耗时
     }
     else
     {
+        // 记录为删失样本：下一次使用固定参数的完整时长，较慢的过渡可以被记录下来
+        transitionModel.recordTimeout(transitionKey, CaptureWorker::clockMs() - causedAt);
         appendLog(QString("进入%1失败（超时）").arg(targetPosition), "ERROR");
     }
     // isRunning = false;
     // updateStartButtonState();
-    return false;
+    co_return false;
 }
 
-bool arona::adjustCafeView(HWND hwnd, int scrollX, int scrollY, int scrollCount)
+ScriptTask<bool> arona::adjustCafeView(HWND hwnd, int scrollX, int scrollY, int scrollCount)
 {
     // appendLog(QString("开始调整咖啡厅视角（滚动%1次）").arg(scrollCount), "INFO");
     
+    // 焦点和CTRL键是全局的：其他窗口的脚本要等这里滚动完成后才能进行同类操作
+    if (!co_await acquireGlobalInput(hwnd)) {
+        if (!stopToken.isCancelled()) {
+            appendLog("等待全局输入超时，跳过视角调整", "WARNING");
+        }
+        co_return false;
+    }
+    
     // 唤醒游戏窗口
     SetFocus(hwnd);
-    delayMs(200);
+    co_await delayMs(200);
 
     // moveMouseToWindow(hwnd, scrollX, scrollY);
     
     // 按下CTRL键
     pressKeyGlobal(VK_CONTROL, 1);
     
-    if (!delayMsWithCheck(500)) {
+    if (!co_await delayMs(500)) {
         appendLog("========== 脚本已停止 ==========1210", "WARNING");
-        isRunning = false;
-        updateStartButtonState();
         // 抬起CTRL键
         pressKeyGlobal(VK_CONTROL, 0);
-        return false;
+        inputArbiter.release();
+        co_return false;
     }
     
     // 循环滚动鼠标滚轮
     for (int i = 0; i < scrollCount; i++)
     {
-        if (shouldStop) {
+        if (stopToken.isCancelled()) {
             appendLog("========== 脚本已停止 ==========1221", "WARNING");
-            isRunning = false;
-            updateStartButtonState();
             // 抬起CTRL键
             pressKeyGlobal(VK_CONTROL, 0);
-            return false;
+            inputArbiter.release();
+            co_return false;
         }
         
         scroll(hwnd, scrollX, scrollY, -3);
         
-        if (!delayMsWithCheck(200)) {
+        if (!co_await delayMs(200)) {
             appendLog("========== 脚本已停止 ==========1231", "WARNING");
-            isRunning = false;
-            updateStartButtonState();
             // 抬起CTRL键
             pressKeyGlobal(VK_CONTROL, 0);
-            return false;
+            inputArbiter.release();
+            co_return false;
         }
     }
     
     // 释放CTRL键
     pressKeyGlobal(VK_CONTROL, 0);
+    inputArbiter.release();
     
     // appendLog("咖啡厅视角调整完成", "SUCCESS");
-    return true;
+    co_return true;
 }
 
-void arona::adjustCafePosition(HWND hwnd)
-{
-    // appendLog("开始调整咖啡厅位置（3次拖拽）", "INFO");
-    
-    drag(hwnd, 1680, 240, 130, 1040, 1000);
-    drag(hwnd, 400, 400, 1900, 900, 1000);
-    drag(hwnd, 1080, 1040, 1680, 240, 1000);
-    
-    // appendLog("咖啡厅位置调整完成", "SUCCESS");
+ScriptTask<> arona::adjustCafePosition(HWND hwnd)
+{
+    // appendLog("开始调整咖啡厅位置（3次拖拽）", "INFO");
+    
+    co_await drag(hwnd, 1680, 240, 130, 1040, 1000);
+    co_await drag(hwnd, 400, 400, 1900, 900, 1000);
+    co_await drag(hwnd, 1080, 1040, 1680, 240, 1000);
+    
+    // appendLog("咖啡厅位置调整完成", "SUCCESS");
+}
+
+ScriptTask<> arona::patStudents(HWND hwnd, int rounds)
+{
+    for (int i = 0; i < rounds; i++)
+    {
+        if (stopToken.isCancelled()) {
+            appendLog("========== 脚本已停止 ==========1263", "WARNING");
+            co_return;
+        }
+        
+        // appendLog(QString("摸头第%1/%2轮").arg(i + 1).arg(rounds), "INFO");
+        if (headpatByVision)
+        {
+            // 只点击头顶有互动气泡的学生；刷新后仍然没有气泡时说明都摸过了，提前结束
+            bool uncleared = false;
+            const int patted = co_await patVisibleStudents(hwnd, &uncleared);
+            if (uncleared && headpatGridFallback)
+            {
+                appendLog("点击后互动气泡没有消失，使用地毯式点击", "INFO");
+                co_await clickGrid(hwnd, 200, 240, 1900, 880, 50, 20);
+                co_await delayMs(1000);
+            }
+            else if (patted == 0 && i > 0)
+            {
+                appendLog("没有可摸头的学生，摸头结束", "INFO");
+                co_return;
+            }
+        }
+        else
+        {
+            co_await clickGrid(hwnd, 200, 240, 1900, 880, 50, 20);
+            co_await delayMs(1000);
+        }
+
+        if (i < rounds - 1)
+        {
+            if (!co_await refreshCafe(hwnd))
+            {
+                appendLog("刷新咖啡厅失败", "ERROR");
+                co_return;
+            }
+        }
+        co_await delayMs(500);
+    }
 }
 
-void arona::patStudents(HWND hwnd, int rounds)
+ScriptTask<int> arona::patVisibleStudents(HWND hwnd, bool *uncleared)
 {
-    for (int i = 0; i < rounds; i++)
+    // 点击完一批气泡后重新截图，之前被挡住的气泡可能露出来；没有气泡时结束
+    // 上一批点过的气泡仍在原处时说明点击没有摸到学生（或识别到的不是气泡），不再重复点击
+    int patted = 0;
+    QVector<HeadpatDetector::Bubble> clicked;
+    if (uncleared) {
+        *uncleared = false;
+    }
+    for (int pass = 0; pass < HEADPAT_MAX_PASSES; pass++)
     {
-        if (shouldStop) {
-            appendLog("========== 脚本已停止 ==========1263", "WARNING");
-            isRunning = false;
-            updateStartButtonState();
-            return;
+        // 识别点击之后的画面（截图在挂起前释放，不占用截图线程的缓冲区）
+        co_await waitForFrame(hwnd);
+        QVector<HeadpatDetector::Bubble> bubbles;
+        {
+            QImage image = captureWindow(hwnd);
+            if (image.isNull())
+            {
+                break;
+            }
+            bubbles = headpatDetector.detect(image, HEADPAT_AREA);
+        }
+        if (bubbles.isEmpty())
+        {
+            break;
+        }
+        bool stillThere = false;
+        for (const HeadpatDetector::Bubble &bubble : bubbles)
+        {
+            for (const HeadpatDetector::Bubble &previous : clicked)
+            {
+                if (bubble.bounds.intersects(previous.bounds))
+                {
+                    stillThere = true;
+                }
+            }
+        }
+        if (stillThere)
+        {
+            if (uncleared) {
+                *uncleared = true;
+            }
+            break;
         }
+        clicked = bubbles;
         
-        // appendLog(QString("摸头第%1/%2轮").arg(i + 1).arg(rounds), "INFO");
-        clickGrid(hwnd, 200, 240, 1900, 880, 50, 20);
-        delayMs(1000);
-
-        if (i < 2)
+        for (const HeadpatDetector::Bubble &bubble : bubbles)
         {
-            if (!refreshCafe(hwnd))
+            int x = bubble.center.x();
+            int y = qMin(bubble.center.y() + headpatClickOffsetY, HEADPAT_AREA.bottom());
+            co_await click(hwnd, x, y);
+            patted++;
+            if (!co_await delayMs(HEADPAT_CLICK_INTERVAL_MS))
             {
-                appendLog("刷新咖啡厅失败", "ERROR");
-                return;
+                co_return patted;
             }
         }
-        delayMs(500);
+        
+        // 等待反应动画结束、气泡消失后再识别下一批
+        if (!co_await delayMs(1000))
+        {
+            break;
+        }
     }
+    
+    if (patted > 0)
+    {
+        appendLog(QString("摸头：点击了%1个学生").arg(patted), "INFO");
+    }
+    co_return patted;
 }
 
-void arona::closeGameWindow(HWND hwnd)
+ScriptTask<> arona::closeGameWindow(HWND hwnd)
 {
     // 找到父窗口，关闭游戏
     HWND parentHwnd = GetParent(hwnd);
@@ -1921,7 +2393,7 @@ void arona::closeGameWindow(HWND hwnd)
         if (!titleStr.isEmpty())
         {
             // 点击关闭按钮
-            click(parentHwnd, 703, 30);
+            co_await click(parentHwnd, 703, 30);
             appendLog(QString("已关闭窗口: %1").arg(titleStr), "SUCCESS");
         }
         else
@@ -1935,22 +2407,22 @@ void arona::closeGameWindow(HWND hwnd)
     }
 }
 
-void arona::closeGameWindowByReturn(HWND hwnd)
+ScriptTask<> arona::closeGameWindowByReturn(HWND hwnd)
 {
     // 找到父窗口，关闭游戏
     HWND parentHwnd = GetParent(hwnd);
     if (parentHwnd != NULL)
     {
         // 点击返回按钮
-        click(parentHwnd, 1600, 30);
-        delayMs(1000);
-        if (!waitForPosition(hwnd, "CloseGame", 20, 1000, 585, 244))
+        co_await click(parentHwnd, 1600, 30);
+        co_await delayMs(1000);
+        if (!co_await waitForPosition(hwnd, "CloseGame", 20, 1000, 585, 244))
         {
             appendLog("关闭游戏失败", "ERROR");
-            return;
+            co_return;
         }
-        click(hwnd, 1145, 756);
-        delayMs(1000);
+        co_await click(hwnd, 1145, 756);
+        co_await delayMs(1000);
     }
 }
 
@@ -1966,11 +2438,17 @@ void arona::onDebugTypeChanged(int index)
     } else if (index == 2) {  // 按键调试
         keyDebugWidget->setVisible(true);
     }
-    // index == 0 (截图调试) 不需要额外参数，都隐藏
+    // index == 0 (截图调试)、index == 3 (性能测试) 不需要额外参数，都隐藏
 }
 
 void arona::onDebugButtonClicked()
 {
+    // 调试功能会在GUI线程截图和识别，与引擎线程争用截图线程的最新帧
+    if (engineThread) {
+        appendLog("脚本运行中，请停止后再调试", "WARNING");
+        return;
+    }
+    
     int debugType = debugTypeComboBox->currentIndex();
     
     if (debugType == 0) {
@@ -1982,6 +2460,9 @@ void arona::onDebugButtonClicked()
     } else if (debugType == 2) {
         // 按键调试
         keyDebug();
+    } else if (debugType == 3) {
+        // 性能测试
+        benchmarkDebug();
     }
 }
 
@@ -1999,11 +2480,9 @@ void arona::screenshotDebug()
         return;
     }
     
-    // 创建screenshots目录
-    QDir dir;
-    if (!dir.exists("screenshots")) {
-        dir.mkdir("screenshots");
-    }
+    // 一次评估所有已登记的ROI，输出当前画面的识别结果
+    ScreenState state = screenRecognizer.classify(image, windowKeyForHandle(hwnd));
+    appendLog(QString("当前画面识别结果: %1").arg(state.matches.isEmpty() ? "无" : state.toString()), "INFO");
     
     // ==================== 新增功能：自动截取学生头像 ====================
     
@@ -2064,9 +2543,9 @@ void arona::screenshotDebug()
                     
                     // 截取168x36像素的学生头像
                     QImage studentImg = image.copy(captureX, captureY, studentWidth, studentHeight);
-                    QString studentPath = QString("screenshots/student%1.png").arg(studentIndex);
+                    QString studentPath = debugImages.submit("student", studentImg, QString("student%1.png").arg(studentIndex));
                     
-                    if (studentImg.save(studentPath)) {
+                    if (!studentPath.isEmpty()) {
                         appendLog(QString("已保存student%1: 标记位置(650, %2), 截取位置(650, %3)")
                                  .arg(studentIndex).arg(currentY).arg(captureY), "SUCCESS");
                         studentIndex++;
@@ -2092,9 +2571,9 @@ void arona::screenshotDebug()
     
     // ==================== 保存完整截图（可选） ====================
     QString timestamp = QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss");
-    QString screenshotPath = QString("screenshots/fullscreen_%1.png").arg(timestamp);
+    QString screenshotPath = debugImages.submit("fullscreen", image, QString("fullscreen_%1.png").arg(timestamp));
     
-    if (image.save(screenshotPath)) {
+    if (!screenshotPath.isEmpty()) {
         appendLog(QString("完整截图已保存: %1").arg(screenshotPath), "INFO");
     }
 }
@@ -2121,8 +2600,8 @@ void arona::clickDebug()
     QImage clickArea = image.copy(x, y, 36, 36);
     // 保存点击区域图像
     QString position = QString("(%1,%2)").arg(x).arg(y);
-    QString clickAreaPath = "screenshots/" + QString("%1clickArea.png").arg(position);
-    if (clickArea.save(clickAreaPath)) {
+    QString clickAreaPath = debugImages.submit("clickArea", clickArea, QString("%1clickArea.png").arg(position));
+    if (!clickAreaPath.isEmpty()) {
         appendLog(QString("点击区域图像保存: %1").arg(clickAreaPath), "SUCCESS");
     } else {
         appendLog("保存点击区域图像失败", "ERROR");
@@ -2207,14 +2686,240 @@ void arona::keyDebug()
     //     appendLog(QString("已完成按键模拟: %1").arg(keyName), "SUCCESS");
     // });
 }
+
+void arona::benchmarkDebug()
+{
+    appendLog("========== 开始性能测试 ==========", "INFO");
+    
+    // ==================== 二值化内核对比 ====================
+    // 使用内置学生头像模板作为测试数据（与邀请界面截取的168x36头像尺寸相同）
+    QRgb backgroundColor = qRgb(243, 247, 248);
+    QVector<QImage> samples;
+    QDir resourceDir(":/images/student_avatar");
+    foreach (QString file, resourceDir.entryList(QDir::Files)) {
+        QImage image(resourceDir.filePath(file));
+        if (!image.isNull()) {
+            samples.append(image.convertToFormat(QImage::Format_RGB32));
+        }
+    }
+    if (samples.isEmpty()) {
+        appendLog("没有可用的测试图像", "ERROR");
+        return;
+    }
+    
+    const int rounds = 20;
+    const int imageCount = samples.size() * rounds;
+    
+    // 原实现：逐像素pixel() + 三次qAbs比较，输出QVector<bool>
+    auto legacyBinarize = [](const QImage &image, QRgb bg) {
+        const int tolerance = 10;
+        QVector<bool> binaryData(image.width() * image.height());
+        for (int y = 0; y < image.height(); y++) {
+            for (int x = 0; x < image.width(); x++) {
+                QRgb pixel = image.pixel(x, y);
+                bool isBackground = (qAbs(qRed(pixel) - qRed(bg)) <= tolerance) &&
+                                    (qAbs(qGreen(pixel) - qGreen(bg)) <= tolerance) &&
+                                    (qAbs(qBlue(pixel) - qBlue(bg)) <= tolerance);
+                binaryData[y * image.width() + x] = !isBackground;
+            }
+        }
+        return binaryData;
+    };
+    
+    QVector<QVector<bool>> legacyResults;
+    QElapsedTimer timer;
+    timer.start();
+    for (int round = 0; round < rounds; round++) {
+        for (const QImage &image : samples) {
+            QVector<bool> result = legacyBinarize(image, backgroundColor);
+            if (round == 0) {
+                legacyResults.append(result);
+            }
+        }
+    }
+    double legacyUs = timer.nsecsElapsed() / 1000.0 / imageCount;
+    appendLog(QString("二值化[原实现 pixel()]: %1 us/张（%2张 x %3轮）")
+             .arg(legacyUs, 0, 'f', 2).arg(samples.size()).arg(rounds), "INFO");
+    
+    const ImageKernels::BinarizeKernel kernels[] = {
+        ImageKernels::BinarizeScalar, ImageKernels::BinarizeSSE2, ImageKernels::BinarizeAVX2
+    };
+    for (ImageKernels::BinarizeKernel kernel : kernels) {
+        if (!ImageKernels::isBinarizeKernelSupported(kernel)) {
+            appendLog(QString("二值化[%1]: 当前CPU不支持，跳过").arg(ImageKernels::binarizeKernelName(kernel)), "INFO");
+            continue;
+        }
+        
+        // 先校验结果与原实现逐位一致
+        int mismatches = 0;
+        QVector<quint64> packed;
+        for (int i = 0; i < samples.size(); i++) {
+            const QImage &image = samples[i];
+            int wordsPerRow = ImageKernels::packedWordsPerRow(image.width());
+            packed.resize(image.height() * wordsPerRow);
+            ImageKernels::binarizeRowsWith(kernel, image, image.rect(), backgroundColor, BINARIZE_TOLERANCE,
+                                           packed.data(), wordsPerRow);
+            for (int y = 0; y < image.height(); y++) {
+                for (int x = 0; x < image.width(); x++) {
+                    bool bit = (packed[y * wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+                    if (bit != legacyResults[i][y * image.width() + x]) {
+                        mismatches++;
+                    }
+                }
+            }
+        }
+        
+        timer.restart();
+        for (int round = 0; round < rounds; round++) {
+            for (const QImage &image : samples) {
+                int wordsPerRow = ImageKernels::packedWordsPerRow(image.width());
+                packed.resize(image.height() * wordsPerRow);
+                ImageKernels::binarizeRowsWith(kernel, image, image.rect(), backgroundColor, BINARIZE_TOLERANCE,
+                                               packed.data(), wordsPerRow);
+            }
+        }
+        double kernelUs = timer.nsecsElapsed() / 1000.0 / imageCount;
+        appendLog(QString("二值化[%1]: %2 us/张，加速%3倍，与原实现不一致的像素: %4")
+                 .arg(ImageKernels::binarizeKernelName(kernel))
+                 .arg(kernelUs, 0, 'f', 2)
+                 .arg(legacyUs / qMax(kernelUs, 0.001), 0, 'f', 1)
+                 .arg(mismatches), mismatches == 0 ? "SUCCESS" : "ERROR");
+    }
+    appendLog(QString("当前使用的二值化内核: %1").arg(ImageKernels::binarizeKernelName(ImageKernels::bestBinarizeKernel())), "INFO");
+    
+    // ==================== 头像模板汉明距离对比 ====================
+    // 每个样本与全部已加载的学生模板比较一次（与邀请界面识别时的阈值0.90相同）
+    QVector<ImageKernels::BitImage> sampleBits;
+    for (const QImage &image : samples) {
+        sampleBits.append(binarizeImage(image, backgroundColor));
+    }
+    
+    // 原实现：QVector<bool>逐元素比较，完整计算距离
+    QVector<QVector<bool>> legacyTemplates;
+    for (auto it = binarizedStudentTemplates.constBegin(); it != binarizedStudentTemplates.constEnd(); ++it) {
+        const ImageKernels::BitImage &bits = it.value().bits;
+        QVector<bool> unpacked(bits.width * bits.height);
+        for (int y = 0; y < bits.height; y++) {
+            for (int x = 0; x < bits.width; x++) {
+                unpacked[y * bits.width + x] = (bits.words[y * bits.wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+            }
+        }
+        legacyTemplates.append(unpacked);
+    }
+    
+    int legacyMatches = 0;
+    timer.restart();
+    for (int round = 0; round < rounds; round++) {
+        for (const QVector<bool> &sample : legacyResults) {
+            for (const QVector<bool> &tmpl : legacyTemplates) {
+                if (sample.size() != tmpl.size()) {
+                    continue;
+                }
+                int distance = 0;
+                for (int i = 0; i < sample.size(); i++) {
+                    if (sample[i] != tmpl[i]) {
+                        distance++;
+                    }
+                }
+                if (1.0 - (double)distance / sample.size() >= 0.90) {
+                    legacyMatches++;
+                }
+            }
+        }
+    }
+    double legacyRosterUs = timer.nsecsElapsed() / 1000.0 / imageCount;
+    
+    int packedMatches = 0;
+    timer.restart();
+    for (int round = 0; round < rounds; round++) {
+        for (const ImageKernels::BitImage &sample : sampleBits) {
+            int budget = ImageKernels::hammingBudget(sample.width * sample.height, 0.90);
+            for (auto it = binarizedStudentTemplates.constBegin(); it != binarizedStudentTemplates.constEnd(); ++it) {
+                int distance = calculateHammingDistance(sample, it.value().bits, budget);
+                if (distance >= 0 && distance <= budget) {
+                    packedMatches++;
+                }
+            }
+        }
+    }
+    double packedRosterUs = timer.nsecsElapsed() / 1000.0 / imageCount;
+    
+    appendLog(QString("头像匹配全部%1个模板[QVector<bool>]: %2 us/张")
+             .arg(binarizedStudentTemplates.size()).arg(legacyRosterUs, 0, 'f', 2), "INFO");
+    appendLog(QString("头像匹配全部%1个模板[位图+POPCNT+提前结束]: %2 us/张，加速%3倍，匹配数%4/%5")
+             .arg(binarizedStudentTemplates.size())
+             .arg(packedRosterUs, 0, 'f', 2)
+             .arg(legacyRosterUs / qMax(packedRosterUs, 0.001), 0, 'f', 1)
+             .arg(packedMatches).arg(legacyMatches), packedMatches == legacyMatches ? "SUCCESS" : "ERROR");
+    
+    // ==================== 截图对比 ====================
+    HWND hwnd = gameHandles[0];
+    if (hwnd == NULL || !IsWindow(hwnd)) {
+        appendLog("窗口句柄1无效，跳过截图测试", "WARNING");
+    } else {
+        const int captureRounds = 30;
+        
+        // 原实现：每次创建DC和兼容位图，再经过 fromHBITMAP -> QPixmap -> toImage
+        // 每帧至少4次整帧分配（兼容位图、fromHBITMAP、QPixmap、toImage）
+        auto legacyCapture = [](HWND hwnd) {
+            RECT rect;
+            GetWindowRect(hwnd, &rect);
+            int width = rect.right - rect.left;
+            int height = rect.bottom - rect.top;
+            HDC hdcWindow = GetDC(hwnd);
+            HDC hdcMemDC = CreateCompatibleDC(hdcWindow);
+            HBITMAP hbmScreen = CreateCompatibleBitmap(hdcWindow, width, height);
+            SelectObject(hdcMemDC, hbmScreen);
+            PrintWindow(hwnd, hdcMemDC, PW_RENDERFULLCONTENT);
+            QPixmap pixmap = QPixmap::fromImage(QImage::fromHBITMAP(hbmScreen));
+            DeleteObject(hbmScreen);
+            DeleteDC(hdcMemDC);
+            ReleaseDC(hwnd, hdcWindow);
+            return pixmap.toImage();
+        };
+        
+        timer.restart();
+        for (int i = 0; i < captureRounds; i++) {
+            QImage image = legacyCapture(hwnd);
+        }
+        double legacyMs = timer.nsecsElapsed() / 1e6 / captureRounds;
+        appendLog(QString("截图[原实现]: %1 ms/次，每次至少4次整帧分配").arg(legacyMs, 0, 'f', 2), "INFO");
+        
+        // 新实现：独立的上下文，避免统计到脚本运行时的截图
+        WindowCapture capture(hwnd);
+        capture.capture();  // 预热：创建DIB
+        WindowCapture::Stats before = capture.stats();
+        timer.restart();
+        for (int i = 0; i < captureRounds; i++) {
+            QImage image = capture.capture();
+        }
+        double pooledMs = timer.nsecsElapsed() / 1e6 / captureRounds;
+        WindowCapture::Stats after = capture.stats();
+        quint64 frames = after.frames - before.frames;
+        appendLog(QString("截图[DIB帧池]: %1 ms/次，加速%2倍，%3次截图中新建DIB %4次")
+                 .arg(pooledMs, 0, 'f', 2)
+                 .arg(legacyMs / qMax(pooledMs, 0.001), 0, 'f', 1)
+                 .arg(frames)
+                 .arg(after.allocations - before.allocations), "SUCCESS");
+        
+        // 只截取ROI时保留下来的数据量
+        RoiFrame fullFrame = capture.captureRegions(QVector<QRect>());
+        RoiFrame roiFrame = capture.captureRegions({TASK_END_ROI, HARD_TASK_ROI});
+        appendLog(QString("截图[仅ROI]: 保留%1字节（全帧%2字节）")
+                 .arg(roiFrame.bufferBytes())
+                 .arg(fullFrame.bufferBytes()), "INFO");
+    }
+    
+    appendLog("========== 性能测试完成 ==========", "SUCCESS");
+}
 #endif
 
 // ==================== 脚本控制函数实现 ====================
 
 void arona::startScript()
 {
-    // 检查是否已经在运行
-    if (isRunning) {
+    // 检查是否已经在运行（停止后引擎线程可能还没有退出）
+    if (isRunning || engineThread) {
         appendLog("脚本已经在运行中", "WARNING");
         return;
     }
@@ -2234,14 +2939,46 @@ void arona::startScript()
     
     // 设置运行状态
     isRunning = true;
-    shouldStop = false;
+    stopToken.reset();
     updateStartButtonState();
     
     appendLog("========== 脚本启动 ==========", "SUCCESS");
     appendLog(QString("检测到%1个有效窗口，将依次执行").arg(validWindowCount), "INFO");
     
-    // 使用QTimer异步执行脚本，避免阻塞UI
-    QTimer::singleShot(100, this, &arona::executeAllWindows);
+    // 运行期间把系统定时器精度提高到1ms，输入时序线程的休眠不会被推迟到下一个15ms周期
+    timeBeginPeriod(1);
+    inputScheduler.resetStats();
+    
+    // 脚本在引擎线程中执行，GUI线程只负责界面；停止时通过stopToken通知
+    engineThread = QThread::create([this]() { executeAllWindows(); });
+    connect(engineThread, &QThread::finished, this, &arona::onEngineFinished);
+    engineThread->start();
+}
+
+void arona::onEngineFinished()
+{
+    delete engineThread;
+    engineThread = nullptr;
+    timeEndPeriod(1);
+    
+    // 输入事件的实际发送时刻与计划时刻之差
+    InputScheduler::Stats timing = inputScheduler.stats();
+    if (timing.events > 0) {
+        QStringList histogram;
+        for (int i = 0; i < InputScheduler::BUCKET_COUNT; i++) {
+            if (timing.buckets[i] > 0) {
+                histogram.append(QString("%1:%2").arg(InputScheduler::bucketLabel(i)).arg(timing.buckets[i]));
+            }
+        }
+        appendLog(QString("输入时序：%1个事件，平均延迟%2us，最大%3us（%4）")
+                 .arg(timing.events)
+                 .arg(timing.totalLateUs / qint64(timing.events))
+                 .arg(timing.maxLateUs)
+                 .arg(histogram.join("，")), "INFO");
+    }
+    
+    isRunning = false;
+    updateStartButtonState();
 }
 
 void arona::stopScript()
@@ -2251,12 +2988,17 @@ void arona::stopScript()
         return;
     }
     
-    shouldStop = true;
+    stopToken.cancel();
     appendLog("正在停止脚本...", "WARNING");
 }
 
 void arona::updateStartButtonState()
 {
+    if (QThread::currentThread() != thread()) {
+        emit runningStateChanged();
+        return;
+    }
+    
     if (isRunning) {
         // 运行中 - 显示为停止按钮（红色）
         startButton->setText("停止");
@@ -2296,17 +3038,15 @@ void arona::updateStartButtonState()
     }
 }
 
-void arona::executeScript(HWND hwnd, QString titleStr)
+ScriptTask<> arona::executeScript(HWND hwnd, QString titleStr)
 {
     // ==================== 初始化 ====================
     
     
     // 检查停止信号
-    if (shouldStop) {
+    if (stopToken.isCancelled()) {
         appendLog("========== 脚本已停止 ==========1682", "WARNING");
-        isRunning = false;
-        updateStartButtonState();
-        return;
+        co_return;
     }
 
     // // 置顶游戏窗口
@@ -2314,33 +3054,30 @@ void arona::executeScript(HWND hwnd, QString titleStr)
     // SetFocus(hwnd);
 
     // ==================== 等待进入大厅 ====================
-    if (!waitForPosition(hwnd, "Hall", 20, 4000, 120, 640)) {
+    if (!co_await waitForPosition(hwnd, "Hall", 20, 4000, 120, 640)) {
         appendLog("进入大厅失败", "ERROR");
-        return;  // 进入失败，已在函数内处理
+        co_return;  // 进入失败，已在函数内处理
     }
 
     // ==================== 困难扫荡（根据定时执行设置）====================
     // 检查当前任务配置是否启用困难扫荡
-    bool shouldSweep = currentTaskConfig.sweepEnabled;
+    bool shouldSweep = scriptWindow()->config.task.sweepEnabled;
     
     // 检查窗口是否在扫荡设置中配置了关卡
-    bool hasSweepConfig = false;
-    if (sweepConfigs.contains(titleStr) && sweepConfigs[titleStr].enabled) {
-        hasSweepConfig = !sweepConfigs[titleStr].stages.isEmpty();
-    }
+    bool hasSweepConfig = scriptWindow()->config.sweep.enabled && !scriptWindow()->config.sweep.stages.isEmpty();
     
     if (shouldSweep && hasSweepConfig)
     {
         appendLog(QString("[%1] 开始执行困难扫荡").arg(titleStr), "INFO");
         // 扫荡
-        sweepTask(hwnd, titleStr);
-        delayMs(1000);
+        co_await sweepTask(hwnd, titleStr);
+        co_await delayMs(1000);
 
         // 返回大厅
-        if (!waitForPosition(hwnd, "Hall", 30, 1000, 1855, 10))
+        if (!co_await waitForPosition(hwnd, "Hall", 30, 1000, 1855, 10))
         {
             appendLog("返回大厅失败", "ERROR");
-            return;
+            co_return;
         }
     }
     else if (shouldSweep && !hasSweepConfig)
@@ -2359,107 +3096,100 @@ void arona::executeScript(HWND hwnd, QString titleStr)
     appendLog("前往咖啡厅1", "INFO");
     
     // 进入咖啡厅1
-    enterCafe1FromHall(hwnd);
-    if (!waitForPosition(hwnd, "Cafe1", 20, 1500, 150, 1045)) {
+    co_await enterCafe1FromHall(hwnd);
+    if (!co_await waitForPosition(hwnd, "Cafe1", 20, 1500, 150, 1045)) {
         appendLog("进入咖啡厅1失败", "ERROR");
-        return;
+        co_return;
     }
 
-    if (!isRunning) {
+    if (stopToken.isCancelled()) {
         appendLog("========== 脚本已停止 ==========1716", "WARNING");
-        updateStartButtonState();
-        return;
+        co_return;
     }
     
     // 调整咖啡厅位置
-    adjustCafePosition(hwnd);
+    co_await adjustCafePosition(hwnd);
     
     // 摸头
     appendLog(QString("在咖啡厅1开始摸头（循环3轮）"), "INFO");
-    patStudents(hwnd, 3);
+    co_await patStudents(hwnd, 3);
     
-    if (!delayMsWithCheck(500)) {
+    if (!co_await delayMs(500)) {
         appendLog("========== 脚本已停止 ==========1731", "WARNING");
-        isRunning = false;
-        updateStartButtonState();
-        return;
+        co_return;
     }
 
     // ==================== 咖啡厅2 ====================
     appendLog("前往咖啡厅2", "INFO");
     
     // 进入咖啡厅2
-    enterCafe2FromCafe1(hwnd);
-    delayMs(3000);
-    if (!waitForPosition(hwnd, "Cafe2", 20, 1500, 150, 1045)) {
+    co_await enterCafe2FromCafe1(hwnd);
+    // 等待离开咖啡厅1（切换动画开始）后再识别咖啡厅2，避免在切换前点击边缘
+    co_await waitUntil(hwnd, 3000, [&]() { return !isAtPosition(hwnd, "Cafe1"); });
+    if (!co_await waitForPosition(hwnd, "Cafe2", 20, 1500, 150, 1045)) {
         appendLog("进入咖啡厅2失败", "ERROR");
-        return;
+        co_return;
     }
 
     // 调整咖啡厅位置
-    adjustCafePosition(hwnd);
+    co_await adjustCafePosition(hwnd);
     
     // 摸头
     appendLog(QString("在咖啡厅2开始摸头（循环3轮）"), "INFO");
-    patStudents(hwnd, 3);
+    co_await patStudents(hwnd, 3);
 
-    if (!delayMsWithCheck(500)) {
+    if (!co_await delayMs(500)) {
         appendLog("========== 脚本已停止 ==========1731", "WARNING");
-        isRunning = false;
-        updateStartButtonState();
-        return;
+        co_return;
     }
 
     // 邀请学生并继续摸头
     // 根据任务配置决定是否在咖啡厅2邀请学生
-    if (currentTaskConfig.inviteCafe2Enabled)
+    if (scriptWindow()->config.task.inviteCafe2Enabled)
     {
-        if (!inviteStudentToCafe(hwnd, titleStr, 2))
+        if (!co_await inviteStudentToCafe(hwnd, titleStr, 2))
         {
             appendLog("在咖啡厅2邀请学生失败", "ERROR");
         }
         else{
             // 摸头
             appendLog(QString("在咖啡厅2开始摸头（循环3轮）"), "INFO");
-            patStudents(hwnd, 3);
+            co_await patStudents(hwnd, 3);
         }
     }
     // 根据任务配置决定是否在咖啡厅1邀请学生
-    if (currentTaskConfig.inviteCafe1Enabled)
+    if (scriptWindow()->config.task.inviteCafe1Enabled)
     {
-        enterCafe1FromCafe2(hwnd);
-        delayMs(1000);
-        if (!waitForPosition(hwnd, "Cafe1", 20, 1500, 150, 1045))
+        co_await enterCafe1FromCafe2(hwnd);
+        co_await waitUntil(hwnd, 1000, [&]() { return !isAtPosition(hwnd, "Cafe2"); });
+        if (!co_await waitForPosition(hwnd, "Cafe1", 20, 1500, 150, 1045))
         {
             appendLog("进入咖啡厅1失败", "ERROR");
-            return;
+            co_return;
         }
-        delayMs(1000);
-        if (!inviteStudentToCafe(hwnd, titleStr, 1))
+        if (!co_await inviteStudentToCafe(hwnd, titleStr, 1))
         {
             appendLog("在咖啡厅1邀请学生失败", "ERROR");
         }
         else{
             // 摸头
             appendLog(QString("在咖啡厅1开始摸头（循环3轮）"), "INFO");
-            patStudents(hwnd, 3);
+            co_await patStudents(hwnd, 3);
         }
     }
 
     // 返回大厅
-    if (!waitForPosition(hwnd, "Hall", 20, 1000, 1855, 10))
+    if (!co_await waitForPosition(hwnd, "Hall", 20, 1000, 1855, 10))
     {
         appendLog("返回大厅失败", "ERROR");
-        return;
+        co_return;
     }
     // closeGameWindowByReturn(hwnd);
 
     // ==================== 关闭游戏 ====================
-    if (!delayMsWithCheck(500)) {
+    if (!co_await delayMs(500)) {
         appendLog("========== 脚本已停止 ==========1731", "WARNING");
-        isRunning = false;
-        updateStartButtonState();
-        return;
+        co_return;
     }
     // closeGameWindow(hwnd);
     
@@ -2473,96 +3203,94 @@ void arona::executeScript(HWND hwnd, QString titleStr)
 }
 
 // ==================== 工具函数实现 ====================
-bool arona::refreshCafe(HWND hwnd)
+ScriptTask<bool> arona::refreshCafe(HWND hwnd)
 {
     // 通过启用并退出编辑模式，刷新一次咖啡厅的学生位置
     int waitCount = 0;
     while (waitCount < 30)
     {
-        if (waitForPosition(hwnd, "EditMode", 10, 1000, 150, 1045))
+        if (co_await waitForPosition(hwnd, "EditMode", 10, 1000, 150, 1045))
         {
-            click(hwnd, 90, 992);
+            co_await click(hwnd, 90, 992);
             break;
         }
 
-        if (shouldStop)
+        if (stopToken.isCancelled())
         {
-            return false;
+            co_return false;
         }
 
         // 点击一次边缘位置
-        click(hwnd, 150, 1045);
+        co_await click(hwnd, 150, 1045);
         waitCount++;
-        delayMs(1000);
+        co_await delayMs(1000);
     }
 
     if (waitCount >= 30)
     {
-        return false;
+        co_return false;
     }
 
     waitCount = 0;
     while (waitCount < 30)
     {
-        delayMs(1000);
-        click(hwnd, 1680, 140);
-        if (waitForPosition(hwnd, "EditMode", 10, 1000, 150, 1045))
+        co_await delayMs(1000);
+        co_await click(hwnd, 1680, 140);
+        if (co_await waitForPosition(hwnd, "EditMode", 10, 1000, 150, 1045))
         {
-            return true;
+            co_return true;
         }
         waitCount++;
     }
     
-    return false;
+    co_return false;
 }
 
-void arona::sweepTask(HWND hwnd, QString titleStr)
+ScriptTask<> arona::sweepTask(HWND hwnd, QString titleStr)
 {
-    if (!waitForPosition(hwnd, "Opration", 10, 2000, 1880, 890))
+    if (!co_await waitForPosition(hwnd, "Opration", 10, 2000, 1880, 890))
     {
-        return;
+        co_return;
     }
     // appendLog("阿罗娜，进入操作界面", "INFO");
-    delayMs(1500);
-    if (!waitForPosition(hwnd, "Task", 10, 2000, 1230, 370))
+    co_await delayMs(1500);
+    if (!co_await waitForPosition(hwnd, "Task", 10, 2000, 1230, 370))
     {
-        return;
+        co_return;
     }
-    delayMs(1500);
+    co_await delayMs(1500);
     // appendLog("阿罗娜，进入任务界面", "INFO");
     // 前往最后一关
     int waitCount = 0;
     while (waitCount < 30)
     {
-        click(hwnd, 1840, 520);
-        delayMs(500);
-        QImage screenshot = captureWindow(hwnd);
-        if (isPositionReady(screenshot, TASK_END_ROI))
+        co_await click(hwnd, 1840, 520);
+        if (co_await waitUntil(hwnd, 500, [&]() { return isRoiReady(hwnd, TASK_END_ROI); }))
         {
-            click(hwnd, 1595, 215);
-            delayMs(300);
+            co_await click(hwnd, 1595, 215);
+            co_await delayMs(300);
             break;
         }
         waitCount++;
     }
     // 确保进入困难关卡
-    QImage screenshot = captureWindow(hwnd);
-    if (isPositionReady(screenshot, HARD_TASK_ROI))
+    co_await waitForFrame(hwnd);
+    if (isRoiReady(hwnd, HARD_TASK_ROI))
     {
-        delayMs(300);
-        click(hwnd, 1595, 215);
+        co_await delayMs(300);
+        co_await click(hwnd, 1595, 215);
     }
     
     // 从配置中获取扫荡关卡列表
-    if (!sweepConfigs.contains(titleStr)) {
+    if (!scriptWindow()->config.hasSweepConfig) {
         appendLog(QString("窗口[%1]没有配置困难扫荡设置").arg(titleStr), "ERROR");
-        return;
+        co_return;
     }
     
-    const WindowSweepConfig &config = sweepConfigs[titleStr];
+    const WindowSweepConfig &config = scriptWindow()->config.sweep;
     if (config.stages.isEmpty()) {
         appendLog(QString("窗口[%1]没有配置扫荡关卡，请先在\"困难扫荡设置\"中添加关卡").arg(titleStr), "ERROR");
-        return;
+        co_return;
     }
 
     // 依次执行所有配置的关卡
@@ -2571,8 +3299,8 @@ void arona::sweepTask(HWND hwnd, QString titleStr)
     {
         const SweepStageConfig &stage = config.stages[i];
         appendLog(QString("执行第%1个关卡: 任务%2-关卡%3").arg(i + 1).arg(stage.taskIndex).arg(stage.subTaskIndex + 1), "INFO");
-        doTask(hwnd, stage.taskIndex, stage.subTaskIndex);
-        delayMs(1000); // 每个关卡之间等待1秒
+        co_await doTask(hwnd, stage.taskIndex, stage.subTaskIndex);
+        co_await delayMs(1000); // 每个关卡之间等待1秒
 
         if (i == config.stages.size() - 1)
         {
@@ -2583,13 +3311,11 @@ void arona::sweepTask(HWND hwnd, QString titleStr)
         int waitCount = 0;
         while (waitCount < 30)
         {
-            click(hwnd, 1840, 520);
-            delayMs(500);
-            QImage screenshot = captureWindow(hwnd);
-            if (isPositionReady(screenshot, TASK_END_ROI))
+            co_await click(hwnd, 1840, 520);
+            if (co_await waitUntil(hwnd, 500, [&]() { return isRoiReady(hwnd, TASK_END_ROI); }))
             {
-                click(hwnd, 1595, 215);
-                delayMs(300);
+                co_await click(hwnd, 1595, 215);
+                co_await delayMs(300);
                 break;
             }
             waitCount++;
@@ -2599,155 +3325,179 @@ void arona::sweepTask(HWND hwnd, QString titleStr)
     appendLog("所有扫荡关卡执行完成", "SUCCESS");
 }
 
-bool arona::inviteStudentToCafe(HWND hwnd, QString titleStr, int cafeNumber)
+ScriptTask<bool> arona::inviteStudentToCafe(HWND hwnd, QString titleStr, int cafeNumber)
 {
-    // 检查邀请券是否就绪
-    QImage screenshot = captureWindow(hwnd);
-    if (isPositionReady(screenshot, INVITATION_TICKET_ROI))
+    // 检查邀请券是否就绪（刚进入咖啡厅时邀请券可能还没有显示，最多等待1秒）
+    if (co_await waitUntil(hwnd, 1000, [&]() { return isRoiReady(hwnd, INVITATION_TICKET_ROI); }))
     {
         appendLog(QString("咖啡厅%1邀请券就绪，准备邀请学生").arg(cafeNumber), "SUCCESS");
 
         // 根据咖啡厅编号检查任务配置是否启用了对应的邀请功能
-        bool inviteEnabled = (cafeNumber == 1) ? currentTaskConfig.inviteCafe1Enabled : currentTaskConfig.inviteCafe2Enabled;
+        bool inviteEnabled = (cafeNumber == 1) ? scriptWindow()->config.task.inviteCafe1Enabled : scriptWindow()->config.task.inviteCafe2Enabled;
         
         if (!inviteEnabled) {
             appendLog(QString("任务配置：咖啡厅%1邀请功能未启用，跳过邀请").arg(cafeNumber), "INFO");
-            return false;
+            co_return false;
         }
 
         // 从配置中获取学生列表
-        QStringList studentNames = studentInviteLists.value(titleStr);
+        QStringList studentNames = scriptWindow()->config.students;
         
         if (studentNames.isEmpty()) {
             appendLog(QString("窗口[%1]没有配置邀请学生列表，请先在\"邀请学生设置\"中配置").arg(titleStr), "WARNING");
-            return false;
+            co_return false;
         }
         
         // appendLog(QString("准备邀请: %1").arg(studentNames.join(", ")), "INFO");
         
         // 邀请学生
-        return inviteStudentByName(hwnd, studentNames, titleStr);
+        co_return co_await inviteStudentByName(hwnd, studentNames, titleStr);
     }
     else
     {
         appendLog(QString("咖啡厅%1邀请券未就绪").arg(cafeNumber), "WARNING");
     }
-    return false;
+    co_return false;
 }
 
 // 关闭声音函数
-void arona::muteSound(HWND hwnd)
+ScriptTask<> arona::muteSound(HWND hwnd)
 {
-    click(GetParent(hwnd), 1531, 30);
-    delayMs(1000);
-    click(hwnd, 715, 136);
-    delayMs(1000);
-    click(GetParent(hwnd), 1120, 30);
-    delayMs(1000);
+    co_await click(GetParent(hwnd), 1531, 30);
+    co_await delayMs(1000);
+    co_await click(hwnd, 715, 136);
+    co_await delayMs(1000);
+    co_await click(GetParent(hwnd), 1120, 30);
+    co_await delayMs(1000);
 }
 
-void arona::doTask(HWND hwnd, int taskIndex, int subTaskIndex)
+ScriptTask<> arona::doTask(HWND hwnd, int taskIndex, int subTaskIndex)
 {
     // 点击固定次数，进入指定关卡
     for (int i = 0; i < taskIndex; i++)
     {
-        click(hwnd, 70, 540);
-        delayMs(300);
+        co_await click(hwnd, 70, 540);
+        co_await delayMs(300);
     }
     // 进入指定关卡
-    click(hwnd, 1680, 370 + subTaskIndex * 170);
-    delayMs(1000);
+    co_await click(hwnd, 1680, 370 + subTaskIndex * 170);
+    co_await delayMs(1000);
 
     // 设定最大挑战次数
     for (int i = 0; i < 3; i++)
     {
-        click(hwnd, 1525, 500);
-        delayMs(300);
+        co_await click(hwnd, 1525, 500);
+        co_await delayMs(300);
     }
 
-    // 点击开始扫荡
-    click(hwnd, 1400, 630);
-    delayMs(1000);
+    // 点击开始扫荡，等待确认框（原先固定等待1秒后再检查，总时长不变）
+    co_await click(hwnd, 1400, 630);
 
-    if (!waitForPosition(hwnd, "SweepConfirm", 5, 400, 1240, 500))
+    if (!co_await waitForPosition(hwnd, "SweepConfirm", 8, 400, 1240, 500))
     {
         appendLog(QString("体力不足或关卡（%1，%2）挑战次数已用完").arg(taskIndex).arg(subTaskIndex), "WARNING");
-        click(hwnd, 1840, 520);
-        delayMs(400);
-        return;
+        co_await click(hwnd, 1840, 520);
+        co_await delayMs(400);
+        co_return;
     }
     else
     {
-        // 点击确认
-        click(hwnd, 1140, 750);
+        // 确认框弹出动画结束后点击确认
+        co_await waitForSettle(hwnd, SWEEP_CONFIRM_BUTTON_ROI, "扫荡确认");
+        co_await click(hwnd, 1140, 750);
     }
 }
 
-void arona::delayMs(int milliseconds)
+ScriptRuntime::Delay arona::delayMs(int milliseconds)
 {
-    // 使用QEventLoop实现无阻塞延时
-    // 这样可以保持UI响应，不会冻结界面
-    QEventLoop loop;
-    QTimer::singleShot(milliseconds, &loop, &QEventLoop::quit);
-    loop.exec();
+    // 挂起当前窗口的脚本协程，期间引擎线程继续执行其他窗口；停止时立即以false返回
+    return ScriptRuntime::delay(milliseconds);
 }
 
-bool arona::delayMsWithCheck(int milliseconds)
+ScriptTask<bool> arona::waitUntil(HWND hwnd, int timeoutMs, std::function<bool()> condition,
+                                  TransitionModel::Estimate expected, qint64 startedAt)
 {
-    // 带停止检查的延时函数
-    // 每100ms检查一次是否需要停止
-    // 返回false表示需要停止，返回true表示延时完成
-    
-    int elapsed = 0;
-    int checkInterval = 100;  // 每100ms检查一次
-    
-    while (elapsed < milliseconds) {
-        // 检查是否需要停止
-        if (shouldStop) {
-            return false;
+    // 等待条件成立（如进入某个界面），条件由调用方在最新画面上判断
+    // 后台截图线程运行时每发布一帧新画面检查一次（挂起在该窗口的帧信号上）；否则从CONDITION_POLL_MIN_MS开始逐次加倍，最长CONDITION_POLL_MS
+    const qint64 deadline = CaptureWorker::clockMs() + timeoutMs;
+    int pollMs = CONDITION_POLL_MIN_MS;
+    // 第一次检查输入之后的画面
+    if (!co_await waitForFrame(hwnd)) {
+        co_return false;
+    }
+    for (;;) {
+        ScriptSignal *signal;
+        {
+            QMutexLocker locker(&captureMutex);
+            signal = captureWorkers.contains(hwnd) ? frameSignals.value(hwnd) : nullptr;
+        }
+        // 先记下帧计数再检查条件：检查期间发布的帧不会被错过
+        const quint64 seen = signal ? signal->generation() : 0;
+        if (condition()) {
+            co_return true;
+        }
+        qint64 remaining = deadline - CaptureWorker::clockMs();
+        if (remaining <= 0) {
+            co_return false;
         }
         
-        // 计算本次需要延时的时间
-        int delayTime = qMin(checkInterval, milliseconds - elapsed);
+        // 过渡耗时已知时，预计最早到达（p10）之前不必检查，p10到p90之间以最短间隔检查
+        if (expected.isWarm()) {
+            const qint64 elapsed = CaptureWorker::clockMs() - startedAt;
+            if (elapsed < expected.p10) {
+                if (!co_await delayMs(int(qMin(remaining, expected.p10 - elapsed)))) {
+                    co_return false;
+                }
+                continue;
+            }
+            if (elapsed <= expected.p90) {
+                pollMs = CONDITION_POLL_MIN_MS;
+            }
+        }
         
-        // 延时
-        QEventLoop loop;
-        QTimer::singleShot(delayTime, &loop, &QEventLoop::quit);
-        loop.exec();
+        if (signal) {
+            co_await signal->wait(int(remaining), seen);
+        } else {
+            co_await delayMs(int(qMin<qint64>(remaining, pollMs)));
+            pollMs = qMin(pollMs * 2, CONDITION_POLL_MS);
+        }
         
-        elapsed += delayTime;
+        if (stopToken.isCancelled()) {
+            co_return false;
+        }
     }
-    
-    return true;
 }
 
-void arona::click(HWND hwnd, int x, int y)
+ScriptTask<> arona::click(HWND hwnd, int x, int y)
 {
     // 检查窗口是否有效
     if (!IsWindow(hwnd)) {
         appendLog("窗口句柄无效", "ERROR");
-        return;
+        co_return;
     }
     
     // 构造lParam (x和y坐标)
     LPARAM lParam = MAKELPARAM(x, y);
     
-    // 发送鼠标按下消息
-    PostMessage(hwnd, WM_LBUTTONDOWN, MK_LBUTTON, lParam);
-    
-    // 延迟50ms后发送鼠标抬起消息，模拟真实点击
-    delayMs(50);
-    PostMessage(hwnd, WM_LBUTTONUP, 0, lParam);
+    // 按下后50ms抬起，模拟真实点击；两条消息由输入时序线程按时发送，发送完毕前挂起
+    QVector<InputScheduler::Event> events = {
+        {0, [hwnd, lParam]() { PostMessage(hwnd, WM_LBUTTONDOWN, MK_LBUTTON, lParam); }},
+        {CLICK_HOLD_US, [this, hwnd, lParam, x, y]() {
+            PostMessage(hwnd, WM_LBUTTONUP, 0, lParam);
+            markInput(hwnd, SessionInputEvent::Click, x, y);
+        }, InputScheduler::Release},
+    };
+    co_await ScriptRuntime::input(inputScheduler, events);
     
     // appendLog(QString("已点击坐标: (%1, %2)").arg(x).arg(y), "INFO");
 }
 
-void arona::clickGrid(HWND hwnd, int x1, int y1, int x2, int y2, int spacing, int delay)
+ScriptTask<> arona::clickGrid(HWND hwnd, int x1, int y1, int x2, int y2, int spacing, int delay)
 {
     // 检查窗口是否有效
     if (!IsWindow(hwnd)) {
         appendLog("窗口句柄无效", "ERROR");
-        return;
+        co_return;
     }
     
     // 确保x1 <= x2, y1 <= y2
@@ -2764,44 +3514,59 @@ void arona::clickGrid(HWND hwnd, int x1, int y1, int x2, int y2, int spacing, in
     // 遍历Y坐标（从上到下）
     for (int y = y1; y <= y2; y += spacing) {
         // 检查是否需要停止
-        if (shouldStop) {
+        if (stopToken.isCancelled()) {
             appendLog(QString("摸头已中断，已完成%1轮").arg(clickedCount), "WARNING");
-            return;
+            co_return;
         }
         
-        // 遍历X坐标（从左到右）
+        // 一行的点击作为一批提交（从左到右）：按下5ms后抬起，间隔delay毫秒点击下一个点
+        QVector<InputScheduler::Event> row;
+        qint64 offsetUs = 0;
         for (int x = x1; x <= x2; x += spacing) {
-            // 检查是否需要停止
-            if (shouldStop) {
-                appendLog(QString("摸头已中断，已完成%1轮").arg(clickedCount), "WARNING");
-                return;
-            }
-            
-            // 构造lParam (x和y坐标)
             LPARAM lParam = MAKELPARAM(x, y);
-            
-            // 发送鼠标按下和抬起消息
-            PostMessage(hwnd, WM_LBUTTONDOWN, MK_LBUTTON, lParam);
-            delayMs(5);  // 按下和抬起之间的短暂延时
-            PostMessage(hwnd, WM_LBUTTONUP, 0, lParam);
-            
-            clickedCount++;
-            
-            // 点击间隔延时（带停止检查）
-            if (delay > 0) {
-                if (!delayMsWithCheck(delay)) {
-                    // 延时期间收到停止信号
-                    appendLog(QString("地毯式点击已中断，已完成%1/%2个点").arg(clickedCount).arg(totalPoints), "WARNING");
-                    return;
-                }
-            }
+            row.append({offsetUs, [hwnd, lParam]() { PostMessage(hwnd, WM_LBUTTONDOWN, MK_LBUTTON, lParam); }});
+            row.append({offsetUs + GRID_CLICK_HOLD_US, [this, hwnd, lParam, x, y]() {
+                PostMessage(hwnd, WM_LBUTTONUP, 0, lParam);
+                markInput(hwnd, SessionInputEvent::Click, x, y);
+            }, InputScheduler::Release});
+            offsetUs += GRID_CLICK_HOLD_US + qint64(qMax(0, delay)) * 1000;
+        }
+        
+        // 等待期间收到停止信号时本行剩余的点击不再发送（已按下的点会抬起），也不再提交下一行
+        if (!co_await ScriptRuntime::input(inputScheduler, row)) {
+            appendLog(QString("地毯式点击已中断，已完成%1/%2个点").arg(clickedCount).arg(totalPoints), "WARNING");
+            co_return;
+        }
+        clickedCount += row.size() / 2;
+    }
+}
+
+ScriptTask<bool> arona::acquireGlobalInput(HWND hwnd)
+{
+    // 以hwnd对应的窗口的名义排队（统计计入该窗口）；轮到之前挂起，由release或放弃排队时的通知唤醒后重试
+    const quint64 ticket = inputArbiter.enqueue(windowKeyForHandle(hwnd));
+    const qint64 deadline = CaptureWorker::clockMs() + GLOBAL_INPUT_TIMEOUT_MS;
+    for (;;) {
+        const quint64 seen = inputArbiterChanged.generation();
+        if (inputArbiter.tryAcquire(ticket)) {
+            co_return true;
+        }
+        const qint64 remaining = deadline - CaptureWorker::clockMs();
+        if (remaining <= 0 || stopToken.isCancelled()) {
+            inputArbiter.abandon(ticket);
+            co_return false;
         }
+        co_await inputArbiterChanged.wait(int(remaining), seen);
     }
 }
 
-void arona::moveMouse(int x, int y)
+void arona::moveMouse(HWND hwnd, int x, int y)
 {
-    // 移动真实鼠标到屏幕坐标
+    // 移动真实鼠标到屏幕坐标（以hwnd对应的窗口的名义排队，统计计入该窗口）
+    InputArbiter::Section section(inputArbiter, windowKeyForHandle(hwnd), GLOBAL_INPUT_TIMEOUT_MS, &stopToken);
+    if (!section.isAcquired()) {
+        return;
+    }
     SetCursorPos(x, y);
     appendLog(QString("鼠标已移动到屏幕坐标: (%1, %2)").arg(x).arg(y), "INFO");
 }
@@ -2826,16 +3591,20 @@ void arona::moveMouseToWindow(HWND hwnd, int x, int y)
     int screenY = rect.top + y;
     
     // 移动鼠标
+    InputArbiter::Section section(inputArbiter, windowKeyForHandle(hwnd), GLOBAL_INPUT_TIMEOUT_MS, &stopToken);
+    if (!section.isAcquired()) {
+        return;
+    }
     SetCursorPos(screenX, screenY);
     appendLog(QString("鼠标已移动到窗口坐标: (%1, %2)").arg(x).arg(y), "INFO");
 }
 
-void arona::drag(HWND hwnd, int startX, int startY, int endX, int endY, int duration)
+ScriptTask<> arona::drag(HWND hwnd, int startX, int startY, int endX, int endY, int duration)
 {
     // 检查窗口是否有效
     if (!IsWindow(hwnd)) {
         appendLog("窗口句柄无效", "ERROR");
-        return;
+        co_return;
     }
     
     // 计算拖动步数（每10ms移动一次）
@@ -2846,29 +3615,34 @@ void arona::drag(HWND hwnd, int startX, int startY, int endX, int endY, int dura
     double deltaX = static_cast<double>(endX - startX) / steps;
     double deltaY = static_cast<double>(endY - startY) / steps;
     
+    // 整个拖动作为一批提交，由输入时序线程按时发送，发送完毕前挂起
+    QVector<InputScheduler::Event> events;
+    
     // 发送鼠标按下消息到起始位置
     LPARAM startLParam = MAKELPARAM(startX, startY);
-    PostMessage(hwnd, WM_LBUTTONDOWN, MK_LBUTTON, startLParam);
+    events.append({0, [hwnd, startLParam]() { PostMessage(hwnd, WM_LBUTTONDOWN, MK_LBUTTON, startLParam); }});
     
     // appendLog(QString("开始拖动: (%1, %2) -> (%3, %4)")
     //          .arg(startX).arg(startY).arg(endX).arg(endY), "INFO");
     
-    delayMs(50);  // 等待按下消息处理
-    
-    // 逐步移动鼠标
+    // 等待按下消息处理后逐步移动鼠标，每步10ms
     for (int i = 1; i <= steps; ++i) {
         int currentX = startX + static_cast<int>(deltaX * i);
         int currentY = startY + static_cast<int>(deltaY * i);
         
         LPARAM currentLParam = MAKELPARAM(currentX, currentY);
-        PostMessage(hwnd, WM_MOUSEMOVE, MK_LBUTTON, currentLParam);
-        
-        delayMs(10);  // 每步延时10ms
+        events.append({DRAG_PRESS_US + (i - 1) * DRAG_STEP_US, [hwnd, currentLParam]() {
+            PostMessage(hwnd, WM_MOUSEMOVE, MK_LBUTTON, currentLParam);
+        }});
     }
     
     // 发送鼠标抬起消息到终点位置
     LPARAM endLParam = MAKELPARAM(endX, endY);
-    PostMessage(hwnd, WM_LBUTTONUP, 0, endLParam);
+    events.append({DRAG_PRESS_US + steps * DRAG_STEP_US, [this, hwnd, endLParam, startX, startY, endX, endY, duration]() {
+        PostMessage(hwnd, WM_LBUTTONUP, 0, endLParam);
+        markInput(hwnd, SessionInputEvent::Drag, startX, startY, endX, endY, duration);
+    }, InputScheduler::Release});
+    co_await ScriptRuntime::input(inputScheduler, events);
     
     // appendLog(QString("拖动完成: (%1, %2) -> (%3, %4)")
     //          .arg(startX).arg(startY).arg(endX).arg(endY), "SUCCESS");
@@ -2884,22 +3658,36 @@ void arona::dragSkill(HWND hwnd, int startX, int startY, int endX, int endY)
     
     // 第1步：在技能位置按下鼠标
     LPARAM startLParam = MAKELPARAM(startX, startY);
-    PostMessage(hwnd, WM_LBUTTONDOWN, MK_LBUTTON, startLParam);
     
-    // 第2步：延时2ms
-    delayMs(2);
-    
-    // 第3步：拖动到按下位置上方10px处
+    // 第2步：2ms后拖动到按下位置上方10px处
     int midY = startY - 10;  // 向上移动10px
     LPARAM midLParam = MAKELPARAM(startX, midY);
-    PostMessage(hwnd, WM_MOUSEMOVE, MK_LBUTTON, midLParam);
-    
-    // 第4步：延时8ms
-    delayMs(8);
     
-    // 第5步：直接拖动到目标位置
+    // 第3步：再过8ms直接拖动到目标位置
     LPARAM endLParam = MAKELPARAM(endX, endY);
-    PostMessage(hwnd, WM_MOUSEMOVE, MK_LBUTTON, endLParam);
+    
+    // 中途停止时已经按下的技能在起点抬起（取消拖动，不在途中的位置释放技能）
+    // 拖动完成后由releaseSkill抬起；之后才停止时由引擎结束时的releaseHeldSkills抬起
+    const bool completed = inputScheduler.run({
+        {0, [hwnd, startLParam]() { PostMessage(hwnd, WM_LBUTTONDOWN, MK_LBUTTON, startLParam); }},
+        {2000, [hwnd, midLParam]() { PostMessage(hwnd, WM_MOUSEMOVE, MK_LBUTTON, midLParam); }},
+        {10000, [this, hwnd, endLParam, startX, startY, endX, endY]() {
+            PostMessage(hwnd, WM_MOUSEMOVE, MK_LBUTTON, endLParam);
+            markInput(hwnd, SessionInputEvent::Drag, startX, startY, endX, endY);
+        }},
+        {10000, [this, hwnd, startLParam, startX, startY]() {
+            PostMessage(hwnd, WM_LBUTTONUP, 0, startLParam);
+            markInput(hwnd, SessionInputEvent::Release, startX, startY);
+        }, InputScheduler::CancelRelease},
+    }, &stopToken);
+    if (!completed) {
+        appendLog("技能拖动已中断", "WARNING");
+        return;
+    }
+    {
+        QMutexLocker locker(&captureMutex);
+        heldSkills.insert(hwnd, QPoint(startX, startY));
+    }
     
     appendLog(QString("技能拖动开始: (%1, %2) -> (%3, %4)")
              .arg(startX).arg(startY).arg(endX).arg(endY), "SUCCESS");
@@ -2915,10 +3703,33 @@ void arona::releaseSkill(HWND hwnd, int x, int y)
     // 发送鼠标抬起消息
     LPARAM lParam = MAKELPARAM(x, y);
     PostMessage(hwnd, WM_LBUTTONUP, 0, lParam);
+    markInput(hwnd, SessionInputEvent::Release, x, y);
+    {
+        QMutexLocker locker(&captureMutex);
+        heldSkills.remove(hwnd);
+    }
     
     appendLog(QString("技能释放完成: (%1, %2)").arg(x).arg(y), "SUCCESS");
 }
 
+void arona::releaseHeldSkills()
+{
+    // 在dragSkill之后、releaseSkill之前停止时，技能仍处于按下状态：在按下的位置抬起（取消拖动）
+    QHash<HWND, QPoint> held;
+    {
+        QMutexLocker locker(&captureMutex);
+        held.swap(heldSkills);
+    }
+    for (auto it = held.constBegin(); it != held.constEnd(); ++it) {
+        if (!IsWindow(it.key())) {
+            continue;
+        }
+        PostMessage(it.key(), WM_LBUTTONUP, 0, MAKELPARAM(it->x(), it->y()));
+        markInput(it.key(), SessionInputEvent::Release, it->x(), it->y());
+        appendLog(QString("技能拖动未释放，已在(%1, %2)抬起").arg(it->x()).arg(it->y()), "WARNING");
+    }
+}
+
 void arona::scroll(HWND hwnd, int x, int y, int delta)
 {
     // 检查窗口是否有效
@@ -2942,6 +3753,7 @@ void arona::scroll(HWND hwnd, int x, int y, int delta)
     
     // 发送滚轮消息
     PostMessage(hwnd, WM_MOUSEWHEEL, wParam, lParam);
+    markInput(hwnd, SessionInputEvent::Scroll, x, y, 0, 0, delta);
     
     QString direction = (delta > 0) ? "向上" : "向下";
     // appendLog(QString("已发送滚轮消息: %1滚动%2格，坐标: (%3, %4)")
@@ -2965,12 +3777,14 @@ void arona::pressKey(HWND hwnd, int vkCode, bool press)
         // 这里简化处理，重复次数为1，扫描码为0
         LPARAM lParam = 0x00000001;  // 重复次数=1, 扫描码=0, 扩展键=0, 上下文码=0, 之前状态=0, 转换状态=0
         PostMessage(hwndParent, WM_KEYDOWN, vkCode, lParam);
+        markInput(hwnd, SessionInputEvent::Key, 1, 0, 0, 0, vkCode);
         appendLog(QString("向窗口发送按键按下: VK_CODE=0x%1(%2)").arg(vkCode, 2, 16, QChar('0')).arg(vkCode), "INFO");
     } else {
         // 抬起键 - 发送WM_KEYUP消息
         // lParam的bit30=1(之前按下), bit31=1(正在释放)
         LPARAM lParam = 0xC0000001;  // 重复次数=1, 之前状态=1, 转换状态=1
         PostMessage(hwndParent, WM_KEYUP, vkCode, lParam);
+        markInput(hwnd, SessionInputEvent::Key, 0, 0, 0, 0, vkCode);
         appendLog(QString("向窗口发送按键抬起: VK_CODE=0x%1(%2)").arg(vkCode, 2, 16, QChar('0')).arg(vkCode), "INFO");
     }
 }
@@ -2978,7 +3792,7 @@ void arona::pressKey(HWND hwnd, int vkCode, bool press)
 void arona::pressKeyGlobal(int vkCode, bool press)
 {
     // 使用keybd_event发送全局键盘事件（不指定窗口）
-    // 注意：这会发送到当前有焦点的窗口
+    // 注意：这会发送到当前有焦点的窗口，多个窗口同时执行时调用方需要持有inputArbiter
     if (press) {
         // 按下键
         keybd_event(vkCode, 0, 0, 0);
@@ -3080,6 +3894,13 @@ void arona::checkAndExecuteScheduledTasks()
                 continue;  // 今天已经执行过这个时间点的任务
             }
             
+            // 脚本仍在运行（包括停止后还未退出）时不覆盖正在使用的任务配置，本次定时跳过
+            if (engineThread) {
+                executedToday.insert(scheduledKey);
+                appendLog(QString("定时任务%1触发时脚本仍在运行，已跳过").arg(scheduledKey), "WARNING");
+                return;
+            }
+            
             // 记录已执行
             executedToday.insert(scheduledKey);
             
@@ -3205,6 +4026,12 @@ void arona::loadTimerSettings()
 
 void arona::onStudentInviteSettingsButtonClicked()
 {
+    // 引擎线程正在使用邀请设置
+    if (engineThread) {
+        appendLog("脚本运行中，请停止后再修改邀请学生设置", "WARNING");
+        return;
+    }
+    
     // 获取有效的窗口标题列表
     QStringList validTitles = getValidWindowTitles();
     
@@ -3258,6 +4085,12 @@ void arona::onStudentInviteSettingsButtonClicked()
 
 void arona::onSweepSettingsButtonClicked()
 {
+    // 引擎线程正在使用扫荡设置
+    if (engineThread) {
+        appendLog("脚本运行中，请停止后再修改困难扫荡设置", "WARNING");
+        return;
+    }
+    
     // 获取有效的窗口标题列表
     QStringList validTitles = getValidWindowTitles();
     
@@ -3686,9 +4519,30 @@ void arona::updateStudentInviteDialog()
 
 void arona::executeAllWindows()
 {
-    // 依次对所有窗口执行脚本
+    // 在引擎线程中对所有窗口执行脚本：各窗口的流程是同一个ScriptRuntime上的协程，在延时、等待画面和输入处挂起时交错执行
     appendLog("========== 开始多窗口执行 ==========", "INFO");
+    
+    {
+        // 停止时所有挂起的等待立即返回，各流程在检查点退出后run()返回
+        ScriptRuntime runtime(&stopToken);
+        runtime.spawn(runAllWindows());
+        runtime.run();
+    }
+    releaseHeldSkills();
+    
+    // 保存本次记录的过渡耗时，下次启动时直接使用
+    saveTransitionModel();
+    
+    if (stopToken.isCancelled()) {
+        appendLog("========== 脚本已停止 ==========", "WARNING");
+    } else {
+        appendLog("========== 多窗口执行完成 ==========", "SUCCESS");
+    }
+}
 
+ScriptTask<> arona::runAllWindows()
+{
+    // 启动游戏和静音依次完成，之后每个窗口一个任务
     int validHandleCount = 0;
     for (int i = 0; i < 3; i++) {
         if (gameHandles[i] != NULL && IsWindow(gameHandles[i])) {
@@ -3697,11 +4551,11 @@ void arona::executeAllWindows()
             if (IsIconic(GetParent(gameHandles[i]))) {
                 appendLog(QString("窗口%1已最小化，正在恢复").arg(i), "INFO");
                 ShowWindow(GetParent(gameHandles[i]), SW_RESTORE);
-                delayMs(200);
+                co_await delayMs(200);
                 appendLog(QString("窗口%1恢复成功").arg(i), "INFO");
             }
             // 启动游戏
-            click(gameHandles[i], 1450, 200);
+            co_await click(gameHandles[i], 1450, 200);
         }
     }
 
@@ -3712,71 +4566,131 @@ void arona::executeAllWindows()
         for (int i = 0; i < 3; i++) {
             if (gameHandles[i] != NULL && IsWindow(gameHandles[i])) {
                 // 关闭声音
-                muteSound(gameHandles[i]);
+                co_await muteSound(gameHandles[i]);
             }
         }
     }
     
     if (validHandleCount == 0) {
         appendLog("没有有效的游戏窗口句柄", "ERROR");
-        isRunning = false;
-        updateStartButtonState();
-        return;
+        co_return;
     }
     
-    appendLog(QString("找到%1个有效窗口，开始依次执行").arg(validHandleCount), "INFO");
+    QString configPath = QCoreApplication::applicationDirPath() + "/arona_config.ini";
+    QSettings settings(configPath, QSettings::IniFormat);
+    bool concurrent = settings.value("Execution/Concurrent", true).toBool();
+    appendLog(QString("找到%1个有效窗口，开始%2执行").arg(validHandleCount).arg(concurrent ? "同时" : "依次"), "INFO");
     
-    // 依次执行每个窗口
+    // 每个窗口的流程是一个独立任务（点击等操作通过PostMessage发送，不需要窗口焦点）
+    // 同时执行时总耗时接近最慢的一个窗口；关闭Execution/Concurrent后一个窗口结束再开始下一个
+    bool started = false;
     for (int i = 0; i < 3; i++) {
-        if (shouldStop) {
-            appendLog("========== 脚本已停止 ==========2139", "WARNING");
-            isRunning = false;
-            updateStartButtonState();
-            return;
-        }
-        
         HWND hwnd = gameHandles[i];
         if (hwnd == NULL || !IsWindow(hwnd)) {
             continue;  // 跳过无效句柄
         }
-        
-        // 使用存储的父窗口标题
-        QString titleStr = gameWindowTitles[i];
-        if (titleStr.isEmpty()) {
-            // 如果没有存储的标题，尝试动态获取
-            wchar_t title[256];
-            GetWindowTextW(GetParent(hwnd), title, 256);
-            titleStr = QString::fromWCharArray(title);
+        if (stopToken.isCancelled()) {
+            break;
         }
-        currentHandleIndex = i;
-        appendLog(QString("---------- 正在处理窗口：%1 ----------").arg(titleStr), "INFO");
-        
-        // 执行脚本主逻辑
-        executeScript(hwnd, titleStr);
         
-        if (shouldStop) {
-            return;
+        if (concurrent) {
+            ScriptRuntime::current()->spawn(executeWindow(i));
+            continue;
         }
-        
-        // 窗口之间延时
-        if (i < 2 && !shouldStop) {
+        if (started) {
+            // 上一个窗口已经结束，窗口之间延时
             appendLog("等待进入下一个窗口...", "INFO");
-            if (!delayMsWithCheck(5000)) {
+            if (!co_await delayMs(5000)) {
                 break;
             }
         }
+        started = true;
+        co_await executeWindow(i);
     }
+}
+
+ScriptTask<> arona::executeWindow(int handleIndex)
+{
+    HWND hwnd = gameHandles[handleIndex];
     
-    // 关闭所有游戏窗口
-    for (int i = 0; i < 3; i++) {
-        if (gameHandles[i] != NULL && IsWindow(gameHandles[i])) {
-            closeGameWindowByReturn(gameHandles[i]);
-            // closeGameWindow(gameHandles[i]);
-        }
+    // 使用存储的父窗口标题
+    QString titleStr = gameWindowTitles[handleIndex];
+    if (titleStr.isEmpty()) {
+        // 如果没有存储的标题，尝试动态获取
+        wchar_t title[256];
+        GetWindowTextW(GetParent(hwnd), title, 256);
+        titleStr = QString::fromWCharArray(title);
+    }
+    // 本窗口的上下文随协程挂起和恢复，日志和配置不会与其他窗口混淆
+    ScriptWindow window;
+    window.tag = QString("窗口%1").arg(handleIndex + 1);
+    ScriptRuntime::setContext(&window);
+    appendLog(QString("---------- 正在处理窗口：%1 ----------").arg(titleStr), "INFO");
+    
+    // 复制本窗口的任务、邀请和扫荡配置
+    ScriptConfig &config = window.config;
+    config.task = currentTaskConfig;
+    config.students = studentInviteLists.value(titleStr);
+    for (const QString &student : config.students) {
+        config.forceInvite.insert(student, forceInviteEnabled.value(titleStr + "|" + student, false));
+    }
+    config.hasSweepConfig = sweepConfigs.contains(titleStr);
+    config.sweep = config.hasSweepConfig ? sweepConfigs.value(titleStr) : WindowSweepConfig{false, {}};
+    
+    // 每次执行前清空该窗口的ROI变化检测缓存、全局输入等待统计
+    QString windowKey = windowKeyForHandle(hwnd);
+    screenRecognizer.resetRoiCache(windowKey);
+    inputArbiter.resetStats(windowKey);
+    {
+        QMutexLocker locker(&settleMutex);
+        settleStats.remove(windowKey);
     }
-
-    appendLog("========== 多窗口执行完成 ==========", "SUCCESS");
-    isRunning = false;
-    updateStartButtonState();
+    
+    // 执行脚本主逻辑（期间由后台线程持续截图，识别时直接取最新一帧）
+    startSessionRecording(hwnd, handleIndex);
+    startCaptureWorker(hwnd);
+    co_await executeScript(hwnd, titleStr);
+    
+    ScreenRecognizer::RoiCacheStats cacheStats = screenRecognizer.roiCacheStats(windowKey);
+    if (cacheStats.hits + cacheStats.misses > 0) {
+        appendLog(QString("ROI缓存：命中%1次，未命中%2次（命中率%3%）")
+                 .arg(cacheStats.hits)
+                 .arg(cacheStats.misses)
+                 .arg(100.0 * cacheStats.hits / (cacheStats.hits + cacheStats.misses), 0, 'f', 1), "INFO");
+    }
+    
+    InputArbiter::Stats inputStats = inputArbiter.stats(windowKey);
+    if (inputStats.acquisitions + inputStats.timeouts > 0) {
+        appendLog(QString("全局输入：%1次，等待共%2ms（最长%3ms），占用共%4ms，放弃%5次")
+                 .arg(inputStats.acquisitions)
+                 .arg(inputStats.waitMs)
+                 .arg(inputStats.maxWaitMs)
+                 .arg(inputStats.holdMs)
+                 .arg(inputStats.timeouts), "INFO");
+    }
+    
+    QHash<QString, SettleStats> windowSettleStats;
+    {
+        QMutexLocker locker(&settleMutex);
+        windowSettleStats = settleStats.value(windowKey);
+    }
+    for (auto it = windowSettleStats.constBegin(); it != windowSettleStats.constEnd(); ++it) {
+        appendLog(QString("画面稳定：%1 %2次，平均%3ms，最长%4ms，超时%5次")
+                 .arg(it.key())
+                 .arg(it->count)
+                 .arg(it->totalMs / qMax<quint64>(1, it->count))
+                 .arg(it->maxMs)
+                 .arg(it->timeouts), "INFO");
+    }
+    
+    // 关闭游戏窗口
+    if (!stopToken.isCancelled() && IsWindow(hwnd)) {
+        co_await closeGameWindowByReturn(hwnd);
+        // closeGameWindow(hwnd);
+    }
+    
+    stopCaptureWorker(hwnd);
+    stopSessionRecording(hwnd);
+    ScriptRuntime::setContext(nullptr);
 }
 
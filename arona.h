@@ -42,10 +42,30 @@
 #include <QSet>
 #include <QHash>
 #include <QPair>
+#include <QSettings>
+#include <QtAlgorithms>
+#include <QMutex>
+#include <QThread>
+#include <atomic>
+#include <climits>
+#include <functional>
 #include "timerdialog.h"
 #include "studentinvitedialog.h"
 #include "sweepsettingsdialog.h"
 #include "aboutdialog.h"
+#include "imagekernels.h"
+#include "screenrecognizer.h"
+#include "wincapture.h"
+#include "captureworker.h"
+#include "sessionrecording.h"
+#include "debugimagesink.h"
+#include "inputarbiter.h"
+#include "cancellationtoken.h"
+#include "settledetector.h"
+#include "transitionmodel.h"
+#include "headpatdetector.h"
+#include "inputscheduler.h"
+#include "scriptruntime.h"
 
 class arona : public QMainWindow
 {
@@ -76,6 +96,11 @@ public:
         bool isDragging;        // 是否正在拖动中（已按下但未释放）
     };
 
+signals:
+    // 由引擎线程（各窗口的脚本协程）发出，队列连接到GUI线程的appendLog/updateStartButtonState
+    void logRequested(const QString &message, const QString &level);
+    void runningStateChanged();
+
 protected:
     void mousePressEvent(QMouseEvent *event) override;
     void mouseReleaseEvent(QMouseEvent *event) override;
@@ -95,6 +120,7 @@ private slots:
     void onReloadTemplatesButtonClicked();  // 重新加载模板按钮点击
     void onLogButtonClicked();  // 执行日志按钮点击
     void onAboutButtonClicked();  // 关于按钮点击
+    void onEngineFinished();  // 引擎线程结束，恢复开始按钮
     
 #if DEBUG_MODE
     void onDebugButtonClicked();
@@ -165,8 +191,8 @@ private:
     bool isCapturingHandle;
     int capturingHandleIndex;  // 正在抓取的句柄索引（1, 2, 3）
     bool waitingForMouseRelease;  // 等待鼠标释放状态
-    bool isRunning;  // 脚本是否正在运行
-    bool shouldStop;  // 是否应该停止脚本
+    std::atomic<bool> isRunning;  // 脚本是否正在运行（启动时置位，只在引擎线程结束后由onEngineFinished清除）
+    CancellationToken stopToken;  // 停止请求（脚本中的等待被取消时立即返回）
     QTimer *captureTimer;
     QTimer *schedulerTimer;  // 定时检查计时器
     QTimer *countdownTimer;  // 倒计时更新计时器
@@ -189,12 +215,39 @@ private:
     QSet<QRgb> validDigitColors;  // 有效的数字颜色集合（用于识别优化）
     
     // 技能图标模板哈希
-    QHash<QString, QString> skillTemplateHashes;  // Key格式："学生名_位置编号"，Value=感知哈希值
+    QHash<QString, quint64> skillTemplateHashes;  // Key格式："学生名_位置编号"，Value=感知哈希值
     QStringList availableStudentNames;  // 可用的学生名称列表
 
     // 多窗口句柄
     QVector<HWND> gameHandles;  // 存储最多3个游戏窗口句柄
     QVector<QString> gameWindowTitles;  // 存储每个句柄对应的父窗口标题
+    QHash<HWND, ICaptureSource *> captureSources;  // 每个窗口的截图来源（WindowCapture复用DIB位图和帧池）
+    QHash<HWND, CaptureWorker *> captureWorkers;  // 脚本执行期间每个窗口的后台截图线程（运行时独占该窗口的截图来源）
+    QHash<HWND, SessionRecorder *> sessionRecorders;  // 脚本执行期间每个窗口的会话录制（配置Recording/Enabled开启）
+    QHash<HWND, qint64> lastInputAt;  // 每个窗口最近一次发送输入的时刻（CaptureWorker::clockMs），之前开始截取的帧视为过期
+    QHash<HWND, QPoint> heldSkills;  // dragSkill按下、还没有releaseSkill抬起的技能（按下的位置），引擎结束时抬起
+    QHash<HWND, ScriptSignal *> frameSignals;  // 后台截图线程每发布一帧通知一次（等待新画面的协程挂起在这里），析构时才删除
+    QMutex captureMutex;  // 保护以上按窗口的表（表中的对象只由对应窗口的脚本协程使用）
+    QThread *engineThread = nullptr;  // 执行executeAllWindows的引擎线程（运行中非空），所有窗口的脚本协程都在这个线程上交错执行
+    // 画面稳定耗时统计（按过渡名称，如"邀请提示"）
+    struct SettleStats {
+        quint64 count = 0;
+        quint64 timeouts = 0;
+        qint64 totalMs = 0;
+        qint64 maxMs = 0;
+    };
+    QHash<QString, QHash<QString, SettleStats>> settleStats;  // 窗口 -> (过渡名称 -> 统计)
+    QMutex settleMutex;  // 保护settleStats
+    TransitionModel transitionModel;  // 各窗口界面过渡的实际耗时（waitForPosition据此决定检查时机和超时）
+    bool adaptiveTransitions = true;  // 配置Transitions/Adaptive，关闭后waitForPosition只使用固定参数
+    double transitionTimeoutMargin = 2.0;  // 超时 = p99 * 余量（配置Transitions/TimeoutMargin）
+    HeadpatDetector headpatDetector;  // 按互动气泡寻找可摸头的学生
+    bool headpatByVision = true;  // 配置Headpat/Mode：vision（默认）按气泡点击，grid使用地毯式点击
+    bool headpatGridFallback = true;  // 点击后气泡没有消失（识别不可靠）时退回地毯式点击（配置Headpat/GridFallback）
+    int headpatClickOffsetY = 80;  // 点击位置在气泡中心下方的距离（学生头部）
+    InputScheduler inputScheduler;  // 点击、拖动等输入事件按计划时刻发送（所有窗口共用一个时序线程）
+    InputArbiter inputArbiter;  // 依赖焦点的全局输入（SetFocus/keybd_event/SetCursorPos）在各窗口之间逐个执行
+    ScriptSignal inputArbiterChanged;  // inputArbiter被释放或有请求放弃排队时通知（协程在这里排队等待）
     int currentHandleIndex;  // 当前正在处理的句柄索引
     
     // 定时任务
@@ -214,11 +267,10 @@ private:
     // Key格式: "窗口标题|学生名称"
     QHash<QString, bool> forceInviteEnabled;
 
-    // 位置模板哈希值
-    QHash<QString, QString> positionTemplates;
-
-    // 位置就绪模板哈希值
-    QHash<QString, QString> positionReadyTemplates;
+    // 位置模板、位置就绪模板索引（位置名 -> 各服务器变体的ROI和哈希值；ROI -> 就绪/通知模板）
+    ScreenRecognizer screenRecognizer;
+    DebugImageSink debugImages;  // 调试截图在后台线程编码保存（按类别限速、按内容去重）
+    bool saveAvatarImages = false;  // 邀请界面扫描时保存每个栏位的头像（配置DebugImages/SaveAvatars，用于制作头像模板）
 
     // 特定区域
     const QRect INVITATION_TICKET_ROI = QRect(1310, 953, 36, 36);
@@ -227,15 +279,38 @@ private:
     const QRect HARD_TASK_ROI = QRect(1595, 215, 36, 36);
     const QRect INVITATION_NOTICE_ROI = QRect(921, 223, 36, 36);
     const QRect EDIT_MODE_ROI = QRect(90, 992, 36, 36);
+    const QRect HEADPAT_AREA = QRect(200, 240, 1700, 640);  // 咖啡厅中学生可能出现的区域（与原地毯式点击范围相同）
+    const QRect SWEEP_CONFIRM_BUTTON_ROI = QRect(1090, 730, 100, 40);  // 扫荡确认框的确认按钮
     
     // 学生头像二值化模板及尺寸信息
     struct StudentTemplate {
-        QVector<bool> binaryData;
+        ImageKernels::BitImage bits;  // 按行对齐的64位打包位图
         int width;
         int height;
     };
     QHash<QString, StudentTemplate> binarizedStudentTemplates;
     
+    // 邀请界面中的一个学生栏位（标记位置 + 头像二值化位图）
+    struct InvitationSlot {
+        int markerY;
+        ImageKernels::BitImage bits;
+    };
+    static constexpr int BINARIZE_TOLERANCE = 10;  // 二值化时背景色RGB各分量允许的误差
+    static constexpr int CAPTURE_WORKER_INTERVAL_MS = 100;  // 后台截图间隔的默认值
+    static constexpr int CAPTURE_WORKER_WAIT_MS = 1000;  // 等待输入之后的新帧的最长时间
+    static constexpr int GLOBAL_INPUT_TIMEOUT_MS = 60000;  // 等待全局输入仲裁的最长时间
+    static constexpr int SETTLE_TIMEOUT_MS = 3000;  // 等待画面稳定的最长时间
+    static constexpr int SLOW_SETTLE_MS = 1500;  // 画面稳定耗时超过该值时记录警告
+    static constexpr int TRANSITION_MIN_TIMEOUT_MS = 2000;  // 按过渡耗时模型计算的超时不低于该值
+    static constexpr int HEADPAT_MAX_PASSES = 3;  // 每轮摸头最多重新识别的次数（防止误识别的色块被反复点击）
+    static constexpr int HEADPAT_CLICK_INTERVAL_MS = 500;  // 两次摸头点击之间的间隔（等待学生的反应动画）
+    static constexpr qint64 CLICK_HOLD_US = 50000;  // 点击时按下到抬起的时间
+    static constexpr qint64 GRID_CLICK_HOLD_US = 5000;  // 地毯式点击时按下到抬起的时间
+    static constexpr qint64 DRAG_PRESS_US = 50000;  // 拖动时按下后开始移动前的时间
+    static constexpr qint64 DRAG_STEP_US = 10000;  // 拖动时每一步移动的间隔
+    static constexpr int CONDITION_POLL_MIN_MS = 20;  // 没有后台截图线程时waitUntil首次检查条件的间隔（之后逐次加倍）
+    static constexpr int CONDITION_POLL_MS = 200;  // 没有后台截图线程时waitUntil检查条件的最大间隔
+    
     // 辅助函数
     void setupUi();
     void setBackgroundImage(const QString &imagePath);
@@ -243,18 +318,35 @@ private:
     void captureWindowHandle(int handleIndex);
     HWND findGameWindowByParentTitle(const QString &parentTitle);  // 根据父窗口标题查找游戏窗口
 
-    QImage captureWindow(HWND hwnd);
-    QString calculateImageHash(const QImage& image, const QRect& roi = QRect());
+    QImage captureWindow(HWND hwnd, qint64 *capturedAt = nullptr);  // capturedAt返回这一帧开始截取的时刻（clockMs）；后台截图时不等待，取最新一帧（见waitForFrame）
+    RoiFrame captureRegions(HWND hwnd, const QVector<QRect> &rois, qint64 *capturedAt = nullptr);  // 只截取指定ROI（rois为空时为全帧）
+    ICaptureSource *captureSourceFor(HWND hwnd);  // 获取或创建窗口的截图来源
+    void startCaptureWorker(HWND hwnd);  // 启动窗口的后台截图线程（配置Capture/WorkerIntervalMs为0时不启动）
+    void stopCaptureWorker(HWND hwnd);
+    ScriptTask<bool> waitForFrame(HWND hwnd);  // 等待一帧在最近一次输入之后开始截取的画面（没有后台截图线程时立即返回），返回false表示需要停止
+    void startSessionRecording(HWND hwnd, int handleIndex);  // 需要在startCaptureWorker之前调用
+    void stopSessionRecording(HWND hwnd);
+    // 记录输入时刻（之后的截图只使用在此之后开始截取的帧），录制中时同时写入录制文件
+    void markInput(HWND hwnd, SessionInputEvent::Type type, int x, int y, int x2 = 0, int y2 = 0, int value = 0);
+    quint64 calculateImageHash(const QImage& image, const QRect& roi = QRect());
+    int loadHashTolerance(QSettings &settings, const QString &templateName);  // 读取模板的哈希容差（默认ScreenRecognizer::DEFAULT_TOLERANCE，可在[HashTolerance]中按模板名覆盖）
     void loadPositionTemplates();
     void loadpositionReadyTemplates();
     void loadStudentAvatarTemplates();
+    void loadDebugImageSettings();  // 读取调试截图的开关和各类别的保存间隔
+    void loadTransitionModel();  // 读取过渡耗时模型的设置和上次保存的样本
+    void saveTransitionModel();  // 保存过渡耗时样本
+    void loadHeadpatSettings();  // 读取摸头方式和互动气泡的识别参数
 
-    QString recognizeCurrentPosition(QImage screenshot, QString targetPosition);
+    QString recognizeCurrentPosition(const ScreenState &state, QString targetPosition, const QString &windowKey = QString());
+    QString windowKeyForHandle(HWND hwnd) const;  // 句柄对应的窗口标题（用于按窗口固定服务器变体）
     void checkAndExecuteScheduledTasks();
-    void executeAllWindows();
-    bool isPositionReady(QImage screenshot, QRect roi);
-    QString checkNotice(QImage screenshot, QRect roi);
-    bool refreshCafe(HWND hwnd);
+    void executeAllWindows();  // 引擎线程：在ScriptRuntime上执行runAllWindows直到所有窗口结束
+    ScriptTask<> runAllWindows();  // 启动游戏和静音，之后为每个窗口启动一个任务（或依次执行）
+    ScriptTask<> executeWindow(int handleIndex);  // 单个窗口的完整流程
+    bool isPositionReady(const ScreenState &state, QRect roi);
+    QString checkNotice(const RoiFrame &screenshot, const ScreenState &state, QRect roi);
+    ScriptTask<bool> refreshCafe(HWND hwnd);
     
     // 参数保存/加载
     void saveTimerSettings();   // 保存定时参数到配置文件
@@ -270,20 +362,25 @@ private:
     QStringList getValidWindowTitles() const;  // 获取所有有效的窗口标题列表
     void updateStudentInviteDialog();  // 更新邀请学生对话框的窗口列表
     
-    // 工具函数
-    void sweepTask(HWND hwnd, QString titleStr);
-    bool inviteStudentToCafe(HWND hwnd, QString titleStr, int cafeNumber);  // cafeNumber: 1=咖啡厅1, 2=咖啡厅2
-    void muteSound(HWND hwnd);
-    void doTask(HWND hwnd, int taskIndex, int subTaskIndex);
-    void delayMs(int milliseconds);  // 无阻塞延时
-    bool delayMsWithCheck(int milliseconds);  // 带停止检查的延时，返回false表示需要停止
-    void click(HWND hwnd, int x, int y);  // 模拟点击
-    void clickGrid(HWND hwnd, int x1, int y1, int x2, int y2, int spacing = 50, int delay = 20);  // 地毯式点击
-    void moveMouse(int x, int y);  // 移动真实鼠标到屏幕坐标
+    // 工具函数（返回ScriptTask的是脚本协程，在引擎线程的ScriptRuntime中co_await）
+    ScriptTask<> sweepTask(HWND hwnd, QString titleStr);
+    ScriptTask<bool> inviteStudentToCafe(HWND hwnd, QString titleStr, int cafeNumber);  // cafeNumber: 1=咖啡厅1, 2=咖啡厅2
+    ScriptTask<> muteSound(HWND hwnd);
+    ScriptTask<> doTask(HWND hwnd, int taskIndex, int subTaskIndex);
+    ScriptRuntime::Delay delayMs(int milliseconds);  // 延时（co_await，挂起期间其他窗口继续执行），返回false表示需要停止
+    // 每到一帧新画面检查一次条件，返回false表示超时或需要停止
+    // expected可用时（以startedAt为起点）在预计到达的时间附近密集检查
+    ScriptTask<bool> waitUntil(HWND hwnd, int timeoutMs, std::function<bool()> condition,
+                               TransitionModel::Estimate expected = TransitionModel::Estimate(), qint64 startedAt = 0);
+    ScriptTask<> click(HWND hwnd, int x, int y);  // 模拟点击
+    ScriptTask<> clickGrid(HWND hwnd, int x1, int y1, int x2, int y2, int spacing = 50, int delay = 20);  // 地毯式点击
+    ScriptTask<bool> acquireGlobalInput(HWND hwnd);  // 以hwnd对应窗口的名义排队获取inputArbiter（成功后调用inputArbiter.release()），返回false表示超时或需要停止
+    void moveMouse(HWND hwnd, int x, int y);  // 移动真实鼠标到屏幕坐标（hwnd为发起操作的窗口）
     void moveMouseToWindow(HWND hwnd, int x, int y);  // 移动真实鼠标到窗口坐标
-    void drag(HWND hwnd, int startX, int startY, int endX, int endY, int duration = 500);  // 拖动
+    ScriptTask<> drag(HWND hwnd, int startX, int startY, int endX, int endY, int duration = 500);  // 拖动
     void dragSkill(HWND hwnd, int startX, int startY, int endX, int endY);  // 技能释放专用拖动（只负责按下和拖动）
     void releaseSkill(HWND hwnd, int x, int y);  // 释放技能（发送鼠标抬起）
+    void releaseHeldSkills();  // 抬起dragSkill之后没有releaseSkill的技能（停止时）
     void scroll(HWND hwnd, int x, int y, int delta);  // 模拟滚轮 (delta>0向上滚, delta<0向下滚)
     void pressKey(HWND hwnd, int vkCode, bool press);  // 按键控制 (press=true按下, press=false抬起)
     void pressKeyGlobal(int vkCode, bool press);  // 全局按键控制（不需要窗口句柄）
@@ -292,32 +389,39 @@ private:
     void startScript();  // 启动脚本
     void stopScript();  // 停止脚本
     void updateStartButtonState();  // 更新启动按钮状态
-    void executeScript(HWND hwnd, QString titleStr);  // 执行脚本主逻辑
+    ScriptTask<> executeScript(HWND hwnd, QString titleStr);  // 执行脚本主逻辑
     
     // 业务逻辑函数
-    void enterCafe1FromHall(HWND hwnd);
-    void enterCafe2FromCafe1(HWND hwnd);
-    void enterCafe1FromCafe2(HWND hwnd);
-    bool inviteStudentByName(HWND hwnd, QStringList studentNames, QString titleStr);
-    int findStudentInInvitationInterface(QImage image, QString studentName);
+    ScriptTask<> enterCafe1FromHall(HWND hwnd);
+    ScriptTask<> enterCafe2FromCafe1(HWND hwnd);
+    ScriptTask<> enterCafe1FromCafe2(HWND hwnd);
+    ScriptTask<bool> inviteStudentByName(HWND hwnd, QStringList studentNames, QString titleStr);
+    QVector<InvitationSlot> extractInvitationSlots(const QImage &image);  // 一次遍历提取邀请界面中所有可见的学生栏位
+    QVector<int> findStudentsInInvitationInterface(const QImage &image, const QStringList &studentNames);  // 按优先级为每个学生匹配栏位，返回标记Y坐标（0表示未找到）
     bool compareImagesByOddRows(const QImage &image1, const QImage &image2);  // 逐像素对比奇数行（已废弃）
-    QVector<bool> binarizeImage(const QImage &image, const QRgb &backgroundColor);  // 二值化图像
-    int calculateHammingDistance(const QVector<bool> &binary1, const QVector<bool> &binary2);  // 计算汉明距离
-    bool compareImagesByHamming(const QImage &image, const QVector<bool> &templateBinary, int width, int height, const QRgb &backgroundColor, double threshold = 0.95);  // 基于汉明距离的图像比较
+    ImageKernels::BitImage binarizeImage(const QImage &image, const QRgb &backgroundColor, const QRect &roi = QRect());  // 二值化图像
+    int calculateHammingDistance(const ImageKernels::BitImage &binary1, const ImageKernels::BitImage &binary2, int budget = INT_MAX);  // 计算汉明距离（超出budget提前结束）
+    bool compareImagesByHamming(const QImage &image, const StudentTemplate &templateData, const QRgb &backgroundColor, double threshold = 0.95);  // 基于汉明距离的图像比较
     
     // 辅助逻辑函数（封装重复逻辑）
-    bool waitForPosition(HWND hwnd, const QString &targetPosition, int maxRetries, int delayMs, int clickX, int clickY);
-    bool adjustCafeView(HWND hwnd, int scrollX, int scrollY, int scrollCount = 12);
-    void adjustCafePosition(HWND hwnd);
-    void patStudents(HWND hwnd, int rounds = 3);
-    void closeGameWindow(HWND hwnd);
-    void closeGameWindowByReturn(HWND hwnd);
+    ScriptTask<bool> waitForPosition(HWND hwnd, QString targetPosition, int maxRetries, int delayMs, int clickX, int clickY);
+    ScreenState screenState(HWND hwnd, const QVector<QRect> &rois, RoiFrame *frame = nullptr);  // 截取rois并用classify识别（frame返回这一帧）
+    bool isAtPosition(HWND hwnd, const QString &position);  // 截图并判断当前是否处于position
+    bool isRoiReady(HWND hwnd, const QRect &roi);  // 截图并判断roi处是否与就绪模板匹配
+    ScriptTask<bool> waitForSettle(HWND hwnd, QRect roi, QString transition, int timeoutMs = SETTLE_TIMEOUT_MS);  // 等待roi内的动画结束，返回false表示超时或需要停止
+    ScriptTask<bool> adjustCafeView(HWND hwnd, int scrollX, int scrollY, int scrollCount = 12);
+    ScriptTask<> adjustCafePosition(HWND hwnd);
+    ScriptTask<> patStudents(HWND hwnd, int rounds = 3);
+    ScriptTask<int> patVisibleStudents(HWND hwnd, bool *uncleared = nullptr);  // 识别互动气泡并点击对应的学生，返回点击的次数；uncleared返回点击后气泡是否仍在原处
+    ScriptTask<> closeGameWindow(HWND hwnd);
+    ScriptTask<> closeGameWindowByReturn(HWND hwnd);
     
 #if DEBUG_MODE
     // 调试功能函数
     void screenshotDebug();
     void clickDebug();
     void keyDebug();
+    void benchmarkDebug();  // 识别内核性能测试
 #endif
 };
 #endif // ARONA_H
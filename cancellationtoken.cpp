@@ -0,0 +1,59 @@
+#include "cancellationtoken.h"
+
+#include <QElapsedTimer>
+#include <QMutexLocker>
+
+void CancellationToken::cancel()
+{
+    QMutexLocker locker(&mutex);
+    cancelled.store(true);
+    wakeup.wakeAll();
+    for (const ExternalWaiter &waiter : waiters) {
+        QMutexLocker waiterLocker(waiter.mutex);
+        waiter.condition->wakeAll();
+    }
+}
+
+void CancellationToken::reset()
+{
+    cancelled.store(false);
+}
+
+bool CancellationToken::waitFor(int milliseconds) const
+{
+    QElapsedTimer timer;
+    timer.start();
+    QMutexLocker locker(&mutex);
+    while (!cancelled.load()) {
+        const qint64 remaining = milliseconds - timer.elapsed();
+        if (remaining <= 0) {
+            return true;
+        }
+        wakeup.wait(&mutex, ulong(remaining));
+    }
+    return false;
+}
+
+CancellationToken::Waiter::Waiter(const CancellationToken *token, QMutex *mutex, QWaitCondition *condition)
+    : token(token)
+    , mutex(mutex)
+    , condition(condition)
+{
+    if (token) {
+        QMutexLocker locker(&token->mutex);
+        token->waiters.append({mutex, condition});
+    }
+}
+
+CancellationToken::Waiter::~Waiter()
+{
+    if (token) {
+        QMutexLocker locker(&token->mutex);
+        for (int i = 0; i < token->waiters.size(); i++) {
+            if (token->waiters[i].mutex == mutex && token->waiters[i].condition == condition) {
+                token->waiters.remove(i);
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef CANCELLATIONTOKEN_H
+#define CANCELLATIONTOKEN_H
+
+#include <QMutex>
+#include <QVector>
+#include <QWaitCondition>
+#include <atomic>
+
+// 协作式取消标志
+// 停止请求由GUI线程发出，引擎线程在检查点读取isCancelled()；
+// waitFor在被取消时立即返回，工作线程中的等待不必等到结束才响应停止（脚本协程的延时见ScriptRuntime）
+class CancellationToken
+{
+public:
+    bool isCancelled() const { return cancelled.load(); }
+    void cancel();
+    void reset();
+
+    // 等待milliseconds毫秒，返回false表示等待期间（或之前）已被取消
+    bool waitFor(int milliseconds) const;
+
+    // 在其他条件变量上等待时登记到令牌（作用域内有效），取消时会在持有mutex的情况下唤醒condition
+    // 等待方在持有mutex时检查isCancelled()再等待，不会错过取消；必须在锁住mutex之前构造（cancel先锁令牌再锁mutex）
+    class Waiter
+    {
+    public:
+        Waiter(const CancellationToken *token, QMutex *mutex, QWaitCondition *condition);
+        ~Waiter();
+        Waiter(const Waiter &) = delete;
+        Waiter &operator=(const Waiter &) = delete;
+
+    private:
+        const CancellationToken *token;
+        QMutex *mutex;
+        QWaitCondition *condition;
+    };
+
+private:
+    struct ExternalWaiter {
+        QMutex *mutex;
+        QWaitCondition *condition;
+    };
+
+    std::atomic<bool> cancelled{false};
+    mutable QMutex mutex;
+    mutable QWaitCondition wakeup;
+    mutable QVector<ExternalWaiter> waiters;  // mutex保护
+};
+
+#endif // CANCELLATIONTOKEN_H
@@ -0,0 +1,103 @@
+#include "capturesource.h"
+
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QRegularExpression>
+#include <QTextStream>
+
+RoiFrame ICaptureSource::captureRegions(const QVector<QRect> &rois)
+{
+    QImage image = capture();
+    if (image.isNull()) {
+        return RoiFrame();
+    }
+    return RoiFrame::fromImage(image, rois);
+}
+
+ReplayCaptureSource::ReplayCaptureSource(const QString &directory, bool loop, int defaultIntervalMs)
+    : directory(directory)
+    , loop(loop)
+{
+    QDir dir(directory);
+    if (!dir.exists()) {
+        errorString = QString("回放目录不存在: %1").arg(directory);
+        return;
+    }
+
+    files = dir.entryList(QStringList() << "*.png" << "*.PNG" << "*.bmp" << "*.jpg", QDir::Files, QDir::Name);
+    if (files.isEmpty()) {
+        errorString = QString("回放目录中没有图片: %1").arg(directory);
+        return;
+    }
+
+    // timestamps.txt 优先
+    QHash<QString, qint64> listed;
+    QFile list(dir.filePath("timestamps.txt"));
+    if (list.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        QTextStream stream(&list);
+        while (!stream.atEnd()) {
+            QStringList parts = stream.readLine().trimmed().split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
+            if (parts.size() >= 2) {
+                listed.insert(parts[0], parts[1].toLongLong());
+            }
+        }
+    }
+
+    static const QRegularExpression leadingNumber("^(\\d+)");
+    for (int i = 0; i < files.size(); ++i) {
+        if (listed.contains(files[i])) {
+            timestamps.append(listed.value(files[i]));
+            continue;
+        }
+        QRegularExpressionMatch match = leadingNumber.match(files[i]);
+        timestamps.append(match.hasMatch() ? match.captured(1).toLongLong() : qint64(i) * defaultIntervalMs);
+    }
+}
+
+void ReplayCaptureSource::rewind()
+{
+    index = 0;
+    lastTimestamp = 0;
+    loopOffset = 0;
+}
+
+void ReplayCaptureSource::preload()
+{
+    cache.resize(files.size());
+    for (int i = 0; i < files.size(); ++i) {
+        cache[i] = QImage(QDir(directory).filePath(files[i])).convertToFormat(QImage::Format_RGB32);
+    }
+}
+
+QImage ReplayCaptureSource::capture()
+{
+    if (files.isEmpty()) {
+        return QImage();
+    }
+    if (index >= files.size()) {
+        if (!loop) {
+            errorString = "回放已结束";
+            return QImage();
+        }
+        // 下一轮的时间戳接在上一轮最后一帧之后
+        loopOffset = lastTimestamp + (timestamps.size() > 1 ? timestamps[1] - timestamps[0] : 0);
+        index = 0;
+    }
+
+    const int current = index++;
+    QImage image = current < cache.size() && !cache[current].isNull()
+                       ? cache[current]
+                       : QImage(QDir(directory).filePath(files[current]));
+    if (image.isNull()) {
+        errorString = QString("无法加载回放帧: %1").arg(files[current]);
+        return QImage();
+    }
+    lastTimestamp = loopOffset + timestamps[current] - timestamps[0];
+
+    // 与WindowCapture的输出格式保持一致
+    if (image.format() != QImage::Format_RGB32) {
+        image = image.convertToFormat(QImage::Format_RGB32);
+    }
+    return image;
+}
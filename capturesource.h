@@ -0,0 +1,67 @@
+#ifndef CAPTURESOURCE_H
+#define CAPTURESOURCE_H
+
+#include <QImage>
+#include <QRect>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "roiframe.h"
+
+// 截图来源接口
+// 识别代码只通过该接口获取画面：Windows下为游戏窗口截图（WindowCapture），
+// 离线调试和Linux上的性能/回归测试使用ReplayCaptureSource回放录制好的画面
+class ICaptureSource
+{
+public:
+    virtual ~ICaptureSource() {}
+
+    // 获取下一帧，失败返回空图像（原因见lastError）
+    virtual QImage capture() = 0;
+    // 只保留指定ROI，默认实现为截取整帧后复制ROI
+    virtual RoiFrame captureRegions(const QVector<QRect> &rois);
+
+    // 最近一帧的时间戳（毫秒，从来源开始计时）
+    virtual qint64 frameTimestamp() const = 0;
+    virtual QString lastError() const = 0;
+    virtual QString sourceName() const = 0;
+};
+
+// 回放截图目录
+// 目录中的图片按文件名排序依次返回；时间戳按以下顺序确定：
+//   1. 目录中的timestamps.txt，每行 "文件名<Tab或空格>毫秒"
+//   2. 文件名开头的数字（如 "001250_hall.png" -> 1250ms）
+//   3. 帧序号 * defaultIntervalMs
+// 回放到末尾后，loop为true时从头开始，否则返回空图像
+class ReplayCaptureSource : public ICaptureSource
+{
+public:
+    explicit ReplayCaptureSource(const QString &directory, bool loop = false, int defaultIntervalMs = 100);
+
+    bool isValid() const { return !files.isEmpty(); }
+    int frameCount() const { return files.size(); }
+    int currentIndex() const { return index; }
+    bool atEnd() const { return !loop && index >= files.size(); }
+    void rewind();
+
+    // 预先解码全部帧，性能测试时排除PNG解码的耗时
+    void preload();
+
+    QImage capture() override;
+    qint64 frameTimestamp() const override { return lastTimestamp; }
+    QString lastError() const override { return errorString; }
+    QString sourceName() const override { return directory; }
+
+private:
+    QString directory;
+    bool loop;
+    QStringList files;
+    QVector<qint64> timestamps;
+    QVector<QImage> cache;      // preload()后的解码结果
+    int index = 0;
+    qint64 lastTimestamp = 0;
+    qint64 loopOffset = 0;      // 循环回放时累加的时间偏移，保证时间戳单调递增
+    QString errorString;
+};
+
+#endif // CAPTURESOURCE_H
@@ -0,0 +1,114 @@
+#include "captureworker.h"
+
+#include <QMutexLocker>
+#include <chrono>
+#include "cancellationtoken.h"
+#include "sessionrecording.h"
+
+CaptureWorker::CaptureWorker(ICaptureSource *source, int intervalMs, QObject *parent)
+    : QThread(parent)
+    , source(source)
+    , intervalMs(qMax(1, intervalMs))
+{
+}
+
+CaptureWorker::~CaptureWorker()
+{
+    stop();
+}
+
+void CaptureWorker::stop()
+{
+    stopping.store(true);
+    {
+        QMutexLocker locker(&frameMutex);
+        frameArrived.wakeAll();
+    }
+    wait();
+}
+
+qint64 CaptureWorker::clockMs()
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+QString CaptureWorker::lastError() const
+{
+    QMutexLocker locker(&errorMutex);
+    return errorString;
+}
+
+CaptureWorker::Frame CaptureWorker::latestFrame()
+{
+    ring.update();
+    return ring.readSlot();
+}
+
+CaptureWorker::Frame CaptureWorker::waitForFrame(qint64 notBefore, int timeoutMs, const CancellationToken *cancel)
+{
+    Frame frame = latestFrame();
+    if (!isRunning()) {
+        return frame;
+    }
+
+    // 先登记取消通知再加锁；之后在锁内检查帧和取消状态，发布新帧和取消都要先拿到这把锁才能唤醒，不会丢失
+    CancellationToken::Waiter cancelWaiter(cancel, &frameMutex, &frameArrived);
+    QMutexLocker locker(&frameMutex);
+    const qint64 deadline = clockMs() + timeoutMs;
+    for (;;) {
+        frame = latestFrame();
+        if (!frame.isNull() && frame.startedAt >= notBefore) {
+            break;
+        }
+        const qint64 remaining = deadline - clockMs();
+        if (remaining <= 0 || stopping.load() || !isRunning() || (cancel && cancel->isCancelled())) {
+            break;
+        }
+        frameArrived.wait(&frameMutex, ulong(remaining));
+    }
+    return frame;
+}
+
+void CaptureWorker::run()
+{
+    while (!stopping.load()) {
+        // 先释放写入槽中的旧帧，让WindowCapture的帧池可以复用它
+        ring.writeSlot().image = QImage();
+
+        const qint64 startedAt = clockMs();
+        QImage image = source->capture();
+        const qint64 finishedAt = clockMs();
+
+        if (image.isNull()) {
+            failed++;
+            QMutexLocker locker(&errorMutex);
+            errorString = source->lastError();
+        } else {
+            Frame &slot = ring.writeSlot();
+            slot.image = image;
+            slot.startedAt = startedAt;
+            slot.finishedAt = finishedAt;
+            slot.sequence = ++captured;
+            ring.publish();
+            {
+                QMutexLocker locker(&frameMutex);
+                frameArrived.wakeAll();
+            }
+            if (frameListener) {
+                frameListener();
+            }
+            if (recorder) {
+                recorder->recordFrame(image, startedAt);
+            }
+        }
+
+        // 按固定间隔截图（截图本身的耗时计入间隔）；分段休眠以便及时响应stop()
+        const qint64 next = startedAt + intervalMs.load();
+        qint64 now = clockMs();
+        while (!stopping.load() && now < next) {
+            QThread::msleep(ulong(qMin<qint64>(next - now, 10)));
+            now = clockMs();
+        }
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef CAPTUREWORKER_H
+#define CAPTUREWORKER_H
+
+#include <QImage>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+#include <atomic>
+#include <functional>
+#include "capturesource.h"
+
+class SessionRecorder;
+class CancellationToken;
+
+// 单生产者/单消费者的最新帧缓冲（无锁三缓冲）
+// 三个槽位轮换：生产者写back，写完与middle交换；消费者需要新帧时把front与middle交换
+// 双方从不同时访问同一个槽位，生产者不会被消费者阻塞，消费者总是拿到最新写入的一帧
+template <typename T>
+class LatestFrameRing
+{
+public:
+    // 生产者线程调用
+    T &writeSlot() { return slots[back]; }
+    void publish()
+    {
+        back = middle.exchange(back | FreshBit, std::memory_order_acq_rel) & IndexMask;
+    }
+
+    // 消费者线程调用：有新帧时切换到新帧，返回false表示自上次以来没有新帧
+    bool update()
+    {
+        if (!(middle.load(std::memory_order_acquire) & FreshBit)) {
+            return false;
+        }
+        front = middle.exchange(front, std::memory_order_acq_rel) & IndexMask;
+        return true;
+    }
+    const T &readSlot() const { return slots[front]; }
+
+private:
+    enum { IndexMask = 3, FreshBit = 4 };
+
+    T slots[3];
+    int back = 0;                   // 只由生产者访问
+    int front = 1;                  // 只由消费者访问
+    std::atomic<int> middle{2};     // 槽位序号 | FreshBit
+};
+
+// 单个窗口的后台截图线程
+// 按固定间隔从ICaptureSource截图并写入最新帧缓冲，识别代码取最新一帧而不必等待PrintWindow，
+// 截图耗时与脚本中的延时重叠。运行期间截图来源只由本线程访问（ICaptureSource不是线程安全的）
+class CaptureWorker : public QThread
+{
+public:
+    struct Frame {
+        QImage image;
+        qint64 startedAt = 0;       // 开始截图的时刻（clockMs）
+        qint64 finishedAt = 0;      // 截图完成的时刻（clockMs）
+        quint64 sequence = 0;       // 帧序号，从1开始
+
+        bool isNull() const { return image.isNull(); }
+    };
+
+    // source由调用方持有，必须在stop()之后才能销毁
+    explicit CaptureWorker(ICaptureSource *source, int intervalMs, QObject *parent = nullptr);
+    ~CaptureWorker();
+
+    // 停止截图并等待线程退出
+    void stop();
+
+    // 把每一帧同时交给录制器（只能在start()之前设置，录制器必须在stop()之后才能关闭）
+    void setRecorder(SessionRecorder *recorder) { this->recorder = recorder; }
+    // 每发布一帧在截图线程上调用一次（如唤醒等待新画面的协程，见ScriptSignal）；只能在start()之前设置
+    void setFrameListener(std::function<void()> listener) { frameListener = std::move(listener); }
+
+    int interval() const { return intervalMs.load(); }
+    void setInterval(int ms) { intervalMs.store(qMax(1, ms)); }
+
+    // 最新一帧（不阻塞，还没有截到任何帧时返回空帧）；只能由同一个消费者线程调用
+    Frame latestFrame();
+    // 等待一帧在notBefore之后开始截取的画面（如输入操作之后），最多等待timeoutMs
+    // 等待时阻塞在条件变量上，每发布一帧、cancel被取消或截图线程停止时被唤醒
+    // 超时或cancel被取消时返回当前最新一帧（可能为空或早于notBefore）
+    Frame waitForFrame(qint64 notBefore, int timeoutMs, const CancellationToken *cancel = nullptr);
+
+    quint64 framesCaptured() const { return captured.load(); }
+    quint64 framesFailed() const { return failed.load(); }
+    QString lastError() const;
+
+    // 统一的单调时钟（毫秒），供调用方记录输入时刻并与帧时间比较
+    static qint64 clockMs();
+
+protected:
+    void run() override;
+
+private:
+    ICaptureSource *source;
+    SessionRecorder *recorder = nullptr;
+    std::function<void()> frameListener;
+    std::atomic<int> intervalMs;
+    std::atomic<bool> stopping{false};
+    std::atomic<quint64> captured{0};
+    std::atomic<quint64> failed{0};
+    LatestFrameRing<Frame> ring;
+    QMutex frameMutex;              // 只用于新帧通知（帧本身在无锁缓冲中）
+    QWaitCondition frameArrived;
+    mutable QMutex errorMutex;      // 只保护错误信息（失败时才写入）
+    QString errorString;
+};
+
+#endif // CAPTUREWORKER_H
@@ -0,0 +1,189 @@
+#include "debugimagesink.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QMutexLocker>
+
+namespace {
+
+// 每个类别最多记住的内容哈希数，超过后清空重新记录（只影响去重，不影响正确性）
+const int MAX_SAVED_HASHES = 1024;
+
+} // namespace
+
+DebugImageSink::DebugImageSink(const QString &directory, int maxPending, QObject *parent)
+    : QThread(parent)
+    , maxPending(qMax(1, maxPending))
+    , dir(directory)
+{
+    clock.start();
+}
+
+DebugImageSink::~DebugImageSink()
+{
+    stop();
+}
+
+void DebugImageSink::setDirectory(const QString &directory)
+{
+    QMutexLocker locker(&mutex);
+    dir = directory;
+}
+
+QString DebugImageSink::directory() const
+{
+    QMutexLocker locker(&mutex);
+    return dir;
+}
+
+void DebugImageSink::setDefaultPolicy(const Policy &policy)
+{
+    QMutexLocker locker(&mutex);
+    defaultPolicy = policy;
+}
+
+void DebugImageSink::setPolicy(const QString &category, const Policy &policy)
+{
+    QMutexLocker locker(&mutex);
+    policies.insert(category, policy);
+}
+
+DebugImageSink::Policy DebugImageSink::policyFor(const QString &category) const
+{
+    return policies.value(category, defaultPolicy);
+}
+
+QString DebugImageSink::submit(const QString &category, const QImage &image, const QString &fileName)
+{
+    if (!enabled.load() || image.isNull()) {
+        return QString();
+    }
+
+    QMutexLocker locker(&mutex);
+    if (stopping) {
+        return QString();
+    }
+
+    const Policy policy = policyFor(category);
+    const qint64 now = clock.elapsed();
+    if (policy.minIntervalMs > 0 && lastAccepted.contains(category)
+        && now - lastAccepted.value(category) < policy.minIntervalMs) {
+        counters.rateLimited++;
+        return QString();
+    }
+    if (queue.size() >= maxPending) {
+        counters.dropped++;
+        return QString();
+    }
+    lastAccepted.insert(category, now);
+
+    Item item;
+    item.category = category;
+    item.image = image;
+    item.dedupe = policy.dedupe;
+    item.path = QDir(dir).filePath(fileName.isEmpty()
+                                       ? QString("%1_%2.png").arg(category, QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss_zzz"))
+                                       : fileName);
+    queue.enqueue(item);
+
+    if (!isRunning()) {
+        start(QThread::LowPriority);
+    }
+    wakeup.wakeOne();
+    return item.path;
+}
+
+void DebugImageSink::flush()
+{
+    QMutexLocker locker(&mutex);
+    while ((!queue.isEmpty() || writing) && isRunning()) {
+        drained.wait(&mutex);
+    }
+}
+
+void DebugImageSink::stop()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        wakeup.wakeOne();
+    }
+    wait();
+    QMutexLocker locker(&mutex);
+    stopping = false;
+}
+
+DebugImageSink::Stats DebugImageSink::stats() const
+{
+    QMutexLocker locker(&mutex);
+    return counters;
+}
+
+QString DebugImageSink::lastError() const
+{
+    QMutexLocker locker(&mutex);
+    return errorString;
+}
+
+quint64 DebugImageSink::contentHash(const QImage &image)
+{
+    // 按扫描行计算（跳过行尾的对齐填充），尺寸和格式也参与哈希
+    quint64 hash = qHash(image.width()) ^ (quint64(qHash(image.height())) << 32) ^ quint64(image.format());
+    const int bytesPerRow = (image.width() * image.depth() + 7) / 8;
+    for (int y = 0; y < image.height(); ++y) {
+        hash = hash * 1099511628211ULL ^ qHashBits(image.constScanLine(y), size_t(bytesPerRow), uint(y));
+    }
+    return hash;
+}
+
+void DebugImageSink::run()
+{
+    for (;;) {
+        Item item;
+        {
+            QMutexLocker locker(&mutex);
+            writing = false;
+            if (queue.isEmpty()) {
+                drained.wakeAll();
+            }
+            while (queue.isEmpty() && !stopping) {
+                wakeup.wait(&mutex);
+            }
+            if (queue.isEmpty()) {
+                break;
+            }
+            item = queue.dequeue();
+            writing = true;
+        }
+
+        if (item.dedupe) {
+            QSet<quint64> &saved = savedHashes[item.category];
+            const quint64 hash = contentHash(item.image);
+            if (saved.contains(hash)) {
+                QMutexLocker locker(&mutex);
+                counters.duplicates++;
+                continue;
+            }
+            if (saved.size() >= MAX_SAVED_HASHES) {
+                saved.clear();
+            }
+            saved.insert(hash);
+        }
+
+        QDir().mkpath(QFileInfo(item.path).absolutePath());
+        const bool ok = item.image.save(item.path);
+
+        QMutexLocker locker(&mutex);
+        if (ok) {
+            counters.written++;
+        } else {
+            counters.failed++;
+            errorString = QString("保存调试图片失败: %1").arg(item.path);
+        }
+    }
+
+    QMutexLocker locker(&mutex);
+    writing = false;
+    drained.wakeAll();
+}
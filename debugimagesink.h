@@ -0,0 +1,94 @@
+#ifndef DEBUGIMAGESINK_H
+#define DEBUGIMAGESINK_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QQueue>
+#include <QSet>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+#include <atomic>
+
+// 调试图片的异步保存
+// 调用方只做开关和限速检查，把图片（隐式共享，不复制）放入有界队列；
+// PNG编码、去重和写文件都在后台线程完成，不阻塞GUI线程
+// 每个类别可以设置最小保存间隔和是否按内容去重（同一类别中内容相同的图片只保存一次）
+// submit可以在任意线程调用
+class DebugImageSink : public QThread
+{
+public:
+    struct Policy {
+        int minIntervalMs = 0;      // 同一类别两次保存之间的最小间隔，0为不限速
+        bool dedupe = true;         // 跳过与该类别中已保存图片内容相同的图片
+    };
+
+    struct Stats {
+        quint64 written = 0;        // 成功写入的图片数
+        quint64 rateLimited = 0;    // 因限速丢弃
+        quint64 duplicates = 0;     // 因内容重复丢弃
+        quint64 dropped = 0;        // 因队列已满丢弃
+        quint64 failed = 0;         // 写入失败
+    };
+
+    explicit DebugImageSink(const QString &directory = "screenshots", int maxPending = 16, QObject *parent = nullptr);
+    ~DebugImageSink();
+
+    // 运行时开关，关闭后submit直接返回（已在队列中的图片仍会写完）
+    void setEnabled(bool enabled) { this->enabled.store(enabled); }
+    bool isEnabled() const { return enabled.load(); }
+
+    void setDirectory(const QString &directory);
+    QString directory() const;
+    void setDefaultPolicy(const Policy &policy);
+    void setPolicy(const QString &category, const Policy &policy);
+
+    // 提交一张图片，返回保存路径；被关闭、限速或队列已满时返回空字符串
+    // fileName为相对保存目录的文件名，为空时使用"类别_时间.png"
+    // 内容去重在写入线程进行，返回路径不代表一定会写入
+    QString submit(const QString &category, const QImage &image, const QString &fileName = QString());
+    // 等待队列中的图片全部写完
+    void flush();
+    // 写完队列后停止线程
+    void stop();
+
+    Stats stats() const;
+    QString lastError() const;
+
+protected:
+    void run() override;
+
+private:
+    struct Item {
+        QString category;
+        QString path;
+        QImage image;
+        bool dedupe = true;
+    };
+
+    Policy policyFor(const QString &category) const;
+    static quint64 contentHash(const QImage &image);
+
+    const int maxPending;
+    std::atomic<bool> enabled{true};
+    QElapsedTimer clock;
+
+    mutable QMutex mutex;           // 保护以下全部成员
+    QWaitCondition wakeup;          // 有新图片或需要停止
+    QWaitCondition drained;         // 队列已清空且当前图片已写完
+    QString dir;
+    Policy defaultPolicy;
+    QHash<QString, Policy> policies;
+    QHash<QString, qint64> lastAccepted;        // 每个类别最近一次接受图片的时刻
+    QQueue<Item> queue;
+    bool writing = false;
+    bool stopping = false;
+    Stats counters;
+    QString errorString;
+
+    QHash<QString, QSet<quint64>> savedHashes;  // 每个类别已保存图片的内容哈希（只由写入线程访问）
+};
+
+#endif // DEBUGIMAGESINK_H
@@ -0,0 +1,89 @@
+#include "headpatdetector.h"
+
+#include <algorithm>
+
+bool HeadpatDetector::matches(QRgb pixel) const
+{
+    return qAbs(qRed(pixel) - qRed(opts.bubbleColor)) <= opts.tolerance
+        && qAbs(qGreen(pixel) - qGreen(opts.bubbleColor)) <= opts.tolerance
+        && qAbs(qBlue(pixel) - qBlue(opts.bubbleColor)) <= opts.tolerance;
+}
+
+QVector<HeadpatDetector::Bubble> HeadpatDetector::detect(const QImage &source, const QRect &area) const
+{
+    QVector<Bubble> bubbles;
+    if (source.isNull()) {
+        return bubbles;
+    }
+    const QImage image = (source.format() == QImage::Format_RGB32 || source.format() == QImage::Format_ARGB32
+                          || source.format() == QImage::Format_ARGB32_Premultiplied)
+                             ? source
+                             : source.convertToFormat(QImage::Format_RGB32);
+    const QRect rect = area.isNull() ? image.rect() : (area & image.rect());
+    const int step = qMax(1, opts.step);
+    const int cols = (rect.width() + step - 1) / step;
+    const int rows = (rect.height() + step - 1) / step;
+    if (cols <= 0 || rows <= 0) {
+        return bubbles;
+    }
+
+    // 采样网格上的颜色掩码：0为不匹配，1为匹配但未归入色块，2为已归入色块
+    QVector<uchar> mask(cols * rows, 0);
+    for (int row = 0; row < rows; ++row) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(image.constScanLine(rect.top() + row * step));
+        for (int col = 0; col < cols; ++col) {
+            if (matches(line[rect.left() + col * step])) {
+                mask[row * cols + col] = 1;
+            }
+        }
+    }
+
+    // 四连通洪水填充，统计每个色块的大小和外接矩形
+    QVector<int> stack;
+    for (int start = 0; start < mask.size(); ++start) {
+        if (mask[start] != 1) {
+            continue;
+        }
+        mask[start] = 2;
+        stack.append(start);
+        int count = 0;
+        int minCol = cols, maxCol = -1, minRow = rows, maxRow = -1;
+        qint64 sumCol = 0, sumRow = 0;
+        while (!stack.isEmpty()) {
+            const int index = stack.takeLast();
+            const int row = index / cols;
+            const int col = index % cols;
+            count++;
+            sumCol += col;
+            sumRow += row;
+            minCol = qMin(minCol, col);
+            maxCol = qMax(maxCol, col);
+            minRow = qMin(minRow, row);
+            maxRow = qMax(maxRow, row);
+
+            const int neighbours[4] = {col > 0 ? index - 1 : -1, col + 1 < cols ? index + 1 : -1,
+                                       row > 0 ? index - cols : -1, row + 1 < rows ? index + cols : -1};
+            for (int neighbour : neighbours) {
+                if (neighbour >= 0 && mask[neighbour] == 1) {
+                    mask[neighbour] = 2;
+                    stack.append(neighbour);
+                }
+            }
+        }
+
+        if (count < opts.minSamples || count > opts.maxSamples) {
+            continue;
+        }
+        Bubble bubble;
+        bubble.samples = count;
+        bubble.center = QPoint(rect.left() + int(sumCol * step / count), rect.top() + int(sumRow * step / count));
+        bubble.bounds = QRect(QPoint(rect.left() + minCol * step, rect.top() + minRow * step),
+                              QPoint(rect.left() + maxCol * step, rect.top() + maxRow * step));
+        bubbles.append(bubble);
+    }
+
+    std::sort(bubbles.begin(), bubbles.end(), [](const Bubble &a, const Bubble &b) {
+        return a.center.y() != b.center.y() ? a.center.y() < b.center.y() : a.center.x() < b.center.x();
+    });
+    return bubbles;
+}
@@ -0,0 +1,45 @@
+#ifndef HEADPATDETECTOR_H
+#define HEADPATDETECTOR_H
+
+#include <QImage>
+#include <QPoint>
+#include <QRect>
+#include <QVector>
+
+// 咖啡厅中可摸头学生的检测
+// 可以摸头的学生头顶会显示互动气泡，按气泡颜色在截图中寻找连通的色块，
+// 大小在范围内的色块视为一个气泡，返回其中心；点击位置由调用方按偏移量换算到学生身上
+// 在稀疏网格上采样（每step个像素一个点），不做完整的逐像素扫描
+class HeadpatDetector
+{
+public:
+    struct Options {
+        QRgb bubbleColor = qRgb(255, 225, 90);  // 气泡的主色
+        int tolerance = 40;                     // RGB各分量允许的偏差
+        int step = 4;                           // 采样间隔（像素）
+        int minSamples = 6;                     // 一个气泡最少包含的采样点数
+        int maxSamples = 400;                   // 超过时视为背景中的大片同色区域
+    };
+
+    struct Bubble {
+        QPoint center;      // 色块中心（截图坐标）
+        QRect bounds;       // 色块外接矩形（截图坐标）
+        int samples = 0;    // 色块包含的采样点数
+    };
+
+    HeadpatDetector() = default;
+    explicit HeadpatDetector(const Options &options) : opts(options) {}
+
+    void setOptions(const Options &options) { opts = options; }
+    Options options() const { return opts; }
+
+    // 在area内（为空时使用整张截图）查找气泡，按从上到下、从左到右排序
+    QVector<Bubble> detect(const QImage &image, const QRect &area = QRect()) const;
+
+private:
+    bool matches(QRgb pixel) const;
+
+    Options opts;
+};
+
+#endif // HEADPATDETECTOR_H
@@ -0,0 +1,489 @@
+#include "imagekernels.h"
+#include <QtAlgorithms>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ARONA_X86_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define ARONA_X86_SIMD 0
+#endif
+
+// GCC/Clang需要为单个函数开启指令集；MSVC可以直接使用内建函数
+#if ARONA_X86_SIMD && (defined(__GNUC__) || defined(__clang__))
+#define ARONA_TARGET_SSE2 __attribute__((target("sse2")))
+#define ARONA_TARGET_AVX2 __attribute__((target("avx2")))
+#define ARONA_TARGET_POPCNT __attribute__((target("popcnt")))
+#else
+#define ARONA_TARGET_SSE2
+#define ARONA_TARGET_AVX2
+#define ARONA_TARGET_POPCNT
+#endif
+
+namespace {
+
+// 按面积权重把ROI累加到8x8个格子中
+// 坐标系：一个源像素宽8个单位，一个格子宽w(h)个单位，因此每个像素的横向/纵向权重之和恒为8，
+// 像素最多跨越两个格子（要求ROI不小于8x8）。所有格子面积相同，直接比较加权和即可得到平均哈希
+template <typename Pixel, typename GrayFn>
+quint64 hashRows(const QImage &image, const QRect &rect, GrayFn toGray)
+{
+    const int w = rect.width();
+    const int h = rect.height();
+
+    quint64 cells[64] = {0};
+    int cellY = 0;
+    int boundaryY = h;  // 当前格子行的下边界
+
+    for (int y = 0; y < h; ++y) {
+        const Pixel *line = reinterpret_cast<const Pixel *>(image.constScanLine(rect.y() + y)) + rect.x();
+
+        // 横向：一行像素累加进8个格子
+        quint32 rowCells[8] = {0};
+        int cellX = 0;
+        int boundaryX = w;  // 当前格子的右边界
+        for (int x = 0; x < w; ++x) {
+            const quint32 gray = toGray(line[x]);
+            const int left = boundaryX - x * 8;  // 当前格子内剩余的宽度，始终在(0, w]内
+            if (left >= 8) {
+                rowCells[cellX] += gray * 8;
+                if (left == 8) {
+                    cellX++;
+                    boundaryX += w;
+                }
+            } else {
+                rowCells[cellX] += gray * left;
+                rowCells[cellX + 1] += gray * (8 - left);
+                cellX++;
+                boundaryX += w;
+            }
+        }
+
+        // 纵向：把这一行分配到对应的格子行
+        const int top = boundaryY - y * 8;
+        quint64 *cellRow = cells + cellY * 8;
+        if (top >= 8) {
+            for (int i = 0; i < 8; ++i) {
+                cellRow[i] += quint64(rowCells[i]) * 8;
+            }
+            if (top == 8) {
+                cellY++;
+                boundaryY += h;
+            }
+        } else {
+            quint64 *nextRow = cellRow + 8;
+            for (int i = 0; i < 8; ++i) {
+                cellRow[i] += quint64(rowCells[i]) * top;
+                nextRow[i] += quint64(rowCells[i]) * (8 - top);
+            }
+            cellY++;
+            boundaryY += h;
+        }
+    }
+
+    // 格子值 >= 平均值 记为1（cell >= total / 64 等价于 cell * 64 >= total，避免取整误差）
+    quint64 total = 0;
+    for (int i = 0; i < 64; ++i) {
+        total += cells[i];
+    }
+
+    quint64 hash = 0;
+    for (int i = 0; i < 64; ++i) {
+        hash <<= 1;
+        if (cells[i] * 64 >= total) {
+            hash |= 1;
+        }
+    }
+    return hash;
+}
+
+// ==================== 二值化内核 ====================
+
+// 单行二值化函数：把width个像素写入 (width+63)/64 个字
+typedef void (*BinarizeRowFn)(const QRgb *line, int width, QRgb background, int tolerance, quint64 *out);
+
+// 标量实现，同时用于SIMD版本的行尾处理
+void binarizeRowScalar(const QRgb *line, int width, QRgb background, int tolerance, quint64 *out, int startX = 0)
+{
+    const int bgR = qRed(background);
+    const int bgG = qGreen(background);
+    const int bgB = qBlue(background);
+
+    quint64 word = (startX & 63) ? out[startX >> 6] : 0;
+    for (int x = startX; x < width; ++x) {
+        const QRgb pixel = line[x];
+        const bool isBackground = (qAbs(qRed(pixel) - bgR) <= tolerance) &&
+                                  (qAbs(qGreen(pixel) - bgG) <= tolerance) &&
+                                  (qAbs(qBlue(pixel) - bgB) <= tolerance);
+        if (!isBackground) {
+            word |= quint64(1) << (x & 63);
+        }
+        if ((x & 63) == 63) {
+            out[x >> 6] = word;
+            word = 0;
+        }
+    }
+    if (width & 63) {
+        out[width >> 6] = word;
+    }
+}
+
+void binarizeRowScalarFn(const QRgb *line, int width, QRgb background, int tolerance, quint64 *out)
+{
+    binarizeRowScalar(line, width, background, tolerance, out);
+}
+
+#if ARONA_X86_SIMD
+// 每个32位像素按字节求 |像素 - 背景| 再减去容差（饱和减法），结果全为0即为背景像素
+// Alpha字节的容差设为255，因此Alpha通道不参与比较
+ARONA_TARGET_SSE2
+void binarizeRowSSE2(const QRgb *line, int width, QRgb background, int tolerance, quint64 *out)
+{
+    const quint32 t = quint32(tolerance);
+    const __m128i bg = _mm_set1_epi32(int(background & 0x00FFFFFFu));
+    const __m128i tol = _mm_set1_epi32(int(0xFF000000u | (t << 16) | (t << 8) | t));
+    const __m128i zero = _mm_setzero_si128();
+
+    const int simdWidth = width & ~3;
+    quint64 word = 0;
+    for (int x = 0; x < simdWidth; x += 4) {
+        const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(line + x));
+        const __m128i diff = _mm_or_si128(_mm_subs_epu8(px, bg), _mm_subs_epu8(bg, px));
+        const __m128i isBackground = _mm_cmpeq_epi32(_mm_subs_epu8(diff, tol), zero);
+        const int foreground = ~_mm_movemask_ps(_mm_castsi128_ps(isBackground)) & 0xF;
+        word |= quint64(foreground) << (x & 63);
+        if ((x & 63) == 60) {
+            out[x >> 6] = word;
+            word = 0;
+        }
+    }
+    if (simdWidth & 63) {
+        out[simdWidth >> 6] = word;
+    }
+    binarizeRowScalar(line, width, background, tolerance, out, simdWidth);
+}
+
+ARONA_TARGET_AVX2
+void binarizeRowAVX2(const QRgb *line, int width, QRgb background, int tolerance, quint64 *out)
+{
+    const quint32 t = quint32(tolerance);
+    const __m256i bg = _mm256_set1_epi32(int(background & 0x00FFFFFFu));
+    const __m256i tol = _mm256_set1_epi32(int(0xFF000000u | (t << 16) | (t << 8) | t));
+    const __m256i zero = _mm256_setzero_si256();
+
+    const int simdWidth = width & ~7;
+    quint64 word = 0;
+    for (int x = 0; x < simdWidth; x += 8) {
+        const __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(line + x));
+        const __m256i diff = _mm256_or_si256(_mm256_subs_epu8(px, bg), _mm256_subs_epu8(bg, px));
+        const __m256i isBackground = _mm256_cmpeq_epi32(_mm256_subs_epu8(diff, tol), zero);
+        const int foreground = ~_mm256_movemask_ps(_mm256_castsi256_ps(isBackground)) & 0xFF;
+        word |= quint64(foreground) << (x & 63);
+        if ((x & 63) == 56) {
+            out[x >> 6] = word;
+            word = 0;
+        }
+    }
+    if (simdWidth & 63) {
+        out[simdWidth >> 6] = word;
+    }
+    binarizeRowScalar(line, width, background, tolerance, out, simdWidth);
+}
+
+// CPUID检测：AVX2还需要操作系统保存YMM寄存器（OSXSAVE + XCR0）
+bool cpuHasSSE2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+bool cpuHasPOPCNT()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 23)) != 0;
+#else
+    return __builtin_cpu_supports("popcnt");
+#endif
+}
+
+bool cpuHasAVX2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+// 汉明距离：每累加4个字检查一次预算，168x36的头像每行3个字，共108个字
+typedef int (*HammingFn)(const quint64 *a, const quint64 *b, int wordCount, int budget);
+
+template <typename PopCount>
+inline int hammingWords(const quint64 *a, const quint64 *b, int wordCount, int budget, PopCount popCount)
+{
+    int distance = 0;
+    int i = 0;
+    for (; i + 4 <= wordCount; i += 4) {
+        distance += popCount(a[i] ^ b[i]) + popCount(a[i + 1] ^ b[i + 1])
+                  + popCount(a[i + 2] ^ b[i + 2]) + popCount(a[i + 3] ^ b[i + 3]);
+        if (distance > budget) {
+            return distance;
+        }
+    }
+    for (; i < wordCount; ++i) {
+        distance += popCount(a[i] ^ b[i]);
+    }
+    return distance;
+}
+
+int hammingGeneric(const quint64 *a, const quint64 *b, int wordCount, int budget)
+{
+    return hammingWords(a, b, wordCount, budget, [](quint64 v) { return int(qPopulationCount(v)); });
+}
+
+#if ARONA_X86_SIMD
+ARONA_TARGET_POPCNT
+int hammingPOPCNT(const quint64 *a, const quint64 *b, int wordCount, int budget)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    return hammingWords(a, b, wordCount, budget, [](quint64 v) { return int(__popcnt64(v)); });
+#elif defined(_MSC_VER)
+    return hammingWords(a, b, wordCount, budget, [](quint64 v) {
+        return int(__popcnt(quint32(v)) + __popcnt(quint32(v >> 32)));
+    });
+#else
+    // 循环体需要直接展开在带target属性的函数内，lambda不会继承该属性
+    int distance = 0;
+    int i = 0;
+    for (; i + 4 <= wordCount; i += 4) {
+        distance += __builtin_popcountll(a[i] ^ b[i]) + __builtin_popcountll(a[i + 1] ^ b[i + 1])
+                  + __builtin_popcountll(a[i + 2] ^ b[i + 2]) + __builtin_popcountll(a[i + 3] ^ b[i + 3]);
+        if (distance > budget) {
+            return distance;
+        }
+    }
+    for (; i < wordCount; ++i) {
+        distance += __builtin_popcountll(a[i] ^ b[i]);
+    }
+    return distance;
+#endif
+}
+#endif
+
+HammingFn hammingFunction()
+{
+#if ARONA_X86_SIMD
+    static const HammingFn fn = cpuHasPOPCNT() ? hammingPOPCNT : hammingGeneric;
+    return fn;
+#else
+    return hammingGeneric;
+#endif
+}
+
+BinarizeRowFn binarizeRowFunction(ImageKernels::BinarizeKernel kernel)
+{
+#if ARONA_X86_SIMD
+    if (kernel == ImageKernels::BinarizeAVX2) {
+        return binarizeRowAVX2;
+    }
+    if (kernel == ImageKernels::BinarizeSSE2) {
+        return binarizeRowSSE2;
+    }
+#else
+    Q_UNUSED(kernel);
+#endif
+    return binarizeRowScalarFn;
+}
+
+}
+
+quint64 ImageKernels::averageHash(const QImage &image, const QRect &roi)
+{
+    const QRect rect = roi.isNull() ? image.rect() : (roi & image.rect());
+    if (rect.width() < 8 || rect.height() < 8) {
+        return 0;
+    }
+
+    switch (image.format()) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        // 与qGray()相同的整数灰度公式
+        return hashRows<QRgb>(image, rect, [](QRgb pixel) {
+            return quint32(qRed(pixel) * 11 + qGreen(pixel) * 16 + qBlue(pixel) * 5) >> 5;
+        });
+    case QImage::Format_Grayscale8:
+        return hashRows<uchar>(image, rect, [](uchar pixel) {
+            return quint32(pixel);
+        });
+    default:
+        // 其他格式（如调色板PNG）先转换为RGB32，只在加载模板时发生
+        return averageHash(image.convertToFormat(QImage::Format_RGB32), rect);
+    }
+}
+
+// ==================== 校验和 ====================
+
+namespace {
+
+// 64位FNV-1a，每次混入一个像素
+template <typename Pixel>
+quint64 checksumRows(const QImage &image, const QRect &rect, int step)
+{
+    quint64 checksum = 14695981039346656037ULL;
+    for (int y = 0; y < rect.height(); y += step) {
+        const Pixel *line = reinterpret_cast<const Pixel *>(image.constScanLine(rect.y() + y)) + rect.x();
+        for (int x = 0; x < rect.width(); x += step) {
+            checksum = (checksum ^ quint64(line[x])) * 1099511628211ULL;
+        }
+    }
+    return checksum;
+}
+
+}
+
+quint64 ImageKernels::sampledChecksum(const QImage &image, const QRect &roi, int step)
+{
+    const QRect rect = roi.isNull() ? image.rect() : (roi & image.rect());
+    if (rect.isEmpty()) {
+        return 0;
+    }
+    step = qMax(1, step);
+
+    switch (image.format()) {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        return checksumRows<QRgb>(image, rect, step);
+    case QImage::Format_Grayscale8:
+        return checksumRows<uchar>(image, rect, step);
+    default:
+        return sampledChecksum(image.convertToFormat(QImage::Format_RGB32), rect, step);
+    }
+}
+
+bool ImageKernels::isBinarizeKernelSupported(BinarizeKernel kernel)
+{
+    switch (kernel) {
+    case BinarizeScalar:
+        return true;
+#if ARONA_X86_SIMD
+    case BinarizeSSE2: {
+        static const bool supported = cpuHasSSE2();
+        return supported;
+    }
+    case BinarizeAVX2: {
+        static const bool supported = cpuHasAVX2();
+        return supported;
+    }
+#endif
+    default:
+        return false;
+    }
+}
+
+ImageKernels::BinarizeKernel ImageKernels::bestBinarizeKernel()
+{
+    static const BinarizeKernel best = isBinarizeKernelSupported(BinarizeAVX2) ? BinarizeAVX2
+                                     : isBinarizeKernelSupported(BinarizeSSE2) ? BinarizeSSE2
+                                     : BinarizeScalar;
+    return best;
+}
+
+const char *ImageKernels::binarizeKernelName(BinarizeKernel kernel)
+{
+    switch (kernel) {
+    case BinarizeSSE2:
+        return "SSE2";
+    case BinarizeAVX2:
+        return "AVX2";
+    default:
+        return "Scalar";
+    }
+}
+
+void ImageKernels::binarizeRows(const QImage &image, const QRect &roi, QRgb backgroundColor, int tolerance,
+                                quint64 *out, int wordsPerRow)
+{
+    binarizeRowsWith(bestBinarizeKernel(), image, roi, backgroundColor, tolerance, out, wordsPerRow);
+}
+
+void ImageKernels::binarizeRowsWith(BinarizeKernel kernel, const QImage &image, const QRect &roi, QRgb backgroundColor,
+                                    int tolerance, quint64 *out, int wordsPerRow)
+{
+    if (image.format() != QImage::Format_RGB32 &&
+        image.format() != QImage::Format_ARGB32 &&
+        image.format() != QImage::Format_ARGB32_Premultiplied) {
+        // 其他格式（如调色板PNG）先转换为RGB32，只在加载模板时发生
+        binarizeRowsWith(kernel, image.convertToFormat(QImage::Format_RGB32), roi, backgroundColor,
+                         tolerance, out, wordsPerRow);
+        return;
+    }
+
+    if (!isBinarizeKernelSupported(kernel)) {
+        kernel = BinarizeScalar;
+    }
+    const BinarizeRowFn rowFn = binarizeRowFunction(kernel);
+    const int clampedTolerance = qBound(0, tolerance, 255);
+    const int width = roi.width();
+    const int usedWords = packedWordsPerRow(width);
+
+    for (int y = 0; y < roi.height(); ++y) {
+        const QRgb *line = reinterpret_cast<const QRgb *>(image.constScanLine(roi.y() + y)) + roi.x();
+        quint64 *outRow = out + y * wordsPerRow;
+        rowFn(line, width, backgroundColor, clampedTolerance, outRow);
+        for (int i = usedWords; i < wordsPerRow; ++i) {
+            outRow[i] = 0;
+        }
+    }
+}
+
+ImageKernels::BitImage ImageKernels::binarize(const QImage &image, const QRect &roi, QRgb backgroundColor, int tolerance)
+{
+    const QRect rect = roi.isNull() ? image.rect() : (roi & image.rect());
+    BitImage bits;
+    if (rect.isEmpty()) {
+        return bits;
+    }
+    bits.width = rect.width();
+    bits.height = rect.height();
+    bits.wordsPerRow = packedWordsPerRow(bits.width);
+    bits.words.resize(bits.height * bits.wordsPerRow);
+    binarizeRows(image, rect, backgroundColor, tolerance, bits.words.data(), bits.wordsPerRow);
+    return bits;
+}
+
+int ImageKernels::hammingDistance(const quint64 *a, const quint64 *b, int wordCount, int budget)
+{
+    return hammingFunction()(a, b, wordCount, budget);
+}
+
+int ImageKernels::hammingDistance(const BitImage &a, const BitImage &b, int budget)
+{
+    if (!a.sameSize(b) || a.words.size() != b.words.size()) {
+        return -1;
+    }
+    return hammingDistance(a.words.constData(), b.words.constData(), a.words.size(), budget);
+}
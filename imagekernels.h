@@ -0,0 +1,82 @@
+#ifndef IMAGEKERNELS_H
+#define IMAGEKERNELS_H
+
+#include <QImage>
+#include <QRect>
+#include <QtGlobal>
+#include <QtAlgorithms>
+#include <QVector>
+
+// 图像识别的底层计算内核
+// 这些函数只读取QImage的扫描行，不依赖窗口系统，可以在任意线程中调用
+namespace ImageKernels {
+
+// 计算ROI区域的8x8平均哈希（aHash）
+// 直接通过scanLine()读取原图，在一次整数遍历中完成灰度转换和8x8面积平均，不分配堆内存
+// 支持RGB32/ARGB32/ARGB32_Premultiplied/Grayscale8，其他格式会先转换（仅加载模板时会遇到）
+// 第(y*8+x)个格子对应返回值的第(63-y*8-x)位；roi为空时使用整张图像，ROI小于8x8时返回0
+quint64 averageHash(const QImage &image, const QRect &roi = QRect());
+
+// 两个平均哈希之间的汉明距离（不同位的数量）
+inline int hashDistance(quint64 hash1, quint64 hash2) { return int(qPopulationCount(hash1 ^ hash2)); }
+
+// ROI的采样校验和，用于判断相邻两帧的ROI是否发生变化
+// 每隔step行、每隔step列读取一个原始像素值（不做灰度转换）；step=1时逐像素，step=2时只读取1/4的像素（会漏掉细小的变化）
+quint64 sampledChecksum(const QImage &image, const QRect &roi, int step = 1);
+
+// 二值化内核实现
+enum BinarizeKernel {
+    BinarizeScalar,     // 标量实现（所有平台）
+    BinarizeSSE2,       // 每次处理4个像素
+    BinarizeAVX2        // 每次处理8个像素
+};
+
+// 每行打包后占用的64位字数（每行单独对齐到64位）
+inline int packedWordsPerRow(int width) { return (width + 63) / 64; }
+
+// 当前CPU可用的最快二值化内核（首次调用时通过CPUID检测）
+BinarizeKernel bestBinarizeKernel();
+bool isBinarizeKernelSupported(BinarizeKernel kernel);
+const char *binarizeKernelName(BinarizeKernel kernel);
+
+// 将ROI内的RGB32扫描行直接二值化为按行打包的位图
+// 与背景色RGB各分量之差都在±tolerance内的像素为0，其他为1（忽略Alpha通道）
+// 第y行第x个像素写入 out[y * wordsPerRow + x / 64] 的第(x % 64)位，行尾多余的位清零
+// out需要至少 roi.height() * wordsPerRow 个字；ROI必须完全位于图像内
+// 支持RGB32/ARGB32/ARGB32_Premultiplied（按不透明像素处理），其他格式会先转换
+void binarizeRows(const QImage &image, const QRect &roi, QRgb backgroundColor, int tolerance,
+                  quint64 *out, int wordsPerRow);
+
+// 指定内核的版本（用于性能测试和结果校验），内核不受支持时退回标量实现
+void binarizeRowsWith(BinarizeKernel kernel, const QImage &image, const QRect &roi, QRgb backgroundColor,
+                      int tolerance, quint64 *out, int wordsPerRow);
+
+// 按行打包的二值位图（每行对齐到64位字，行尾多余的位为0）
+struct BitImage {
+    QVector<quint64> words;
+    int width = 0;
+    int height = 0;
+    int wordsPerRow = 0;
+
+    bool isNull() const { return words.isEmpty(); }
+    bool sameSize(const BitImage &other) const { return width == other.width && height == other.height; }
+};
+
+// 将ROI二值化为BitImage（roi为空时使用整张图像）
+BitImage binarize(const QImage &image, const QRect &roi, QRgb backgroundColor, int tolerance);
+
+// 两段等长位图的汉明距离（硬件POPCNT，首次调用时检测）
+// 累计距离超过budget后立即停止，此时返回值只保证大于budget；未超出时返回精确距离
+int hammingDistance(const quint64 *a, const quint64 *b, int wordCount, int budget);
+// 尺寸不同时返回-1
+int hammingDistance(const BitImage &a, const BitImage &b, int budget);
+
+// 相似度阈值对应的最大允许距离：similarity = 1 - distance / totalBits >= threshold
+inline int hammingBudget(int totalBits, double threshold)
+{
+    return qMax(0, int((1.0 - threshold) * totalBits + 1e-9));
+}
+
+}
+
+#endif // IMAGEKERNELS_H
@@ -0,0 +1,164 @@
+#include "inputarbiter.h"
+#include "cancellationtoken.h"
+
+#include <QMutexLocker>
+
+InputArbiter::InputArbiter()
+{
+    clock.start();
+}
+
+bool InputArbiter::acquire(const QString &requester, int timeoutMs, const CancellationToken *cancel)
+{
+    QMutexLocker locker(&mutex);
+    // 持有者在同一线程中嵌套获取：不排队（排队会等待自己释放，直到超时）
+    if (held && ownerThread == QThread::currentThreadId()) {
+        depth++;
+        return true;
+    }
+
+    const qint64 requestedAt = clock.elapsed();
+    const quint64 ticket = nextTicket++;
+    queue.append(ticket);
+
+    while (held || queue.first() != ticket) {
+        const qint64 now = clock.elapsed();
+        const bool expired = timeoutMs >= 0 && now - requestedAt >= timeoutMs;
+        if (expired || (cancel && cancel->isCancelled())) {
+            // 放弃排队，唤醒后面的请求（可能轮到它们）
+            queue.removeOne(ticket);
+            Stats &stats = counters[requester];
+            stats.timeouts++;
+            stats.waitMs += now - requestedAt;
+            stats.maxWaitMs = qMax(stats.maxWaitMs, now - requestedAt);
+            changed.wakeAll();
+            locker.unlock();
+            notifyChanged();
+            return false;
+        }
+
+        qint64 waitMs = cancel ? CANCEL_POLL_MS : -1;
+        if (timeoutMs >= 0) {
+            const qint64 remaining = requestedAt + timeoutMs - now;
+            waitMs = waitMs < 0 ? remaining : qMin(waitMs, remaining);
+        }
+        if (waitMs < 0) {
+            changed.wait(&mutex);
+        } else {
+            changed.wait(&mutex, ulong(waitMs));
+        }
+    }
+
+    queue.removeFirst();
+    held = true;
+    ownerThread = QThread::currentThreadId();
+    depth = 1;
+    owner = requester;
+    acquiredAt = clock.elapsed();
+
+    Stats &stats = counters[requester];
+    stats.acquisitions++;
+    stats.waitMs += acquiredAt - requestedAt;
+    stats.maxWaitMs = qMax(stats.maxWaitMs, acquiredAt - requestedAt);
+    return true;
+}
+
+void InputArbiter::release()
+{
+    {
+        QMutexLocker locker(&mutex);
+        if (!held) {
+            return;
+        }
+        if (--depth > 0) {
+            return;
+        }
+        counters[owner].holdMs += clock.elapsed() - acquiredAt;
+        held = false;
+        ownerThread = nullptr;
+        owner.clear();
+        changed.wakeAll();
+    }
+    notifyChanged();
+}
+
+quint64 InputArbiter::enqueue(const QString &requester)
+{
+    QMutexLocker locker(&mutex);
+    const quint64 ticket = nextTicket++;
+    queue.append(ticket);
+    requests.insert(ticket, Request{requester, clock.elapsed()});
+    return ticket;
+}
+
+bool InputArbiter::tryAcquire(quint64 ticket)
+{
+    QMutexLocker locker(&mutex);
+    auto it = requests.find(ticket);
+    if (it == requests.end() || held || queue.first() != ticket) {
+        return false;
+    }
+
+    queue.removeFirst();
+    held = true;
+    ownerThread = nullptr;  // 不按线程重入：同一线程上的其他协程仍要排队
+    depth = 1;
+    owner = it->requester;
+    acquiredAt = clock.elapsed();
+
+    Stats &stats = counters[owner];
+    stats.acquisitions++;
+    stats.waitMs += acquiredAt - it->requestedAt;
+    stats.maxWaitMs = qMax(stats.maxWaitMs, acquiredAt - it->requestedAt);
+    requests.erase(it);
+    return true;
+}
+
+void InputArbiter::abandon(quint64 ticket)
+{
+    {
+        QMutexLocker locker(&mutex);
+        auto it = requests.find(ticket);
+        if (it == requests.end()) {
+            return;
+        }
+        queue.removeOne(ticket);
+        const qint64 waited = clock.elapsed() - it->requestedAt;
+        Stats &stats = counters[it->requester];
+        stats.timeouts++;
+        stats.waitMs += waited;
+        stats.maxWaitMs = qMax(stats.maxWaitMs, waited);
+        requests.erase(it);
+        changed.wakeAll();
+    }
+    notifyChanged();
+}
+
+void InputArbiter::notifyChanged()
+{
+    if (changedListener) {
+        changedListener();
+    }
+}
+
+QString InputArbiter::holder() const
+{
+    QMutexLocker locker(&mutex);
+    return owner;
+}
+
+InputArbiter::Stats InputArbiter::stats(const QString &requester) const
+{
+    QMutexLocker locker(&mutex);
+    return counters.value(requester);
+}
+
+void InputArbiter::resetStats(const QString &requester)
+{
+    QMutexLocker locker(&mutex);
+    if (requester.isEmpty()) {
+        counters.clear();
+    } else {
+        counters.remove(requester);
+    }
+}
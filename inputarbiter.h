@@ -0,0 +1,105 @@
+#ifndef INPUTARBITER_H
+#define INPUTARBITER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+#include <functional>
+
+class CancellationToken;
+
+// 全局输入仲裁
+// 多个窗口的脚本同时运行时，依赖焦点或真实鼠标/键盘的操作（SetFocus、keybd_event、SetCursorPos）
+// 会互相干扰，必须逐个执行；通过PostMessage发送给各自窗口的输入不需要经过仲裁
+// 按请求顺序（先来先得）授予，等待超过期限或被取消时放弃排队，不影响后面的请求
+// 可重入：持有仲裁的线程再次获取（嵌套的Section）时直接成功，最外层释放时才真正释放
+// 协程脚本（多个窗口交错运行在同一个线程上）使用enqueue/tryAcquire，不按线程判断持有者
+// 按请求方（窗口）统计获取次数、等待时间和占用时间
+class InputArbiter
+{
+public:
+    struct Stats {
+        quint64 acquisitions = 0;   // 成功获取的次数
+        quint64 timeouts = 0;       // 超过期限或被取消而放弃的次数
+        qint64 waitMs = 0;          // 累计等待时间（含放弃的请求）
+        qint64 maxWaitMs = 0;       // 单次最长等待时间
+        qint64 holdMs = 0;          // 累计占用时间
+    };
+
+    InputArbiter();
+
+    // 等待轮到requester，timeoutMs < 0 时一直等待；cancel非空且被取消时放弃等待
+    // 返回false表示没有获取到（超时或被取消）；每次成功的acquire都要对应一次release
+    bool acquire(const QString &requester, int timeoutMs = -1, const CancellationToken *cancel = nullptr);
+    void release();
+
+    // 非阻塞的排队：enqueue取得排队号，之后每次收到变化通知时调用tryAcquire，成功后照常release（不可重入）；
+    // 超时或被取消时调用abandon放弃排队（计入放弃次数）
+    quint64 enqueue(const QString &requester);
+    bool tryAcquire(quint64 ticket);
+    void abandon(quint64 ticket);
+    // 仲裁被释放或有请求放弃排队时调用（在释放方的线程上，不持有内部锁）；只能在使用前设置
+    void setChangedListener(std::function<void()> listener) { changedListener = std::move(listener); }
+
+    QString holder() const;
+    Stats stats(const QString &requester) const;
+    void resetStats(const QString &requester = QString());
+
+    // 作用域内持有仲裁（析构时释放），用法：
+    //   InputArbiter::Section section(arbiter, windowKey, 30000, &stopToken);
+    //   if (!section.isAcquired()) { ... }
+    class Section
+    {
+    public:
+        Section(InputArbiter &arbiter, const QString &requester, int timeoutMs = -1, const CancellationToken *cancel = nullptr)
+            : arbiter(arbiter)
+            , acquired(arbiter.acquire(requester, timeoutMs, cancel))
+        {
+        }
+        ~Section()
+        {
+            if (acquired) {
+                arbiter.release();
+            }
+        }
+        Section(const Section &) = delete;
+        Section &operator=(const Section &) = delete;
+
+        bool isAcquired() const { return acquired; }
+
+    private:
+        InputArbiter &arbiter;
+        bool acquired;
+    };
+
+private:
+    // 取消令牌不会唤醒这里的条件变量，等待期间每隔一段时间检查一次（停止请求最多延迟这么久）
+    static constexpr int CANCEL_POLL_MS = 10;
+
+    struct Request {
+        QString requester;
+        qint64 requestedAt;
+    };
+
+    void notifyChanged();
+
+    mutable QMutex mutex;
+    QWaitCondition changed;         // 仲裁被释放或有请求放弃排队
+    QElapsedTimer clock;
+    QList<quint64> queue;           // 等待中的请求（按到达顺序）
+    QHash<quint64, Request> requests;   // enqueue排队中的请求
+    quint64 nextTicket = 0;
+    bool held = false;
+    Qt::HANDLE ownerThread = nullptr;   // 持有仲裁的线程（用于重入）
+    int depth = 0;                  // 持有线程的嵌套层数
+    QString owner;                  // 当前持有者
+    qint64 acquiredAt = 0;
+    QHash<QString, Stats> counters;
+    std::function<void()> changedListener;
+};
+
+#endif // INPUTARBITER_H
@@ -0,0 +1,202 @@
+#include "inputscheduler.h"
+#include "cancellationtoken.h"
+
+#include <QMutexLocker>
+#include <chrono>
+
+InputScheduler::InputScheduler(QObject *parent)
+    : QThread(parent)
+{
+}
+
+InputScheduler::~InputScheduler()
+{
+    stop();
+}
+
+qint64 InputScheduler::clockUs()
+{
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+quint64 InputScheduler::submit(const QVector<Event> &batch)
+{
+    QMutexLocker locker(&mutex);
+    const quint64 id = nextBatch++;
+    if (batch.isEmpty()) {
+        return id;
+    }
+
+    const qint64 submittedAt = clockUs();
+    for (const Event &event : batch) {
+        pending.push(Pending{submittedAt + qMax<qint64>(0, event.offsetUs), nextSequence++, id, event.action, event.kind});
+    }
+    Batch state;
+    state.remaining = batch.size();
+    batches.insert(id, state);
+
+    if (!isRunning()) {
+        start(QThread::TimeCriticalPriority);
+    }
+    wakeup.wakeOne();
+    return id;
+}
+
+bool InputScheduler::waitFor(quint64 batch, const CancellationToken *cancel)
+{
+    QMutexLocker locker(&mutex);
+    while (batches.contains(batch)) {
+        if (cancel && cancel->isCancelled()) {
+            // 剩余的按下、移动不再发送；时序线程可能正在休眠，唤醒它尽快处理
+            batches[batch].cancelled = true;
+            wakeup.wakeOne();
+            return false;
+        }
+        if (cancel) {
+            completed.wait(&mutex, CANCEL_POLL_MS);
+        } else {
+            completed.wait(&mutex);
+        }
+    }
+    return true;
+}
+
+void InputScheduler::whenDone(quint64 batch, Action callback)
+{
+    {
+        QMutexLocker locker(&mutex);
+        auto it = batches.find(batch);
+        if (it != batches.end()) {
+            it->done = std::move(callback);
+            return;
+        }
+    }
+    callback();
+}
+
+void InputScheduler::cancel(quint64 batch)
+{
+    QMutexLocker locker(&mutex);
+    auto it = batches.find(batch);
+    if (it != batches.end()) {
+        it->cancelled = true;
+        wakeup.wakeOne();
+    }
+}
+
+void InputScheduler::stop()
+{
+    {
+        QMutexLocker locker(&mutex);
+        stopping = true;
+        wakeup.wakeOne();
+    }
+    wait();
+    QMutexLocker locker(&mutex);
+    stopping = false;
+}
+
+InputScheduler::Stats InputScheduler::stats() const
+{
+    QMutexLocker locker(&mutex);
+    return counters;
+}
+
+void InputScheduler::resetStats()
+{
+    QMutexLocker locker(&mutex);
+    counters = Stats();
+}
+
+QString InputScheduler::bucketLabel(int bucket)
+{
+    if (bucket < BUCKET_COUNT - 1) {
+        return QString("≤%1us").arg(BUCKET_LIMITS_US[bucket]);
+    }
+    return QString(">%1us").arg(BUCKET_LIMITS_US[BUCKET_COUNT - 2]);
+}
+
+void InputScheduler::recordLateness(qint64 lateUs)
+{
+    counters.events++;
+    counters.totalLateUs += lateUs;
+    counters.maxLateUs = qMax(counters.maxLateUs, lateUs);
+    int bucket = 0;
+    while (bucket < BUCKET_COUNT - 1 && lateUs > BUCKET_LIMITS_US[bucket]) {
+        bucket++;
+    }
+    counters.buckets[bucket]++;
+}
+
+void InputScheduler::finishEvent(quint64 batch)
+{
+    auto it = batches.find(batch);
+    if (it != batches.end() && --it->remaining == 0) {
+        Action done = std::move(it->done);
+        batches.erase(it);
+        completed.wakeAll();
+        if (done) {
+            done();
+        }
+    }
+}
+
+void InputScheduler::run()
+{
+    QMutexLocker locker(&mutex);
+    for (;;) {
+        while (pending.empty() && !stopping) {
+            wakeup.wait(&mutex);
+        }
+        if (pending.empty()) {
+            break;
+        }
+
+        // 已取消的批次：丢弃按下、移动和不欠的抬起，不等待计划时刻；未取消的批次：丢弃只在取消时发送的抬起
+        const Pending &top = pending.top();
+        auto batchIt = batches.constFind(top.batch);
+        const bool dropped = batchIt != batches.constEnd()
+                && (batchIt->cancelled ? (top.kind == Normal || !batchIt->down) : top.kind == CancelRelease);
+        if (dropped) {
+            const quint64 batch = top.batch;
+            pending.pop();
+            finishEvent(batch);
+            continue;
+        }
+
+        // 停止时不再等待计划时刻，立即执行剩余事件（如鼠标抬起），避免游戏中残留按下状态
+        const qint64 dueUs = top.dueUs;
+        qint64 waitUs = dueUs - clockUs();
+        if (!stopping && waitUs > SPIN_US) {
+            // 休眠到计划时刻前SPIN_US为止（向上取整，否则不足1ms时等待0ms，持有锁空转）
+            // 期间提交了更早的事件时会被唤醒重新计算
+            wakeup.wait(&mutex, ulong((waitUs - SPIN_US + 999) / 1000));
+            continue;
+        }
+
+        Pending next = pending.top();
+        pending.pop();
+        const bool immediate = stopping;
+        locker.unlock();
+        if (!immediate) {
+            while (clockUs() < next.dueUs) {
+                QThread::yieldCurrentThread();
+            }
+        }
+        const qint64 lateUs = clockUs() - next.dueUs;
+        if (next.action) {
+            next.action();
+        }
+        locker.relock();
+
+        if (!immediate) {
+            recordLateness(qMax<qint64>(0, lateUs));
+        }
+        auto it = batches.find(next.batch);
+        if (it != batches.end()) {
+            it->down = next.kind == Normal;
+        }
+        finishEvent(next.batch);
+    }
+}
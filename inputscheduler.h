@@ -0,0 +1,117 @@
+#ifndef INPUTSCHEDULER_H
+#define INPUTSCHEDULER_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+#include <functional>
+#include <queue>
+#include <vector>
+
+class CancellationToken;
+
+// 输入时序线程
+// 点击、拖动等输入由调用方组成带时间偏移的一批事件提交，由专门的线程按计划时刻执行
+// 计划时刻前较远时在条件变量上休眠，最后SPIN_US微秒改为自旋，不受系统定时器精度（约15ms）影响
+// 多个窗口的批次可以同时提交，按各自的计划时刻交错执行；每个事件的实际执行时刻与计划时刻之差计入延迟分布
+// submit/waitFor可以在任意线程调用
+class InputScheduler : public QThread
+{
+public:
+    using Action = std::function<void()>;
+
+    // 批次被取消后的处理方式
+    enum Kind {
+        Normal,             // 按下、移动等：批次被取消后不再发送
+        Release,            // 抬起：批次被取消后，只有之前的按下已经发送时才发送，避免游戏中残留按下状态
+        CancelRelease       // 只在取消时发送的抬起：批次正常完成时丢弃（按下由之后的输入抬起，如技能拖动），
+                            // 批次被取消且之前的按下已经发送时与Release相同
+    };
+
+    struct Event {
+        qint64 offsetUs;    // 相对批次提交时刻的偏移（微秒）
+        Action action;
+        Kind kind = Normal;
+    };
+
+    // 延迟分布的区间上限（微秒），最后一个区间不设上限
+    static constexpr int BUCKET_COUNT = 8;
+    static constexpr qint64 BUCKET_LIMITS_US[BUCKET_COUNT - 1] = {100, 250, 500, 1000, 2000, 5000, 10000};
+
+    struct Stats {
+        quint64 events = 0;
+        qint64 totalLateUs = 0;
+        qint64 maxLateUs = 0;
+        quint64 buckets[BUCKET_COUNT] = {};
+    };
+
+    explicit InputScheduler(QObject *parent = nullptr);
+    ~InputScheduler();
+
+    // 提交一批事件，返回批次号；停止线程时立即执行剩余事件
+    quint64 submit(const QVector<Event> &batch);
+    // 等待批次执行完毕，cancel被取消时不再等待并取消该批次，返回false
+    // 取消后批次中尚未发送的Normal事件被丢弃，只发送仍然欠着的Release事件（见Kind）
+    bool waitFor(quint64 batch, const CancellationToken *cancel = nullptr);
+    // 提交并等待
+    bool run(const QVector<Event> &batch, const CancellationToken *cancel = nullptr) { return waitFor(submit(batch), cancel); }
+    // 批次处理完毕时调用callback（在时序线程上、持有内部锁，callback中不能再调用本类）；已经处理完毕时立即在调用线程上调用
+    // 每个批次只保留一个callback，供协程挂起等待输入发送完毕（见ScriptRuntime::input）
+    void whenDone(quint64 batch, Action callback);
+    // 取消批次，与waitFor被取消时相同
+    void cancel(quint64 batch);
+    // 执行完剩余事件后停止线程
+    void stop();
+
+    Stats stats() const;
+    void resetStats();
+    static QString bucketLabel(int bucket);
+
+    // 高精度单调时钟（微秒）
+    static qint64 clockUs();
+
+protected:
+    void run() override;
+
+private:
+    static constexpr qint64 SPIN_US = 2000;     // 距计划时刻不足该值时自旋等待
+    static constexpr int CANCEL_POLL_MS = 10;
+
+    struct Pending {
+        qint64 dueUs;
+        quint64 sequence;   // 计划时刻相同时按提交顺序执行
+        quint64 batch;
+        Action action;
+        Kind kind;
+    };
+    struct Batch {
+        int remaining = 0;      // 尚未处理的事件数
+        bool cancelled = false;
+        bool down = false;      // 已发送了Normal事件（按下）而对应的Release还没有发送
+        Action done;            // 见whenDone
+    };
+    struct Later {
+        bool operator()(const Pending &a, const Pending &b) const
+        {
+            return a.dueUs != b.dueUs ? a.dueUs > b.dueUs : a.sequence > b.sequence;
+        }
+    };
+
+    void recordLateness(qint64 lateUs);
+    void finishEvent(quint64 batch);
+
+    mutable QMutex mutex;           // 保护以下全部成员
+    QWaitCondition wakeup;          // 有新事件或需要停止
+    QWaitCondition completed;       // 有批次执行完毕
+    std::priority_queue<Pending, std::vector<Pending>, Later> pending;
+    QHash<quint64, Batch> batches;  // 尚未处理完的批次
+    quint64 nextBatch = 1;
+    quint64 nextSequence = 0;
+    bool stopping = false;
+    Stats counters;
+};
+
+#endif // INPUTSCHEDULER_H
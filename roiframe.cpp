@@ -0,0 +1,99 @@
+#include "roiframe.h"
+
+#include <cstring>
+
+RoiFrame::RoiFrame(const QImage &image)
+    : buffer(image)
+    , source(image.size())
+    , fullFrame(!image.isNull())
+{
+    if (fullFrame) {
+        regions.append(image.rect());
+        offsets.append(0);
+    }
+}
+
+RoiFrame RoiFrame::fromImage(const QImage &image, const QVector<QRect> &rois)
+{
+    if (image.isNull()) {
+        return RoiFrame();
+    }
+
+    QVector<QRect> clipped;
+    int width = 0;
+    int height = 0;
+    for (const QRect &roi : rois) {
+        if (roi.contains(image.rect())) {
+            return RoiFrame(image);
+        }
+        QRect rect = roi & image.rect();
+        if (rect.isEmpty()) {
+            continue;
+        }
+        clipped.append(rect);
+        width = qMax(width, rect.width());
+        height += rect.height();
+    }
+    if (clipped.isEmpty()) {
+        return RoiFrame(image);
+    }
+
+    // 只支持32位格式的逐行复制，其他格式先转换（截图本身就是RGB32）
+    QImage source = image;
+    if (source.depth() != 32) {
+        source = source.convertToFormat(QImage::Format_RGB32);
+    }
+
+    RoiFrame frame;
+    frame.source = image.size();
+    frame.buffer = QImage(width, height, source.format());
+    int offset = 0;
+    for (const QRect &rect : clipped) {
+        for (int y = 0; y < rect.height(); ++y) {
+            const uchar *from = source.constScanLine(rect.y() + y) + rect.x() * 4;
+            memcpy(frame.buffer.scanLine(offset + y), from, size_t(rect.width()) * 4);
+        }
+        frame.regions.append(rect);
+        frame.offsets.append(offset);
+        offset += rect.height();
+    }
+    return frame;
+}
+
+bool RoiFrame::contains(const QRect &roi) const
+{
+    for (const QRect &rect : regions) {
+        if (rect.contains(roi)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RoiFrame::locate(const QRect &roi, QImage *image, QRect *localRoi) const
+{
+    for (int i = 0; i < regions.size(); ++i) {
+        const QRect &rect = regions[i];
+        if (!rect.contains(roi)) {
+            continue;
+        }
+        if (image) {
+            *image = buffer;
+        }
+        if (localRoi) {
+            *localRoi = roi.translated(-rect.x(), offsets[i] - rect.y());
+        }
+        return true;
+    }
+    return false;
+}
+
+QImage RoiFrame::copy(const QRect &roi) const
+{
+    QImage image;
+    QRect local;
+    if (!locate(roi, &image, &local)) {
+        return QImage();
+    }
+    return image.copy(local);
+}
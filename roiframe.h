@@ -0,0 +1,46 @@
+#ifndef ROIFRAME_H
+#define ROIFRAME_H
+
+#include <QImage>
+#include <QRect>
+#include <QSize>
+#include <QVector>
+
+// 一帧截图中被识别代码用到的部分
+// 全帧模式：直接持有整张截图（隐式共享，不复制）
+// ROI模式：只把指定的几个矩形复制到一块紧凑的缓冲区中（按顺序纵向拼接），原截图可以立即释放
+// 所有坐标都使用原截图（游戏窗口）的坐标系
+class RoiFrame
+{
+public:
+    RoiFrame() = default;
+    RoiFrame(const QImage &image);  // 全帧，允许从QImage隐式转换
+
+    // rois为空，或某个ROI覆盖整张截图时返回全帧；超出截图范围的部分会被裁掉
+    static RoiFrame fromImage(const QImage &image, const QVector<QRect> &rois);
+
+    bool isNull() const { return buffer.isNull(); }
+    bool isFullFrame() const { return fullFrame; }
+    QSize sourceSize() const { return source; }
+    int regionCount() const { return regions.size(); }
+    QRect region(int index) const { return regions[index]; }
+    qsizetype bufferBytes() const { return buffer.sizeInBytes(); }
+
+    // roi是否完全落在已截取的区域内
+    bool contains(const QRect &roi) const;
+    // 把原截图坐标的roi映射为缓冲区图像和其中的局部矩形，可直接交给ImageKernels使用
+    bool locate(const QRect &roi, QImage *image, QRect *localRoi) const;
+    // 复制roi对应的图像（不在已截取区域内时返回空图像）
+    QImage copy(const QRect &roi) const;
+    // 全帧模式下的整张截图，ROI模式下为空
+    QImage fullImage() const { return fullFrame ? buffer : QImage(); }
+
+private:
+    QImage buffer;
+    QVector<QRect> regions;     // 原截图坐标
+    QVector<int> offsets;       // 每个区域在缓冲区中的起始行
+    QSize source;
+    bool fullFrame = false;
+};
+
+#endif // ROIFRAME_H
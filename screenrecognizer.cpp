@@ -0,0 +1,558 @@
+#include "screenrecognizer.h"
+#include "imagekernels.h"
+
+#include <QMutexLocker>
+#include <QPair>
+#include <QRegularExpression>
+#include <QStringList>
+#include <algorithm>
+
+int ScreenRecognizer::toleranceFromSettings(QSettings &settings, const QString &templateName)
+{
+    int defaultTolerance = settings.value("HashTolerance/Default", DEFAULT_TOLERANCE).toInt();
+    QString description = templateName.mid(templateName.indexOf(')') + 1);
+    int tolerance = settings.value("HashTolerance/" + description, defaultTolerance).toInt();
+    return qBound(0, tolerance, 64);
+}
+
+bool ScreenRecognizer::parseTemplateKey(const QString &key, QPoint *pos, QString *name, Variant *variant)
+{
+    // 格式: "(x,y)描述"，描述末尾可能带服务器后缀
+    static const QRegularExpression regex("^\\((\\d+),(\\d+)\\)(.+)$");
+    QRegularExpressionMatch match = regex.match(key);
+    if (!match.hasMatch()) {
+        return false;
+    }
+
+    QString description = match.captured(3);
+    Variant parsedVariant = VariantDefault;
+    for (int v = VariantDefault + 1; v < VariantCount; v++) {
+        QString suffix = QString::fromLatin1(variantSuffix(Variant(v)));
+        if (description.endsWith(suffix) && description.size() > suffix.size()) {
+            description.chop(suffix.size());
+            parsedVariant = Variant(v);
+            break;
+        }
+    }
+
+    if (pos) {
+        *pos = QPoint(match.captured(1).toInt(), match.captured(2).toInt());
+    }
+    if (name) {
+        *name = description;
+    }
+    if (variant) {
+        *variant = parsedVariant;
+    }
+    return true;
+}
+
+const char *ScreenRecognizer::variantSuffix(Variant variant)
+{
+    switch (variant) {
+    case VariantJP:
+        return "_JP";
+    case VariantKR:
+        return "_KR";
+    case VariantTW:
+        return "_TW";
+    case VariantCN:
+        return "_CN";
+    case VariantAC:
+        return "_AC";
+    default:
+        return "";
+    }
+}
+
+void ScreenRecognizer::clearPositionTemplates()
+{
+    positionIndex.clear();
+    positionTemplateTotal = 0;
+    classifierBuilt = false;
+}
+
+void ScreenRecognizer::clearReadyTemplates()
+{
+    readyTemplates.clear();
+    readyIndex.clear();
+    classifierBuilt = false;
+}
+
+bool ScreenRecognizer::addPositionTemplate(const QString &key, const QSize &size, quint64 hash, int tolerance)
+{
+    QPoint pos;
+    QString name;
+    Variant variant;
+    if (!parseTemplateKey(key, &pos, &name, &variant)) {
+        return false;
+    }
+
+    PositionCandidate candidate;
+    candidate.roi = QRect(pos, size);
+    candidate.hash = hash;
+    candidate.tolerance = tolerance;
+    candidate.variant = variant;
+    candidate.key = key;
+
+    // 保持原版在前、其他变体按枚举顺序排列，与原先逐个变体尝试的顺序一致
+    QVector<PositionCandidate> &candidates = positionIndex[name];
+    auto it = std::upper_bound(candidates.begin(), candidates.end(), variant,
+                               [](Variant v, const PositionCandidate &c) { return v < c.variant; });
+    candidates.insert(it, candidate);
+    positionTemplateTotal++;
+    classifierBuilt = false;
+    return true;
+}
+
+const QVector<ScreenRecognizer::PositionCandidate> &ScreenRecognizer::positionCandidates(const QString &position) const
+{
+    static const QVector<PositionCandidate> empty;
+    auto it = positionIndex.constFind(position);
+    return it != positionIndex.constEnd() ? it.value() : empty;
+}
+
+QVector<QRect> ScreenRecognizer::positionRois(const QString &position) const
+{
+    QVector<QRect> rois;
+    for (const PositionCandidate &candidate : positionCandidates(position)) {
+        if (!rois.contains(candidate.roi)) {
+            rois.append(candidate.roi);
+        }
+    }
+    return rois;
+}
+
+bool ScreenRecognizer::matchCandidates(const RoiFrame &screenshot, const QVector<PositionCandidate> &candidates,
+                                       int variantFilter, const QString &windowKey,
+                                       const PositionCandidate **matched, int *distance) const
+{
+    // 同一位置的各变体通常共用一个ROI，只计算一次哈希
+    QRect hashedRoi;
+    quint64 hash = 0;
+    for (const PositionCandidate &candidate : candidates) {
+        if (variantFilter >= 0 && candidate.variant != variantFilter) {
+            continue;
+        }
+        // ROI超出游戏窗口范围（窗口尺寸异常）或未被截取时跳过该模板
+        if (!screenshot.contains(candidate.roi)) {
+            continue;
+        }
+
+        // 直接在截图上计算该区域的哈希值，汉明距离在容差范围内即视为匹配
+        if (candidate.roi != hashedRoi) {
+            hash = roiHash(screenshot, candidate.roi, windowKey);
+            hashedRoi = candidate.roi;
+        }
+        int d = ImageKernels::hashDistance(hash, candidate.hash);
+        if (d <= candidate.tolerance) {
+            if (matched) {
+                *matched = &candidate;
+            }
+            if (distance) {
+                *distance = d;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ScreenRecognizer::matchPosition(const RoiFrame &screenshot, const QString &position,
+                                     const PositionCandidate **matched, int *distance) const
+{
+    return matchCandidates(screenshot, positionCandidates(position), -1, QString(), matched, distance);
+}
+
+bool ScreenRecognizer::matchPosition(const RoiFrame &screenshot, const QString &position, const QString &windowKey,
+                                     const PositionCandidate **matched, int *distance)
+{
+    if (windowKey.isEmpty()) {
+        return matchPosition(screenshot, position, matched, distance);
+    }
+    const QVector<PositionCandidate> &candidates = positionCandidates(position);
+    return matchPinned(position, windowKey, [&](int variantFilter, const PositionCandidate **hit, int *hitDistance) {
+        return matchCandidates(screenshot, candidates, variantFilter, windowKey, hit, hitDistance);
+    }, matched, distance);
+}
+
+bool ScreenRecognizer::matchPosition(const ScreenState &state, const QString &position, const QString &windowKey,
+                                     const PositionCandidate **matched, int *distance)
+{
+    const QVector<PositionCandidate> &candidates = positionCandidates(position);
+    auto match = [&](int variantFilter, const PositionCandidate **hit, int *hitDistance) {
+        return matchCandidates(state, candidates, variantFilter, hit, hitDistance);
+    };
+    if (windowKey.isEmpty()) {
+        return match(-1, matched, distance);
+    }
+    return matchPinned(position, windowKey, match, matched, distance);
+}
+
+bool ScreenRecognizer::matchCandidates(const ScreenState &state, const QVector<PositionCandidate> &candidates,
+                                       int variantFilter, const PositionCandidate **matched, int *distance) const
+{
+    // 与截图版本一致，按候选模板的顺序取第一个命中（classify已给出容差内的全部匹配）
+    for (const PositionCandidate &candidate : candidates) {
+        if (variantFilter >= 0 && candidate.variant != variantFilter) {
+            continue;
+        }
+        for (const ScreenState::Match &match : state.matches) {
+            if (match.isPosition && match.key == candidate.key) {
+                if (matched) {
+                    *matched = &candidate;
+                }
+                if (distance) {
+                    *distance = match.distance;
+                }
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool ScreenRecognizer::matchPinned(const QString &position, const QString &windowKey, const CandidateMatcher &match,
+                                   const PositionCandidate **matched, int *distance)
+{
+    // 匹配时不持有锁（roiHash内部会加锁），结束时写回该窗口的状态
+    const QVector<PositionCandidate> &candidates = positionCandidates(position);
+    WindowVariantState state;
+    {
+        QMutexLocker locker(&windowStateMutex);
+        state = windowVariants.value(windowKey);
+    }
+    auto storeState = [&]() {
+        QMutexLocker locker(&windowStateMutex);
+        windowVariants.insert(windowKey, state);
+    };
+    const PositionCandidate *hit = nullptr;
+    int hitDistance = 0;
+
+    bool hasPinnedVariant = false;
+    if (state.pinned) {
+        for (const PositionCandidate &candidate : candidates) {
+            if (candidate.variant == state.variant) {
+                hasPinnedVariant = true;
+                break;
+            }
+        }
+    }
+
+    // 该位置没有固定变体的模板时（如只有原版的TimesExhausted，或固定为原版而该位置只有变体模板）
+    // 固定不适用于这个位置：检查全部变体，不计入未命中次数，也不据此重新固定
+    if (state.pinned && !hasPinnedVariant) {
+        if (!match(-1, &hit, &hitDistance)) {
+            return false;
+        }
+        if (matched) {
+            *matched = hit;
+        }
+        if (distance) {
+            *distance = hitDistance;
+        }
+        return true;
+    }
+
+    if (state.pinned) {
+        if (match(state.variant, &hit, &hitDistance)) {
+            state.misses = 0;
+            storeState();
+            if (matched) {
+                *matched = hit;
+            }
+            if (distance) {
+                *distance = hitDistance;
+            }
+            return true;
+        }
+        // 其他变体也未命中时只是不在该位置（等待界面切换、!isAtPosition之类的否定检查），不计入未命中次数
+        if (!match(-1, &hit, &hitDistance)) {
+            return false;
+        }
+        // 其他变体命中时固定可能有误，连续多次后才接受（避免偶然的误匹配改变固定）
+        if (++state.misses < VARIANT_REDETECT_MISSES) {
+            storeState();
+            return false;
+        }
+    } else if (!match(-1, &hit, &hitDistance)) {
+        return false;
+    }
+
+    // 可信匹配：距离足够小，且该位置有多个变体可以区分服务器
+    bool ambiguous = true;
+    for (const PositionCandidate &candidate : candidates) {
+        if (candidate.variant != hit->variant) {
+            ambiguous = false;
+            break;
+        }
+    }
+    if (!ambiguous && hitDistance <= hit->tolerance / 2) {
+        state.variant = hit->variant;
+        state.pinned = true;
+    }
+    state.misses = 0;
+    storeState();
+
+    if (matched) {
+        *matched = hit;
+    }
+    if (distance) {
+        *distance = hitDistance;
+    }
+    return true;
+}
+
+bool ScreenRecognizer::windowVariant(const QString &windowKey, Variant *variant) const
+{
+    QMutexLocker locker(&windowStateMutex);
+    auto it = windowVariants.constFind(windowKey);
+    if (it == windowVariants.constEnd() || !it.value().pinned) {
+        return false;
+    }
+    if (variant) {
+        *variant = it.value().variant;
+    }
+    return true;
+}
+
+void ScreenRecognizer::resetWindowVariant(const QString &windowKey)
+{
+    QMutexLocker locker(&windowStateMutex);
+    if (windowKey.isEmpty()) {
+        windowVariants.clear();
+    } else {
+        windowVariants.remove(windowKey);
+    }
+}
+
+bool ScreenRecognizer::addReadyTemplate(const QString &key, const QSize &size, quint64 hash, int tolerance)
+{
+    QPoint pos;
+    if (!parseTemplateKey(key, &pos, nullptr, nullptr)) {
+        return false;
+    }
+
+    HashTemplate tmpl;
+    tmpl.hash = hash;
+    tmpl.tolerance = tolerance;
+    tmpl.key = key;
+    tmpl.size = size;
+    readyIndex[roiKey(pos)].append(readyTemplates.size());
+    readyTemplates.append(tmpl);
+    classifierBuilt = false;
+    return true;
+}
+
+QVector<QRect> ScreenRecognizer::readyRois(const QRect &roi) const
+{
+    QVector<QRect> rois;
+    auto it = readyIndex.constFind(roiKey(roi.topLeft()));
+    if (it != readyIndex.constEnd()) {
+        for (int index : it.value()) {
+            const QRect rect(roi.topLeft(), readyTemplates[index].size);
+            if (!rois.contains(rect)) {
+                rois.append(rect);
+            }
+        }
+    }
+    if (rois.isEmpty()) {
+        rois.append(roi);
+    }
+    return rois;
+}
+
+void ScreenRecognizer::buildClassifier()
+{
+    // 收集所有模板，按ROI分组
+    QVector<QPair<QRect, ClassifierEntry>> all;
+    for (auto it = positionIndex.constBegin(); it != positionIndex.constEnd(); ++it) {
+        for (const PositionCandidate &candidate : it.value()) {
+            ClassifierEntry entry;
+            entry.hash = candidate.hash;
+            entry.tolerance = candidate.tolerance;
+            entry.isPosition = true;
+            entry.variant = candidate.variant;
+            entry.name = it.key();
+            entry.key = candidate.key;
+            all.append(qMakePair(candidate.roi, entry));
+        }
+    }
+    for (const HashTemplate &tmpl : readyTemplates) {
+        QPoint pos;
+        ClassifierEntry entry;
+        parseTemplateKey(tmpl.key, &pos, &entry.name, &entry.variant);
+        entry.hash = tmpl.hash;
+        entry.tolerance = tmpl.tolerance;
+        entry.isPosition = false;
+        entry.key = tmpl.key;
+        all.append(qMakePair(QRect(pos, tmpl.size), entry));
+    }
+
+    // ROI按(y, x)排序，识别时从上到下访问截图的扫描行
+    std::stable_sort(all.begin(), all.end(), [](const QPair<QRect, ClassifierEntry> &a,
+                                                const QPair<QRect, ClassifierEntry> &b) {
+        if (a.first.y() != b.first.y()) {
+            return a.first.y() < b.first.y();
+        }
+        if (a.first.x() != b.first.x()) {
+            return a.first.x() < b.first.x();
+        }
+        if (a.first.width() != b.first.width()) {
+            return a.first.width() < b.first.width();
+        }
+        return a.first.height() < b.first.height();
+    });
+
+    classifierRois.clear();
+    classifierEntries.clear();
+    classifierEntries.reserve(all.size());
+    for (const auto &item : all) {
+        if (classifierRois.isEmpty() || classifierRois.last().roi != item.first) {
+            ClassifierRoi roi;
+            roi.roi = item.first;
+            roi.first = classifierEntries.size();
+            roi.count = 0;
+            classifierRois.append(roi);
+        }
+        classifierRois.last().count++;
+        classifierEntries.append(item.second);
+    }
+    classifierBuilt = true;
+}
+
+ScreenState ScreenRecognizer::classify(const RoiFrame &screenshot, const QString &windowKey) const
+{
+    // 模板变化后未重新生成索引时不做识别（识别期间不会修改模板，这里无需加锁）
+    Q_ASSERT(classifierBuilt);
+    ScreenState state;
+    if (!classifierBuilt) {
+        return state;
+    }
+    for (const ClassifierRoi &roi : classifierRois) {
+        if (!screenshot.contains(roi.roi)) {
+            continue;
+        }
+
+        const quint64 hash = roiHash(screenshot, roi.roi, windowKey);
+        const int firstMatch = state.matches.size();
+        for (int i = roi.first; i < roi.first + roi.count; i++) {
+            const ClassifierEntry &entry = classifierEntries[i];
+            int distance = ImageKernels::hashDistance(hash, entry.hash);
+            if (distance > entry.tolerance) {
+                continue;
+            }
+            ScreenState::Match match;
+            match.name = entry.name;
+            match.key = entry.key;
+            match.variant = entry.variant;
+            match.roi = roi.roi;
+            match.distance = distance;
+            match.isPosition = entry.isPosition;
+            state.matches.append(match);
+        }
+
+        // 同一ROI内按距离排序，nearestAt直接取第一个
+        std::stable_sort(state.matches.begin() + firstMatch, state.matches.end(),
+                         [](const ScreenState::Match &a, const ScreenState::Match &b) {
+            return a.distance < b.distance;
+        });
+    }
+    return state;
+}
+
+quint64 ScreenRecognizer::roiHash(const RoiFrame &screenshot, const QRect &roi, const QString &windowKey) const
+{
+    QImage image;
+    QRect localRoi;
+    if (!screenshot.locate(roi, &image, &localRoi)) {
+        return 0;
+    }
+    if (windowKey.isEmpty()) {
+        return ImageKernels::averageHash(image, localRoi);
+    }
+
+    // 逐像素的校验和：任何一个像素变化都会改变校验和（隔行隔列采样会漏掉细小的图标、文字变化），
+    // 只做一次整数混合、不做灰度转换和面积加权，仍比完整的平均哈希便宜
+    const quint64 checksum = ImageKernels::sampledChecksum(image, localRoi, 1);
+    {
+        QMutexLocker locker(&windowStateMutex);
+        QHash<quint64, RoiCacheEntry> &cache = roiCache[windowKey];
+        auto it = cache.find(rectKey(roi));
+        if (it != cache.end() && it->checksum == checksum && it->reuse < ROI_CACHE_MAX_REUSE) {
+            it->reuse++;
+            roiCacheCounters[windowKey].hits++;
+            return it->hash;
+        }
+    }
+
+    // 未命中时在锁外计算哈希，其他窗口的线程不必等待
+    RoiCacheEntry entry;
+    entry.checksum = checksum;
+    entry.hash = ImageKernels::averageHash(image, localRoi);
+    entry.reuse = 0;
+    QMutexLocker locker(&windowStateMutex);
+    roiCache[windowKey].insert(rectKey(roi), entry);
+    roiCacheCounters[windowKey].misses++;
+    return entry.hash;
+}
+
+ScreenRecognizer::RoiCacheStats ScreenRecognizer::roiCacheStats(const QString &windowKey) const
+{
+    QMutexLocker locker(&windowStateMutex);
+    if (!windowKey.isEmpty()) {
+        return roiCacheCounters.value(windowKey);
+    }
+    RoiCacheStats total;
+    for (const RoiCacheStats &counters : roiCacheCounters) {
+        total.hits += counters.hits;
+        total.misses += counters.misses;
+    }
+    return total;
+}
+
+void ScreenRecognizer::resetRoiCache(const QString &windowKey)
+{
+    QMutexLocker locker(&windowStateMutex);
+    if (windowKey.isEmpty()) {
+        roiCache.clear();
+        roiCacheCounters.clear();
+    } else {
+        roiCache.remove(windowKey);
+        roiCacheCounters.remove(windowKey);
+    }
+}
+
+const ScreenState::Match *ScreenState::find(const QString &name) const
+{
+    for (const Match &match : matches) {
+        if (match.name == name) {
+            return &match;
+        }
+    }
+    return nullptr;
+}
+
+const ScreenState::Match *ScreenState::nearestAt(const QRect &roi) const
+{
+    // 同一左上角可能登记了不同尺寸的模板，分属不同的ROI，取其中距离最小的
+    const Match *best = nullptr;
+    for (const Match &match : matches) {
+        if (!match.isPosition && match.roi.topLeft() == roi.topLeft()
+            && (!best || match.distance < best->distance)) {
+            best = &match;
+        }
+    }
+    return best;
+}
+
+QString ScreenState::toString() const
+{
+    QStringList parts;
+    for (const Match &match : matches) {
+        parts << QString("%1%2(%3)").arg(match.name)
+                                   .arg(QString::fromLatin1(ScreenRecognizer::variantSuffix(match.variant)))
+                                   .arg(match.distance);
+    }
+    return parts.join(", ");
+}
@@ -0,0 +1,211 @@
+#ifndef SCREENRECOGNIZER_H
+#define SCREENRECOGNIZER_H
+
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QPoint>
+#include <QRect>
+#include <QSettings>
+#include <QSize>
+#include <QString>
+#include <QVector>
+#include <functional>
+#include "roiframe.h"
+
+struct ScreenState;
+
+// 基于感知哈希的界面识别
+// 模板文件名格式为 "(x,y)名称[_服务器后缀]"，加载时一次性解析为索引，识别时不再做字符串处理
+// 识别函数接受RoiFrame（可由QImage隐式转换），只截取了部分ROI时，未截取的ROI视为不匹配
+// 识别函数可以在多个线程中同时调用（按窗口的变体和ROI缓存由内部互斥量保护），
+// 但添加/清除模板不能与识别同时进行；添加完模板后调用buildClassifier生成classify使用的索引
+class ScreenRecognizer
+{
+public:
+    // 服务器变体：原版、日服(_JP)、韩服(_KR)、台服(_TW)、国服(_CN)、反和谐(_AC)
+    enum Variant {
+        VariantDefault,
+        VariantJP,
+        VariantKR,
+        VariantTW,
+        VariantCN,
+        VariantAC,
+        VariantCount
+    };
+
+    // 一个位置模板：截图中的ROI + 模板哈希 + 允许的汉明距离
+    struct PositionCandidate {
+        QRect roi;
+        quint64 hash;
+        int tolerance;
+        Variant variant;
+        QString key;        // 原始模板名（用于日志）
+    };
+
+    // 默认容差（同一ROI下不同模板的最小距离为12）
+    static constexpr int DEFAULT_TOLERANCE = 4;
+    // 从配置读取模板容差，格式: [HashTolerance] Default=4, Hall_JP=6 ...（键为去掉坐标前缀的模板名）
+    static int toleranceFromSettings(QSettings &settings, const QString &templateName);
+
+    // 解析模板名，失败返回false
+    // "(118,960)Hall_JP" -> pos=(118,960), name="Hall", variant=VariantJP
+    static bool parseTemplateKey(const QString &key, QPoint *pos, QString *name, Variant *variant);
+    static const char *variantSuffix(Variant variant);
+
+    void clearPositionTemplates();
+    void clearReadyTemplates();
+
+    // 添加位置模板，size为模板图像尺寸（即截图中ROI的尺寸）；模板名无法解析时返回false
+    bool addPositionTemplate(const QString &key, const QSize &size, quint64 hash, int tolerance);
+
+    int positionTemplateCount() const { return positionTemplateTotal; }
+    // 指定位置的所有候选模板（按变体顺序排列，原版在前）
+    const QVector<PositionCandidate> &positionCandidates(const QString &position) const;
+    // 识别指定位置需要截取的ROI（去重），用于只截取ROI的截图模式
+    QVector<QRect> positionRois(const QString &position) const;
+
+    // 判断截图是否处于指定位置（尝试全部变体），匹配时可通过matched返回命中的候选模板
+    bool matchPosition(const RoiFrame &screenshot, const QString &position,
+                       const PositionCandidate **matched = nullptr, int *distance = nullptr) const;
+
+    // 按窗口固定服务器变体的版本（windowKey为窗口标题，为空时等同于上面的版本）
+    // 第一次可信匹配（距离不超过容差的一半，且该位置存在多个变体）后固定该窗口的变体，
+    // 之后只检查固定变体的模板（该位置没有此变体的模板时固定不适用，检查全部变体）；
+    // 固定变体未命中时检查全部变体：都未命中只是不在该位置，不计入未命中次数；
+    // 命中其他变体时计为一次未命中，连续VARIANT_REDETECT_MISSES次后接受该匹配（可信时重新固定）
+    static constexpr int VARIANT_REDETECT_MISSES = 5;
+    bool matchPosition(const RoiFrame &screenshot, const QString &position, const QString &windowKey,
+                       const PositionCandidate **matched = nullptr, int *distance = nullptr);
+    // 同上，但使用classify的结果判断（不再计算哈希），变体固定规则相同
+    bool matchPosition(const ScreenState &state, const QString &position, const QString &windowKey,
+                       const PositionCandidate **matched = nullptr, int *distance = nullptr);
+
+    // 查询/重置窗口固定的变体（windowKey为空时重置全部窗口）
+    bool windowVariant(const QString &windowKey, Variant *variant) const;
+    void resetWindowVariant(const QString &windowKey = QString());
+
+    // 添加就绪/通知模板（按ROI左上角分组），size为模板图像尺寸；模板名无法解析时返回false
+    bool addReadyTemplate(const QString &key, const QSize &size, quint64 hash, int tolerance);
+    int readyTemplateCount() const { return readyTemplates.size(); }
+
+    // 判断roi处的就绪/通知模板需要截取的ROI（登记在roi左上角的模板的实际区域，没有模板时为roi本身）
+    QVector<QRect> readyRois(const QRect &roi) const;
+
+    // 根据当前的全部模板生成classify使用的扁平索引，添加/清除模板后必须重新调用
+    void buildClassifier();
+
+    // 一次评估所有已登记的ROI（位置模板和就绪/通知模板），返回容差内的全部匹配
+    // 每个ROI只计算一次哈希，ROI按从上到下的顺序访问截图；指定windowKey时使用ROI变化检测缓存
+    // 只截取了部分ROI时只评估截取到的ROI，因此判断单个位置/就绪状态时也可以只截取需要的ROI
+    ScreenState classify(const RoiFrame &screenshot, const QString &windowKey = QString()) const;
+
+    // ROI变化检测缓存（按窗口）：ROI的逐像素校验和与上一帧相同时直接复用上一帧的哈希
+    // 位置、就绪和通知模板的判断都经过classify（matchPosition的截图版本同样经过roiHash），都使用这个缓存
+    // 校验和覆盖ROI内的每个像素；连续复用ROI_CACHE_MAX_REUSE次后仍强制重新计算一次，校验和碰撞时也不会长期沿用旧结果
+    static constexpr int ROI_CACHE_MAX_REUSE = 4;
+    struct RoiCacheStats {
+        quint64 hits = 0;
+        quint64 misses = 0;
+    };
+    RoiCacheStats roiCacheStats(const QString &windowKey = QString()) const;  // windowKey为空时返回所有窗口的合计
+    void resetRoiCache(const QString &windowKey = QString());
+
+private:
+    // 就绪/通知模板
+    struct HashTemplate {
+        quint64 hash;
+        int tolerance;
+        QString key;
+        QSize size;
+    };
+
+    // 分类器的扁平索引：每个ROI对应entries中连续的一段模板
+    struct ClassifierEntry {
+        quint64 hash;
+        int tolerance;
+        bool isPosition;
+        Variant variant;
+        QString name;
+        QString key;
+    };
+    struct ClassifierRoi {
+        QRect roi;
+        int first;
+        int count;
+    };
+
+    // 每个窗口的变体固定状态
+    struct WindowVariantState {
+        Variant variant = VariantDefault;
+        bool pinned = false;
+        int misses = 0;     // 固定后固定变体未命中而其他变体命中的次数（固定变体命中时清零）
+    };
+
+    // ROI缓存项
+    struct RoiCacheEntry {
+        quint64 checksum;
+        quint64 hash;
+        int reuse;          // 已连续复用的次数
+    };
+
+    // 在候选模板中查找第一个匹配项；variantFilter < 0 时检查全部变体
+    bool matchCandidates(const RoiFrame &screenshot, const QVector<PositionCandidate> &candidates, int variantFilter,
+                         const QString &windowKey, const PositionCandidate **matched, int *distance) const;
+    bool matchCandidates(const ScreenState &state, const QVector<PositionCandidate> &candidates, int variantFilter,
+                         const PositionCandidate **matched, int *distance) const;
+
+    // 按窗口固定变体的匹配流程，match(variantFilter, matched, distance)负责实际的匹配
+    typedef std::function<bool(int, const PositionCandidate **, int *)> CandidateMatcher;
+    bool matchPinned(const QString &position, const QString &windowKey, const CandidateMatcher &match,
+                     const PositionCandidate **matched, int *distance);
+
+    // 计算ROI的平均哈希，windowKey非空时先查变化检测缓存
+    quint64 roiHash(const RoiFrame &screenshot, const QRect &roi, const QString &windowKey) const;
+    static quint64 rectKey(const QRect &rect)
+    {
+        return (quint64(quint16(rect.x())) << 48) | (quint64(quint16(rect.y())) << 32)
+             | (quint64(quint16(rect.width())) << 16) | quint16(rect.height());
+    }
+
+    static quint64 roiKey(const QPoint &pos) { return (quint64(quint32(pos.x())) << 32) | quint32(pos.y()); }
+
+    QHash<QString, QVector<PositionCandidate>> positionIndex;  // 位置名 -> 候选模板
+    int positionTemplateTotal = 0;
+    QHash<QString, WindowVariantState> windowVariants;          // 窗口标题 -> 固定的变体（windowStateMutex保护）
+
+    QVector<HashTemplate> readyTemplates;               // 全部就绪模板
+    QHash<quint64, QVector<int>> readyIndex;            // ROI左上角 -> readyTemplates中的下标
+
+    // 窗口标题 -> (ROI -> 上一帧的校验和与哈希)（windowStateMutex保护）
+    mutable QHash<QString, QHash<quint64, RoiCacheEntry>> roiCache;
+    mutable QHash<QString, RoiCacheStats> roiCacheCounters;
+    mutable QMutex windowStateMutex;
+
+    // 由buildClassifier生成，模板变化后清空直到重新生成
+    bool classifierBuilt = false;
+    QVector<ClassifierRoi> classifierRois;
+    QVector<ClassifierEntry> classifierEntries;
+};
+
+// 一帧截图的识别结果
+struct ScreenState {
+    struct Match {
+        QString name;                       // 去掉坐标和服务器后缀的名称，如"Hall"、"Notice"
+        QString key;                        // 原始模板名，如"(921,223)Notice_JP"
+        ScreenRecognizer::Variant variant;
+        QRect roi;
+        int distance;
+        bool isPosition;                    // 位置模板(true)或就绪/通知模板(false)
+    };
+    QVector<Match> matches;                 // 按ROI从上到下排列；同一ROI内按距离从小到大
+
+    // 按名称查询（任一服务器变体命中即可）
+    const Match *find(const QString &name) const;
+    bool contains(const QString &name) const { return find(name) != nullptr; }
+    // 左上角为roi左上角的就绪/通知模板中距离最近的匹配（用于就绪判断和通知类的多选一判断）
+    const Match *nearestAt(const QRect &roi) const;
+    QString toString() const;               // 日志用："Hall(0), ticket_JP(2)"
+};
+
+#endif // SCREENRECOGNIZER_H
@@ -0,0 +1,209 @@
+#include "scriptruntime.h"
+#include "cancellationtoken.h"
+
+#include <QMutexLocker>
+#include <chrono>
+
+static thread_local ScriptRuntime *currentRuntime = nullptr;
+static thread_local void *currentContext = nullptr;
+
+ScriptRuntime::ScriptRuntime(const CancellationToken *cancel)
+    : cancel(cancel)
+    , queue(std::make_shared<Queue>())
+{
+}
+
+ScriptRuntime::~ScriptRuntime()
+{
+    // run()只在所有任务结束后返回；没有run()过的任务在这里销毁
+    for (auto root : roots) {
+        root.destroy();
+    }
+    QMutexLocker locker(&queue->mutex);
+    queue->suspended.clear();
+}
+
+qint64 ScriptRuntime::clockMs()
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+ScriptRuntime *ScriptRuntime::current()
+{
+    return currentRuntime;
+}
+
+void *ScriptRuntime::context()
+{
+    return currentContext;
+}
+
+void ScriptRuntime::setContext(void *context)
+{
+    currentContext = context;
+}
+
+bool ScriptRuntime::isCancelled() const
+{
+    return cancel && cancel->isCancelled();
+}
+
+void ScriptRuntime::spawn(ScriptTask<> task, void *context)
+{
+    auto root = std::exchange(task.handle, {});
+    roots.append(root);
+    QMutexLocker locker(&queue->mutex);
+    queue->ready.append({root, context});
+}
+
+ScriptRuntime::WaitHandle ScriptRuntime::suspend(std::coroutine_handle<> handle, int timeoutMs, bool timeoutResult)
+{
+    WaitHandle wait = std::make_shared<Wait>();
+    wait->queue = queue;
+    wait->handle = handle;
+    wait->context = currentContext;
+
+    QMutexLocker locker(&queue->mutex);
+    queue->suspended.append(wait);
+    if (isCancelled()) {
+        // 取消之后的等待不再挂起（如停止后仍要发送的输入）
+        queue->wakeLocked(wait, false);
+    } else if (timeoutMs >= 0) {
+        timers.push(Timer{clockMs() + timeoutMs, nextSequence++, wait, timeoutResult});
+    }
+    return wait;
+}
+
+void ScriptRuntime::wake(const WaitHandle &wait, bool result)
+{
+    if (wait->done.load()) {
+        return;
+    }
+    QMutexLocker locker(&wait->queue->mutex);
+    wait->queue->wakeLocked(wait, result);
+}
+
+void ScriptRuntime::Queue::wakeLocked(const WaitHandle &wait, bool result)
+{
+    if (wait->done.exchange(true)) {
+        return;
+    }
+    wait->result = result;
+    ready.append({wait->handle, wait->context});
+    suspended.removeOne(wait);
+    wakeup.wakeAll();
+}
+
+void ScriptRuntime::reapFinished()
+{
+    for (int i = roots.size() - 1; i >= 0; i--) {
+        if (roots[i].done()) {
+            roots.takeAt(i).destroy();
+        }
+    }
+}
+
+void ScriptRuntime::run()
+{
+    ScriptRuntime *previousRuntime = std::exchange(currentRuntime, this);
+    void *previousContext = currentContext;
+
+    // 先登记取消通知再加锁（见CancellationToken::Waiter），取消时从休眠中醒来恢复所有挂起
+    CancellationToken::Waiter cancelWaiter(cancel, &queue->mutex, &queue->wakeup);
+    QMutexLocker locker(&queue->mutex);
+    for (;;) {
+        if (isCancelled()) {
+            while (!queue->suspended.isEmpty()) {
+                WaitHandle wait = queue->suspended.first();
+                queue->wakeLocked(wait, false);
+            }
+        }
+
+        // 到期的定时器（已经被其他唤醒源恢复的直接丢弃）
+        const qint64 now = clockMs();
+        while (!timers.empty() && timers.top().dueMs <= now) {
+            Timer timer = timers.top();
+            timers.pop();
+            queue->wakeLocked(timer.wait, timer.result);
+        }
+
+        if (!queue->ready.isEmpty()) {
+            Ready next = queue->ready.takeFirst();
+            locker.unlock();
+            currentContext = next.context;
+            next.handle.resume();
+            reapFinished();
+            locker.relock();
+            continue;
+        }
+        if (roots.isEmpty()) {
+            break;
+        }
+
+        if (timers.empty()) {
+            queue->wakeup.wait(&queue->mutex);
+        } else {
+            queue->wakeup.wait(&queue->mutex, ulong(timers.top().dueMs - now));
+        }
+    }
+
+    currentRuntime = previousRuntime;
+    currentContext = previousContext;
+}
+
+void ScriptRuntime::InputCompletion::await_suspend(std::coroutine_handle<> handle)
+{
+    wait = current()->suspend(handle, -1);
+    WaitHandle completed = wait;
+    scheduler.whenDone(batch, [completed]() { ScriptRuntime::wake(completed, true); });
+}
+
+bool ScriptRuntime::InputCompletion::await_resume()
+{
+    if (!wait->result) {
+        scheduler.cancel(batch);
+    }
+    return wait->result;
+}
+
+quint64 ScriptSignal::generation() const
+{
+    QMutexLocker locker(&mutex);
+    return count;
+}
+
+void ScriptSignal::notify()
+{
+    QVector<ScriptRuntime::WaitHandle> woken;
+    {
+        QMutexLocker locker(&mutex);
+        count++;
+        woken.swap(waiters);
+    }
+    for (const ScriptRuntime::WaitHandle &wait : woken) {
+        ScriptRuntime::wake(wait, true);
+    }
+}
+
+bool ScriptSignal::Awaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    QMutexLocker locker(&signal.mutex);
+    if (signal.count != seen) {
+        return false;  // 检查条件之后已经通知过
+    }
+    wait = ScriptRuntime::current()->suspend(handle, timeoutMs);
+    signal.waiters.append(wait);
+    return true;
+}
+
+bool ScriptSignal::Awaiter::await_resume()
+{
+    if (!wait) {
+        return true;
+    }
+    // 超时或被取消时从等待列表中移除
+    QMutexLocker locker(&signal.mutex);
+    signal.waiters.removeOne(wait);
+    return wait->result;
+}
@@ -0,0 +1,281 @@
+#ifndef SCRIPTRUNTIME_H
+#define SCRIPTRUNTIME_H
+
+#include <QList>
+#include <QMutex>
+#include <QVector>
+#include <QWaitCondition>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <queue>
+#include <utility>
+#include <vector>
+#include "inputscheduler.h"
+
+class CancellationToken;
+class ScriptRuntime;
+
+// 协程脚本任务（C++20协程）
+// 脚本流程写成返回ScriptTask的协程，在延时、等待新画面、等待输入发送完毕处co_await挂起，
+// 由ScriptRuntime在同一个线程上恢复；多个窗口的流程在挂起点交错执行，不需要每个窗口一个线程，也不嵌套事件循环
+// 任务创建后不立即执行：被co_await时开始执行，结束后回到等待它的协程；或者交给ScriptRuntime::spawn独立执行
+// 协程的参数应按值传递（引用参数在挂起期间可能失效）；任务中不使用异常
+template <typename T = void>
+class ScriptTask;
+
+class ScriptTaskPromiseBase
+{
+public:
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    // 结束时直接转到等待它的协程（对称转移，嵌套再深也不增加调用栈）；独立任务没有等待方，停在这里由运行时销毁
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            std::coroutine_handle<> continuation = handle.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() const noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() noexcept { std::terminate(); }
+
+    std::coroutine_handle<> continuation;
+};
+
+template <typename T>
+class ScriptTask
+{
+public:
+    struct promise_type : ScriptTaskPromiseBase {
+        T value{};
+        ScriptTask get_return_object() { return ScriptTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        void return_value(T result) { value = std::move(result); }
+    };
+
+    ScriptTask(ScriptTask &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+    ScriptTask &operator=(ScriptTask &&other) noexcept
+    {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, {});
+        }
+        return *this;
+    }
+    ~ScriptTask()
+    {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+    T await_resume() { return std::move(handle.promise().value); }
+
+private:
+    explicit ScriptTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+template <>
+class ScriptTask<void>
+{
+public:
+    struct promise_type : ScriptTaskPromiseBase {
+        ScriptTask get_return_object() { return ScriptTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        void return_void() {}
+    };
+
+    ScriptTask(ScriptTask &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+    ScriptTask &operator=(ScriptTask &&other) noexcept
+    {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, {});
+        }
+        return *this;
+    }
+    ~ScriptTask()
+    {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+    void await_resume() {}
+
+private:
+    friend class ScriptRuntime;
+    explicit ScriptTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// 单线程协程调度器
+// run()在调用线程上依次恢复就绪的协程，没有就绪的协程时在条件变量上休眠到最近的定时器或被唤醒
+// 唤醒源（截图线程、输入时序线程、仲裁）可以在任意线程调用wake，协程总是在run()的线程上恢复
+// 取消令牌被取消时，所有挂起中（以及之后再挂起）的等待立即以false恢复，各流程按返回值自行退出
+class ScriptRuntime
+{
+    struct Queue;
+
+public:
+    // 一次挂起：先被唤醒或到期的一方恢复协程（只恢复一次），result为co_await的结果
+    // 唤醒源持有的是共享的就绪队列而不是运行时本身，运行时结束后迟到的唤醒不会访问已销毁的对象
+    struct Wait {
+        std::shared_ptr<Queue> queue;
+        std::coroutine_handle<> handle;
+        void *context = nullptr;
+        std::atomic<bool> done{false};
+        bool result = false;
+    };
+    using WaitHandle = std::shared_ptr<Wait>;
+
+    explicit ScriptRuntime(const CancellationToken *cancel = nullptr);
+    ~ScriptRuntime();
+    ScriptRuntime(const ScriptRuntime &) = delete;
+    ScriptRuntime &operator=(const ScriptRuntime &) = delete;
+
+    // 添加独立任务，在run()中开始执行（可以在任务中调用，如为每个窗口启动一个任务）
+    void spawn(ScriptTask<> task, void *context = nullptr);
+    // 执行到所有任务结束
+    void run();
+
+    bool isCancelled() const;
+
+    // 当前线程上正在run()的运行时（不在协程中时为空）
+    static ScriptRuntime *current();
+    // 当前任务的上下文：挂起时随协程保存、恢复时还原，相当于每个任务自己的thread_local（如日志中的窗口标签）
+    static void *context();
+    static void setContext(void *context);
+
+    // 挂起handle直到wake；timeoutMs >= 0时到期以timeoutResult恢复（供下面的等待和ScriptSignal使用）
+    WaitHandle suspend(std::coroutine_handle<> handle, int timeoutMs, bool timeoutResult = false);
+    // 恢复一次挂起（任意线程）；已经恢复过时忽略
+    static void wake(const WaitHandle &wait, bool result);
+
+    // co_await ScriptRuntime::delay(ms)：延时，返回false表示被取消
+    class Delay
+    {
+    public:
+        explicit Delay(int milliseconds) : milliseconds(milliseconds) {}
+        bool await_ready() const { return milliseconds <= 0 || current()->isCancelled(); }
+        void await_suspend(std::coroutine_handle<> handle) { wait = current()->suspend(handle, milliseconds, true); }
+        bool await_resume() const { return wait ? wait->result : !current()->isCancelled(); }
+
+    private:
+        int milliseconds;
+        WaitHandle wait;
+    };
+    static Delay delay(int milliseconds) { return Delay(milliseconds); }
+
+    // co_await ScriptRuntime::input(scheduler, batch)：提交一批输入，挂起到时序线程发送完毕
+    // 返回false表示被取消：该批次随之取消（尚未发送的按下、移动不再发送，欠着的抬起仍会发送）
+    class InputCompletion
+    {
+    public:
+        InputCompletion(InputScheduler &scheduler, quint64 batch) : scheduler(scheduler), batch(batch) {}
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<> handle);
+        bool await_resume();
+
+    private:
+        InputScheduler &scheduler;
+        quint64 batch;
+        WaitHandle wait;
+    };
+    static InputCompletion input(InputScheduler &scheduler, const QVector<InputScheduler::Event> &batch)
+    {
+        return InputCompletion(scheduler, scheduler.submit(batch));
+    }
+
+private:
+    struct Ready {
+        std::coroutine_handle<> handle;
+        void *context;
+    };
+    // 可以被其他线程访问的部分
+    struct Queue {
+        QMutex mutex;                   // 保护以下成员
+        QWaitCondition wakeup;          // 有协程就绪或被取消
+        QList<Ready> ready;
+        QList<WaitHandle> suspended;    // 尚未恢复的挂起（取消时全部恢复）
+
+        void wakeLocked(const WaitHandle &wait, bool result);
+    };
+    struct Timer {
+        qint64 dueMs;
+        quint64 sequence;   // 到期时刻相同时按挂起顺序
+        WaitHandle wait;
+        bool result;
+    };
+    struct Later {
+        bool operator()(const Timer &a, const Timer &b) const
+        {
+            return a.dueMs != b.dueMs ? a.dueMs > b.dueMs : a.sequence > b.sequence;
+        }
+    };
+
+    static qint64 clockMs();
+    void reapFinished();
+
+    const CancellationToken *cancel;
+    std::shared_ptr<Queue> queue;
+    // 以下只由run()的线程访问
+    std::priority_queue<Timer, std::vector<Timer>, Later> timers;
+    quint64 nextSequence = 0;
+    QList<std::coroutine_handle<ScriptTask<>::promise_type>> roots;
+};
+
+// 可以在任意线程通知的信号（截图线程发布新帧、全局输入仲裁被释放等），协程在上面等待
+// 按计数避免丢失通知：先读取generation()，检查条件不成立后再co_await wait(timeoutMs, generation)，
+// 两者之间已经通知过时wait立即返回；返回false表示超时或被取消
+class ScriptSignal
+{
+public:
+    quint64 generation() const;
+    void notify();
+
+    class Awaiter
+    {
+    public:
+        Awaiter(ScriptSignal &signal, int timeoutMs, quint64 seen) : signal(signal), timeoutMs(timeoutMs), seen(seen) {}
+        bool await_ready() const { return signal.generation() != seen; }
+        bool await_suspend(std::coroutine_handle<> handle);
+        bool await_resume();
+
+    private:
+        ScriptSignal &signal;
+        int timeoutMs;
+        quint64 seen;
+        ScriptRuntime::WaitHandle wait;
+    };
+    Awaiter wait(int timeoutMs, quint64 seen) { return Awaiter(*this, timeoutMs, seen); }
+
+private:
+    mutable QMutex mutex;
+    quint64 count = 0;
+    QVector<ScriptRuntime::WaitHandle> waiters;
+};
+
+#endif // SCRIPTRUNTIME_H
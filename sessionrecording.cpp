@@ -0,0 +1,583 @@
+#include "sessionrecording.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <algorithm>
+#include <cstring>
+#include "captureworker.h"
+
+using namespace SessionFormat;
+
+static_assert(sizeof(FileHeader) == 16, "FileHeader layout");
+static_assert(sizeof(RecordHeader) == 16, "RecordHeader layout");
+static_assert(sizeof(FrameHeader) == 16, "FrameHeader layout");
+static_assert(sizeof(FrameIndexEntry) == 16, "FrameIndexEntry layout");
+static_assert(sizeof(Footer) == 24, "Footer layout");
+static_assert(sizeof(SessionInputEvent) == 32, "SessionInputEvent layout");
+
+namespace {
+
+// 未变化的像素段短于该长度时并入前后的变化段（每段额外占用8字节，即2个像素）
+const int MIN_SKIP_PIXELS = 4;
+
+void appendWord(QByteArray &out, quint32 value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// 差分编码：[跳过像素数, 像素数, 像素...] 重复，直到覆盖整帧
+// 编码结果不小于原始像素时返回false（调用方改为写原始帧）
+bool encodeDelta(const QVector<quint32> &current, const QVector<quint32> &previous, QByteArray &out)
+{
+    const int count = current.size();
+    const qsizetype rawBytes = qsizetype(count) * 4;
+    const quint32 *cur = current.constData();
+    const quint32 *prev = previous.constData();
+
+    out.clear();
+    int i = 0;
+    while (i < count) {
+        const int skipStart = i;
+        while (i < count && cur[i] == prev[i]) {
+            i++;
+        }
+        const int literalStart = i;
+        while (i < count) {
+            if (cur[i] != prev[i]) {
+                i++;
+                continue;
+            }
+            int j = i;
+            while (j < count && cur[j] == prev[j] && j - i < MIN_SKIP_PIXELS) {
+                j++;
+            }
+            if (j - i >= MIN_SKIP_PIXELS || j >= count) {
+                break;
+            }
+            i = j;
+        }
+
+        appendWord(out, quint32(literalStart - skipStart));
+        appendWord(out, quint32(i - literalStart));
+        out.append(reinterpret_cast<const char *>(cur + literalStart), (i - literalStart) * 4);
+        if (out.size() >= rawBytes) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool applyDelta(const uchar *data, quint32 size, QVector<quint32> &pixels)
+{
+    const qint64 count = pixels.size();
+    quint32 *dst = pixels.data();
+    qint64 position = 0;
+    quint32 offset = 0;
+    while (offset + 8 <= size) {
+        quint32 skip;
+        quint32 literal;
+        memcpy(&skip, data + offset, 4);
+        memcpy(&literal, data + offset + 4, 4);
+        offset += 8;
+        position += skip;
+        if (position + literal > count || offset + qint64(literal) * 4 > size) {
+            return false;
+        }
+        memcpy(dst + position, data + offset, size_t(literal) * 4);
+        position += literal;
+        offset += literal * 4;
+    }
+    return offset == size && position <= count;
+}
+
+} // namespace
+
+// ==================== SessionRecorder ====================
+
+SessionRecorder::SessionRecorder(int keyframeInterval, int maxPendingFrames, QObject *parent)
+    : QThread(parent)
+    , keyframeInterval(qMax(1, keyframeInterval))
+    , maxPendingFrames(qMax(1, maxPendingFrames))
+{
+}
+
+SessionRecorder::~SessionRecorder()
+{
+    close();
+}
+
+bool SessionRecorder::open(const QString &path)
+{
+    if (isRunning()) {
+        return false;
+    }
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    file.setFileName(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        QMutexLocker locker(&mutex);
+        errorString = QString("无法创建录制文件: %1").arg(path);
+        return false;
+    }
+
+    queue.clear();
+    pendingFrames = 0;
+    closing = false;
+    errorString.clear();
+    previous.clear();
+    previousSize = QSize();
+    keyframe = 0;
+    frameIndex.clear();
+    events.clear();
+    failed = false;
+    written = 0;
+    dropped = 0;
+    deltas = 0;
+    bytes = 0;
+
+    FileHeader header;
+    memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.reserved = 0;
+    if (!writeBytes(&header, sizeof(header))) {
+        file.close();
+        return false;
+    }
+
+    origin = CaptureWorker::clockMs();
+    start(QThread::LowPriority);
+    return true;
+}
+
+void SessionRecorder::close()
+{
+    if (!isRunning()) {
+        return;
+    }
+    {
+        QMutexLocker locker(&mutex);
+        closing = true;
+        wakeup.wakeOne();
+    }
+    wait();
+}
+
+QString SessionRecorder::lastError() const
+{
+    QMutexLocker locker(&mutex);
+    return errorString;
+}
+
+void SessionRecorder::recordFrame(const QImage &image, qint64 capturedAt)
+{
+    if (image.isNull()) {
+        return;
+    }
+    {
+        QMutexLocker locker(&mutex);
+        if (closing || !isRunning()) {
+            return;
+        }
+        if (pendingFrames >= maxPendingFrames) {
+            // 写入跟不上截图：丢弃新帧而不是阻塞调用方
+            dropped++;
+            return;
+        }
+        pendingFrames++;  // 先占住队列位置，复制像素时不持有锁
+    }
+
+    // 截图来自WindowCapture的帧池（共享DIB），队列中的帧如果直接引用它，帧池很快就会耗尽
+    // 这里把像素复制到录制器自己持有的缓冲区，调用方返回后帧立即可以回到帧池
+    Item item;
+    item.image = image.format() == QImage::Format_RGB32 ? image.copy() : image.convertToFormat(QImage::Format_RGB32);
+    item.event.timestamp = capturedAt - origin;
+
+    QMutexLocker locker(&mutex);
+    if (closing) {
+        pendingFrames--;
+        return;
+    }
+    queue.enqueue(item);
+    wakeup.wakeOne();
+}
+
+void SessionRecorder::recordInput(SessionInputEvent::Type type, int x, int y, int x2, int y2, int value)
+{
+    QMutexLocker locker(&mutex);
+    if (closing || !isRunning()) {
+        return;
+    }
+    Item item;
+    item.event.timestamp = CaptureWorker::clockMs() - origin;
+    item.event.type = type;
+    item.event.x = x;
+    item.event.y = y;
+    item.event.x2 = x2;
+    item.event.y2 = y2;
+    item.event.value = value;
+    queue.enqueue(item);
+    wakeup.wakeOne();
+}
+
+void SessionRecorder::run()
+{
+    for (;;) {
+        Item item;
+        {
+            QMutexLocker locker(&mutex);
+            while (queue.isEmpty() && !closing) {
+                wakeup.wait(&mutex);
+            }
+            if (queue.isEmpty()) {
+                break;
+            }
+            item = queue.dequeue();
+            if (!item.image.isNull()) {
+                pendingFrames--;
+            }
+        }
+
+        if (item.image.isNull()) {
+            writeEvent(item.event);
+        } else {
+            writeFrame(std::move(item.image), item.event.timestamp);
+        }
+    }
+
+    writeIndex();
+    file.close();
+}
+
+void SessionRecorder::writeFrame(QImage image, qint64 timestamp)
+{
+    if (image.format() != QImage::Format_RGB32) {
+        image = image.convertToFormat(QImage::Format_RGB32);
+    }
+    const int width = image.width();
+    const int height = image.height();
+
+    // 按行复制为紧凑的像素数组（QImage每行可能有对齐填充）
+    current.resize(width * height);
+    for (int y = 0; y < height; ++y) {
+        memcpy(current.data() + qsizetype(y) * width, image.constScanLine(y), size_t(width) * 4);
+    }
+    image = QImage();  // 尽早释放入队时复制的帧
+
+    const int index = frameIndex.size();
+    quint32 encoding = EncodingRaw;
+    if (previousSize == QSize(width, height) && index - keyframe < keyframeInterval
+        && encodeDelta(current, previous, encoded)) {
+        encoding = EncodingDelta;
+    } else {
+        keyframe = index;
+    }
+
+    const char *payload = encoding == EncodingDelta ? encoded.constData() : reinterpret_cast<const char *>(current.constData());
+    const quint32 payloadSize = encoding == EncodingDelta ? quint32(encoded.size()) : quint32(current.size() * 4);
+
+    FrameIndexEntry entry;
+    entry.timestamp = timestamp;
+    entry.offset = quint64(file.pos());
+
+    RecordHeader record;
+    record.type = RecordFrame;
+    record.size = quint32(sizeof(FrameHeader)) + payloadSize;
+    record.timestamp = timestamp;
+    FrameHeader header;
+    header.width = width;
+    header.height = height;
+    header.encoding = encoding;
+    header.keyframe = quint32(keyframe);
+
+    if (!writeBytes(&record, sizeof(record)) || !writeBytes(&header, sizeof(header))
+        || !writeBytes(payload, payloadSize)) {
+        return;
+    }
+
+    frameIndex.append(entry);
+    previous.swap(current);
+    previousSize = QSize(width, height);
+    written++;
+    if (encoding == EncodingDelta) {
+        deltas++;
+    }
+}
+
+void SessionRecorder::writeEvent(const SessionInputEvent &event)
+{
+    RecordHeader record;
+    record.type = RecordInput;
+    record.size = sizeof(SessionInputEvent);
+    record.timestamp = event.timestamp;
+    if (writeBytes(&record, sizeof(record)) && writeBytes(&event, sizeof(event))) {
+        events.append(event);
+    }
+}
+
+void SessionRecorder::writeIndex()
+{
+    Footer footer;
+    footer.indexOffset = quint64(file.pos());
+    footer.frameCount = quint32(frameIndex.size());
+    footer.eventCount = quint32(events.size());
+    memcpy(footer.magic, FOOTER_MAGIC, sizeof(footer.magic));
+
+    writeBytes(frameIndex.constData(), qint64(frameIndex.size()) * sizeof(FrameIndexEntry));
+    writeBytes(events.constData(), qint64(events.size()) * sizeof(SessionInputEvent));
+    writeBytes(&footer, sizeof(footer));
+    file.flush();
+}
+
+bool SessionRecorder::writeBytes(const void *data, qint64 size)
+{
+    if (failed) {
+        return false;
+    }
+    if (size == 0) {
+        return true;
+    }
+    if (file.write(static_cast<const char *>(data), size) != size) {
+        // 写入失败后不再写任何内容，已写入的记录仍可通过扫描读取
+        failed = true;
+        QMutexLocker locker(&mutex);
+        errorString = QString("写入录制文件失败: %1").arg(file.errorString());
+        return false;
+    }
+    bytes += size;
+    return true;
+}
+
+// ==================== SessionReader ====================
+
+bool SessionReader::open(const QString &path)
+{
+    close();
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        errorString = QString("无法打开录制文件: %1").arg(path);
+        return false;
+    }
+    size = file.size();
+    if (size < qint64(sizeof(FileHeader))) {
+        errorString = QString("不是录制文件: %1").arg(path);
+        close();
+        return false;
+    }
+    data = file.map(0, size);
+    if (!data) {
+        errorString = QString("无法映射录制文件: %1").arg(path);
+        close();
+        return false;
+    }
+
+    FileHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) != 0 || header.version != VERSION) {
+        errorString = QString("不是录制文件或版本不支持: %1").arg(path);
+        close();
+        return false;
+    }
+
+    indexed = readIndex();
+    if (!indexed && !scanRecords()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SessionReader::close()
+{
+    if (data) {
+        file.unmap(const_cast<uchar *>(data));
+        data = nullptr;
+    }
+    file.close();
+    size = 0;
+    indexed = false;
+    frames.clear();
+    events.clear();
+    decoded.clear();
+    decodedIndex = -1;
+}
+
+bool SessionReader::readIndex()
+{
+    if (size < qint64(sizeof(FileHeader) + sizeof(Footer))) {
+        return false;
+    }
+    Footer footer;
+    memcpy(&footer, data + size - sizeof(Footer), sizeof(footer));
+    if (memcmp(footer.magic, FOOTER_MAGIC, sizeof(footer.magic)) != 0) {
+        return false;
+    }
+    const qint64 frameBytes = qint64(footer.frameCount) * sizeof(FrameIndexEntry);
+    const qint64 eventBytes = qint64(footer.eventCount) * sizeof(SessionInputEvent);
+    if (qint64(footer.indexOffset) + frameBytes + eventBytes + qint64(sizeof(Footer)) != size) {
+        return false;
+    }
+
+    frames.resize(int(footer.frameCount));
+    events.resize(int(footer.eventCount));
+    memcpy(frames.data(), data + footer.indexOffset, size_t(frameBytes));
+    memcpy(events.data(), data + footer.indexOffset + frameBytes, size_t(eventBytes));
+    return true;
+}
+
+bool SessionReader::scanRecords()
+{
+    // 录制中断时没有索引：顺序扫描记录，最后一条不完整的记录被忽略
+    qint64 offset = sizeof(FileHeader);
+    while (offset + qint64(sizeof(RecordHeader)) <= size) {
+        RecordHeader record;
+        memcpy(&record, data + offset, sizeof(record));
+        const qint64 end = offset + qint64(sizeof(record)) + record.size;
+        if (end > size) {
+            break;
+        }
+        if (record.type == RecordFrame && record.size >= sizeof(FrameHeader)) {
+            FrameIndexEntry entry;
+            entry.timestamp = record.timestamp;
+            entry.offset = quint64(offset);
+            frames.append(entry);
+        } else if (record.type == RecordInput && record.size == sizeof(SessionInputEvent)) {
+            SessionInputEvent event;
+            memcpy(&event, data + offset + sizeof(record), sizeof(event));
+            events.append(event);
+        } else {
+            break;  // 未知记录：之后的内容无法可靠解析
+        }
+        offset = end;
+    }
+    if (frames.isEmpty() && events.isEmpty()) {
+        errorString = QString("录制文件中没有可读取的记录: %1").arg(file.fileName());
+        return false;
+    }
+    return true;
+}
+
+SessionReader::FrameInfo SessionReader::frameInfo(int index) const
+{
+    FrameInfo info;
+    if (index < 0 || index >= frames.size()) {
+        return info;
+    }
+    const quint64 offset = frames[index].offset;
+    if (offset + sizeof(RecordHeader) + sizeof(FrameHeader) > quint64(size)) {
+        return info;
+    }
+    RecordHeader record;
+    FrameHeader header;
+    memcpy(&record, data + offset, sizeof(record));
+    memcpy(&header, data + offset + sizeof(record), sizeof(header));
+    info.timestamp = record.timestamp;
+    info.width = header.width;
+    info.height = header.height;
+    info.encoding = header.encoding;
+    info.keyframe = int(header.keyframe);
+    info.bytes = record.size - quint32(sizeof(FrameHeader));
+    return info;
+}
+
+bool SessionReader::decode(int index)
+{
+    if (index == decodedIndex) {
+        return true;
+    }
+    const FrameInfo target = frameInfo(index);
+    if (target.width <= 0 || target.height <= 0 || target.keyframe > index) {
+        errorString = QString("录制文件中的第%1帧已损坏").arg(index);
+        return false;
+    }
+
+    // 从关键帧开始解码；已解码的帧位于关键帧和目标帧之间时从它继续
+    int first = target.keyframe;
+    if (decodedIndex >= target.keyframe && decodedIndex < index) {
+        first = decodedIndex + 1;
+    }
+    decodedIndex = -1;
+
+    for (int i = first; i <= index; ++i) {
+        const FrameInfo info = frameInfo(i);
+        const uchar *payload = data + frames[i].offset + sizeof(RecordHeader) + sizeof(FrameHeader);
+        const int count = info.width * info.height;
+        if (info.encoding == EncodingRaw && info.bytes == quint32(count) * 4) {
+            decoded.resize(count);
+            memcpy(decoded.data(), payload, info.bytes);
+        } else if (info.encoding != EncodingDelta || decoded.size() != count
+                   || !applyDelta(payload, info.bytes, decoded)) {
+            errorString = QString("录制文件中的第%1帧已损坏").arg(i);
+            return false;
+        }
+    }
+    decodedIndex = index;
+    return true;
+}
+
+QImage SessionReader::frame(int index)
+{
+    if (index < 0 || index >= frames.size() || !decode(index)) {
+        return QImage();
+    }
+    const FrameInfo info = frameInfo(index);
+    QImage image(info.width, info.height, QImage::Format_RGB32);
+    for (int y = 0; y < info.height; ++y) {
+        memcpy(image.scanLine(y), decoded.constData() + qsizetype(y) * info.width, size_t(info.width) * 4);
+    }
+    return image;
+}
+
+int SessionReader::frameAtTime(qint64 timestamp) const
+{
+    auto it = std::upper_bound(frames.constBegin(), frames.constEnd(), timestamp,
+                               [](qint64 value, const FrameIndexEntry &entry) { return value < entry.timestamp; });
+    return int(it - frames.constBegin()) - 1;
+}
+
+// ==================== SessionCaptureSource ====================
+
+SessionCaptureSource::SessionCaptureSource(const QString &path, bool loop)
+    : path(path)
+    , loop(loop)
+{
+    if (!reader.open(path)) {
+        errorString = reader.lastError();
+    } else if (reader.frameCount() == 0) {
+        errorString = QString("录制文件中没有帧: %1").arg(path);
+    }
+}
+
+void SessionCaptureSource::rewind()
+{
+    index = 0;
+    lastTimestamp = 0;
+    loopOffset = 0;
+}
+
+QImage SessionCaptureSource::capture()
+{
+    const int count = reader.frameCount();
+    if (count == 0) {
+        return QImage();
+    }
+    if (index >= count) {
+        if (!loop) {
+            errorString = "回放已结束";
+            return QImage();
+        }
+        // 下一轮的时间戳接在上一轮最后一帧之后
+        const qint64 first = reader.frameInfo(0).timestamp;
+        loopOffset = lastTimestamp - first + (count > 1 ? reader.frameInfo(1).timestamp - first : 0);
+        index = 0;
+    }
+
+    const int current = index++;
+    QImage image = reader.frame(current);
+    if (image.isNull()) {
+        errorString = reader.lastError();
+        return QImage();
+    }
+    lastTimestamp = loopOffset + reader.frameInfo(current).timestamp;
+    return image;
+}
@@ -0,0 +1,237 @@
+#ifndef SESSIONRECORDING_H
+#define SESSIONRECORDING_H
+
+#include <QFile>
+#include <QImage>
+#include <QMutex>
+#include <QQueue>
+#include <QString>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+#include <atomic>
+#include "capturesource.h"
+
+// 会话录制文件（.arec）
+// 记录一次运行中截取的每一帧和发送的每一个输入事件，时间戳为相对录制开始的单调时钟毫秒
+// 文件布局（小端序）：
+//   FileHeader
+//   记录*：RecordHeader + 数据（帧：FrameHeader + 像素；输入：InputEvent）
+//   索引：FrameIndexEntry * 帧数，InputEvent * 事件数
+//   Footer（固定位于文件末尾，指向索引）
+// 帧为RGB32像素，关键帧存原始像素，其余帧尽量存与上一帧的差分（未变化的像素段只记录长度）
+// 读取时映射整个文件，通过索引O(1)定位任意一帧；没有Footer（录制异常中断）时顺序扫描记录重建索引
+namespace SessionFormat {
+
+enum RecordType : quint32 {
+    RecordFrame = 1,
+    RecordInput = 2
+};
+
+enum FrameEncoding : quint32 {
+    EncodingRaw = 0,    // width*height个像素
+    EncodingDelta = 1   // 若干段 [跳过像素数, 像素数, 像素...]，相对上一帧
+};
+
+struct FileHeader {
+    char magic[8];      // "ARONAREC"
+    quint32 version;
+    quint32 reserved;
+};
+
+struct RecordHeader {
+    quint32 type;
+    quint32 size;       // 之后的数据字节数
+    qint64 timestamp;
+};
+
+struct FrameHeader {
+    qint32 width;
+    qint32 height;
+    quint32 encoding;
+    quint32 keyframe;   // 解码本帧需要从哪一帧（帧序号）开始
+};
+
+struct FrameIndexEntry {
+    qint64 timestamp;
+    quint64 offset;     // RecordHeader在文件中的位置
+};
+
+struct Footer {
+    quint64 indexOffset;
+    quint32 frameCount;
+    quint32 eventCount;
+    char magic[8];      // "ARECINDX"
+};
+
+static const char FILE_MAGIC[8] = {'A', 'R', 'O', 'N', 'A', 'R', 'E', 'C'};
+static const char FOOTER_MAGIC[8] = {'A', 'R', 'E', 'C', 'I', 'N', 'D', 'X'};
+static const quint32 VERSION = 1;
+
+} // namespace SessionFormat
+
+// 输入事件（与arona中发送给游戏窗口的消息一一对应）
+struct SessionInputEvent {
+    enum Type : quint32 {
+        Click = 1,      // (x, y)
+        Drag = 2,       // (x, y) -> (x2, y2)，value为持续时间（毫秒）
+        Scroll = 3,     // (x, y)，value为滚动格数
+        Key = 4,        // value为虚拟键码，x为1表示按下、0表示抬起
+        Release = 5     // 技能拖动后在(x, y)抬起
+    };
+
+    qint64 timestamp = 0;
+    quint32 type = 0;
+    qint32 x = 0;
+    qint32 y = 0;
+    qint32 x2 = 0;
+    qint32 y2 = 0;
+    qint32 value = 0;
+};
+
+// 录制器：调用方只把帧和事件放入队列，编码和写文件在后台线程完成，不会阻塞脚本
+// 待写入的帧超过maxPendingFrames时丢弃新帧（计入framesDropped），输入事件从不丢弃
+// 入队的帧是像素的副本，不会占用WindowCapture帧池中的截图
+// recordFrame/recordInput可以在任意线程调用
+class SessionRecorder : public QThread
+{
+public:
+    explicit SessionRecorder(int keyframeInterval = 60, int maxPendingFrames = 8, QObject *parent = nullptr);
+    ~SessionRecorder();
+
+    // 创建文件并启动写入线程，失败返回false（原因见lastError）
+    bool open(const QString &path);
+    // 写完队列中剩余的数据和索引，关闭文件
+    void close();
+    bool isOpen() const { return isRunning(); }
+    QString fileName() const { return file.fileName(); }
+
+    // capturedAt为CaptureWorker::clockMs()时刻（帧开始截取的时间）
+    void recordFrame(const QImage &image, qint64 capturedAt);
+    void recordInput(SessionInputEvent::Type type, int x, int y, int x2 = 0, int y2 = 0, int value = 0);
+
+    quint64 framesWritten() const { return written.load(); }
+    quint64 framesDropped() const { return dropped.load(); }
+    quint64 deltaFrames() const { return deltas.load(); }
+    qint64 bytesWritten() const { return bytes.load(); }
+    QString lastError() const;
+
+protected:
+    void run() override;
+
+private:
+    struct Item {
+        QImage image;               // 为空表示输入事件
+        SessionInputEvent event;
+    };
+
+    void writeFrame(QImage image, qint64 timestamp);
+    void writeEvent(const SessionInputEvent &event);
+    void writeIndex();
+    bool writeBytes(const void *data, qint64 size);
+
+    const int keyframeInterval;
+    const int maxPendingFrames;
+    QFile file;
+    qint64 origin = 0;
+
+    mutable QMutex mutex;           // 保护队列、状态和错误信息
+    QWaitCondition wakeup;
+    QQueue<Item> queue;
+    int pendingFrames = 0;
+    bool closing = false;
+    QString errorString;
+
+    // 以下只由写入线程访问
+    QVector<quint32> previous;      // 上一帧像素（差分基准）
+    QVector<quint32> current;
+    QByteArray encoded;
+    QSize previousSize;
+    int keyframe = 0;
+    QVector<SessionFormat::FrameIndexEntry> frameIndex;
+    QVector<SessionInputEvent> events;
+    bool failed = false;
+
+    std::atomic<quint64> written{0};
+    std::atomic<quint64> dropped{0};
+    std::atomic<quint64> deltas{0};
+    std::atomic<qint64> bytes{0};
+};
+
+// 读取录制文件（内存映射）
+class SessionReader
+{
+public:
+    struct FrameInfo {
+        qint64 timestamp = 0;
+        int width = 0;
+        int height = 0;
+        quint32 encoding = 0;
+        int keyframe = 0;
+        quint32 bytes = 0;          // 编码后的数据大小
+    };
+
+    SessionReader() = default;
+    ~SessionReader() { close(); }
+
+    bool open(const QString &path);
+    void close();
+    bool isOpen() const { return data != nullptr; }
+    // false表示文件没有索引（录制中断），索引是打开时扫描重建的
+    bool hasIndex() const { return indexed; }
+
+    int frameCount() const { return frames.size(); }
+    int eventCount() const { return events.size(); }
+    FrameInfo frameInfo(int index) const;
+    // 解码第index帧；顺序读取时从上一次解码的帧继续，不必回到关键帧
+    QImage frame(int index);
+    const SessionInputEvent &event(int index) const { return events[index]; }
+    // 时间戳不晚于timestamp的最后一帧，没有时返回-1
+    int frameAtTime(qint64 timestamp) const;
+
+    QString lastError() const { return errorString; }
+
+private:
+    bool readIndex();
+    bool scanRecords();
+    bool decode(int index);         // 把第index帧解码到decoded
+
+    QFile file;
+    const uchar *data = nullptr;
+    qint64 size = 0;
+    bool indexed = false;
+    QVector<SessionFormat::FrameIndexEntry> frames;
+    QVector<SessionInputEvent> events;
+    QVector<quint32> decoded;       // 最近一次解码的像素
+    int decodedIndex = -1;
+    QString errorString;
+};
+
+// 按顺序回放录制文件中的帧，时间戳与录制文件中的相同（与输入事件的时间戳可以直接比较）
+class SessionCaptureSource : public ICaptureSource
+{
+public:
+    explicit SessionCaptureSource(const QString &path, bool loop = false);
+
+    bool isValid() const { return reader.isOpen() && reader.frameCount() > 0; }
+    int frameCount() const { return reader.frameCount(); }
+    bool atEnd() const { return !loop && index >= reader.frameCount(); }
+    void rewind();
+    SessionReader &session() { return reader; }
+
+    QImage capture() override;
+    qint64 frameTimestamp() const override { return lastTimestamp; }
+    QString lastError() const override { return errorString; }
+    QString sourceName() const override { return path; }
+
+private:
+    QString path;
+    bool loop;
+    SessionReader reader;
+    int index = 0;
+    qint64 lastTimestamp = 0;
+    qint64 loopOffset = 0;      // 循环回放时累加的时间偏移，保证时间戳单调递增
+    QString errorString;
+};
+
+#endif // SESSIONRECORDING_H
@@ -0,0 +1,43 @@
+#include "settledetector.h"
+#include "imagekernels.h"
+
+SettleDetector::SettleDetector(const QRect &roi, const Options &options)
+    : region(roi)
+    , opts(options)
+{
+}
+
+bool SettleDetector::feed(const RoiFrame &frame, qint64 timestampMs)
+{
+    QImage image;
+    QRect localRoi;
+    if (!frame.locate(region, &image, &localRoi)) {
+        hasBaseline = false;
+        unchanged = 0;
+        changedAt = timestampMs;
+        stable = false;
+        return false;
+    }
+
+    const quint64 current = ImageKernels::sampledChecksum(image, localRoi, 1);  // 逐像素，不跳过任何行列
+    if (!hasBaseline || current != checksum) {
+        hasBaseline = true;
+        checksum = current;
+        unchanged = 0;
+        changedAt = timestampMs;
+    } else {
+        unchanged++;
+    }
+
+    stable = unchanged > 0 && (unchanged >= opts.stableFrames || timestampMs - changedAt >= opts.stableMs);
+    return stable;
+}
+
+void SettleDetector::reset()
+{
+    hasBaseline = false;
+    checksum = 0;
+    unchanged = 0;
+    changedAt = 0;
+    stable = false;
+}
@@ -0,0 +1,40 @@
+#ifndef SETTLEDETECTOR_H
+#define SETTLEDETECTOR_H
+
+#include <QRect>
+#include "roiframe.h"
+
+// 画面稳定检测
+// 逐帧比较ROI全部像素的校验和（任何像素变化都会改变校验和，淡入淡出等平均哈希看不出的动画也能发现），
+// ROI连续stableFrames帧不变，或保持不变超过stableMs后认为动画已经结束
+// 不持有截图，只记录上一帧的校验和，每个等待过程使用一个实例
+class SettleDetector
+{
+public:
+    struct Options {
+        int stableFrames = 3;       // 连续不变的帧数（不含作为基准的第一帧）
+        int stableMs = 300;         // 或者保持不变的时间
+    };
+
+    explicit SettleDetector(const QRect &roi, const Options &options = Options());
+
+    // 输入一帧（timestampMs为截取时刻），返回ROI是否已经稳定；截图中没有该ROI时视为发生了变化
+    bool feed(const RoiFrame &frame, qint64 timestampMs);
+    void reset();
+
+    bool isStable() const { return stable; }
+    QRect roi() const { return region; }
+    int unchangedFrames() const { return unchanged; }
+    qint64 unchangedSince() const { return changedAt; }     // 最近一次变化的时刻
+
+private:
+    QRect region;
+    Options opts;
+    bool hasBaseline = false;
+    quint64 checksum = 0;
+    int unchanged = 0;
+    qint64 changedAt = 0;
+    bool stable = false;
+};
+
+#endif // SETTLEDETECTOR_H
@@ -0,0 +1,159 @@
+// 离线回放工具：不依赖Win32，在任意平台上回放截图目录，输出每帧的识别结果和识别耗时
+// 用法: arona_replay <截图目录|录制文件.arec> [--templates <images目录>] [--config <arona_config.ini>] [--rounds N] [--quiet]
+// 截图目录的格式见ReplayCaptureSource（按文件名排序，可选timestamps.txt），录制文件的格式见sessionrecording.h
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QSettings>
+#include <QTextStream>
+#include "capturesource.h"
+#include "imagekernels.h"
+#include "screenrecognizer.h"
+#include "sessionrecording.h"
+
+static int loadTemplates(ScreenRecognizer &recognizer, const QString &path, bool ready, QSettings *settings)
+{
+    QDir dir(path);
+    int count = 0;
+    foreach (QString file, dir.entryList(QStringList() << "*.png", QDir::Files)) {
+        QImage image(dir.filePath(file));
+        QString name = file.left(file.lastIndexOf('.'));
+        int tolerance = settings ? ScreenRecognizer::toleranceFromSettings(*settings, name)
+                                 : ScreenRecognizer::DEFAULT_TOLERANCE;
+        quint64 hash = ImageKernels::averageHash(image);
+        bool added = ready ? recognizer.addReadyTemplate(name, image.size(), hash, tolerance)
+                           : recognizer.addPositionTemplate(name, image.size(), hash, tolerance);
+        if (added) {
+            count++;
+        }
+    }
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+    QStringList args = app.arguments();
+
+    QString framesDir;
+    QString templatesDir = QDir(QCoreApplication::applicationDirPath()).filePath("images");
+    QString configPath;
+    int rounds = 10;
+    bool quiet = false;
+    for (int i = 1; i < args.size(); i++) {
+        if (args[i] == "--templates" && i + 1 < args.size()) {
+            templatesDir = args[++i];
+        } else if (args[i] == "--config" && i + 1 < args.size()) {
+            configPath = args[++i];
+        } else if (args[i] == "--rounds" && i + 1 < args.size()) {
+            rounds = qMax(1, args[++i].toInt());
+        } else if (args[i] == "--quiet") {
+            quiet = true;
+        } else {
+            framesDir = args[i];
+        }
+    }
+    if (framesDir.isEmpty()) {
+        out << "用法: arona_replay <截图目录|录制文件.arec> [--templates <images目录>] [--config <arona_config.ini>] [--rounds N] [--quiet]\n";
+        return 2;
+    }
+
+    // 加载模板
+    ScreenRecognizer recognizer;
+    QSettings *settings = configPath.isEmpty() ? nullptr : new QSettings(configPath, QSettings::IniFormat);
+    int positionCount = loadTemplates(recognizer, QDir(templatesDir).filePath("position_templates"), false, settings);
+    int readyCount = loadTemplates(recognizer, QDir(templatesDir).filePath("position_ready"), true, settings);
+    delete settings;
+    recognizer.buildClassifier();
+    if (positionCount + readyCount == 0) {
+        out << "未加载到任何模板: " << templatesDir << "\n";
+        return 1;
+    }
+    out << "模板: 位置" << positionCount << "个, 就绪" << readyCount << "个\n";
+
+    // 逐帧输出识别结果；录制文件同时按时间顺序输出其中的输入事件
+    QVector<QImage> frames;
+    auto replay = [&](ICaptureSource &source, auto atEnd, const SessionReader *session) {
+        int eventIndex = 0;
+        while (!atEnd()) {
+            QImage frame = source.capture();
+            if (frame.isNull()) {
+                out << source.lastError() << "\n";
+                continue;
+            }
+            frames.append(frame);
+            if (quiet) {
+                continue;
+            }
+            while (session && eventIndex < session->eventCount()
+                   && session->event(eventIndex).timestamp <= source.frameTimestamp()) {
+                const SessionInputEvent &event = session->event(eventIndex++);
+                out << QString("%1ms\t> 输入%2 (%3, %4) (%5, %6) %7\n")
+                           .arg(event.timestamp, 8).arg(event.type)
+                           .arg(event.x).arg(event.y).arg(event.x2).arg(event.y2).arg(event.value);
+            }
+            ScreenState state = recognizer.classify(frame);
+            out << QString("%1ms\t%2\n").arg(source.frameTimestamp(), 8).arg(state.matches.isEmpty() ? "-" : state.toString());
+        }
+    };
+
+    if (QFileInfo(framesDir).isFile()) {
+        SessionCaptureSource source(framesDir);
+        if (!source.isValid()) {
+            out << source.lastError() << "\n";
+            return 1;
+        }
+        SessionReader &session = source.session();
+        out << QString("录制文件: %1帧, %2个输入事件%3\n")
+                   .arg(session.frameCount()).arg(session.eventCount())
+                   .arg(session.hasIndex() ? "" : "（无索引，已扫描重建）");
+        replay(source, [&]() { return source.atEnd(); }, &session);
+    } else {
+        ReplayCaptureSource source(framesDir);
+        if (!source.isValid()) {
+            out << source.lastError() << "\n";
+            return 1;
+        }
+        source.preload();
+        replay(source, [&]() { return source.atEnd(); }, nullptr);
+    }
+    if (frames.isEmpty()) {
+        return 1;
+    }
+
+    // 识别耗时：不使用缓存 / 使用按窗口的ROI变化检测缓存（按回放顺序连续输入）
+    QElapsedTimer timer;
+    int matchCount = 0;
+    timer.start();
+    for (int round = 0; round < rounds; round++) {
+        for (const QImage &frame : frames) {
+            matchCount += recognizer.classify(frame).matches.size();
+        }
+    }
+    double uncachedUs = timer.nsecsElapsed() / 1000.0 / (rounds * frames.size());
+
+    const QString windowKey = "replay";
+    recognizer.resetRoiCache(windowKey);
+    timer.restart();
+    for (int round = 0; round < rounds; round++) {
+        for (const QImage &frame : frames) {
+            matchCount -= recognizer.classify(frame, windowKey).matches.size();
+        }
+    }
+    double cachedUs = timer.nsecsElapsed() / 1000.0 / (rounds * frames.size());
+    ScreenRecognizer::RoiCacheStats stats = recognizer.roiCacheStats(windowKey);
+
+    out << QString("帧数: %1, 轮数: %2\n").arg(frames.size()).arg(rounds);
+    out << QString("classify: %1 us/帧\n").arg(uncachedUs, 0, 'f', 2);
+    out << QString("classify(ROI缓存): %1 us/帧, 命中%2次, 未命中%3次\n")
+               .arg(cachedUs, 0, 'f', 2).arg(stats.hits).arg(stats.misses);
+    if (matchCount != 0) {
+        // 缓存最多复用ROI_CACHE_MAX_REUSE次，对静态回放结果应完全一致
+        out << "警告: 使用缓存后的识别结果与不使用缓存时不一致\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include "transitionmodel.h"
+
+#include <QMutexLocker>
+#include <QSettings>
+#include <QStringList>
+#include <algorithm>
+
+void TransitionModel::append(Samples &samples, qint64 elapsedMs)
+{
+    if (samples.values.size() < MAX_SAMPLES) {
+        samples.values.append(qMax<qint64>(0, elapsedMs));
+    } else {
+        samples.values[samples.next] = qMax<qint64>(0, elapsedMs);
+        samples.next = (samples.next + 1) % MAX_SAMPLES;
+    }
+}
+
+void TransitionModel::record(const QString &key, qint64 elapsedMs)
+{
+    QMutexLocker locker(&mutex);
+    Samples &samples = transitions[key];
+    append(samples, elapsedMs);
+    samples.timedOut = false;
+}
+
+void TransitionModel::recordTimeout(const QString &key, qint64 elapsedMs)
+{
+    QMutexLocker locker(&mutex);
+    Samples &samples = transitions[key];
+    append(samples, elapsedMs);
+    samples.timedOut = true;
+}
+
+TransitionModel::Estimate TransitionModel::estimate(const QString &key) const
+{
+    QVector<qint64> sorted;
+    Estimate result;
+    {
+        QMutexLocker locker(&mutex);
+        const Samples samples = transitions.value(key);
+        sorted = samples.values;
+        result.afterTimeout = samples.timedOut;
+    }
+
+    result.samples = sorted.size();
+    if (sorted.isEmpty()) {
+        return result;
+    }
+    std::sort(sorted.begin(), sorted.end());
+    // 最近秩法：样本较少时p99就是最大值
+    auto percentile = [&sorted](int p) {
+        const int rank = (p * sorted.size() + 99) / 100;
+        return sorted[qBound(0, rank - 1, sorted.size() - 1)];
+    };
+    result.p10 = percentile(10);
+    result.p50 = percentile(50);
+    result.p90 = percentile(90);
+    result.p99 = percentile(99);
+    return result;
+}
+
+void TransitionModel::clear()
+{
+    QMutexLocker locker(&mutex);
+    transitions.clear();
+}
+
+void TransitionModel::load(QSettings &settings)
+{
+    QHash<QString, Samples> loaded;
+    const int count = settings.beginReadArray("transitions");
+    for (int i = 0; i < count; ++i) {
+        settings.setArrayIndex(i);
+        const QString name = settings.value("key").toString();
+        if (name.isEmpty()) {
+            continue;
+        }
+        Samples samples;
+        const QStringList values = settings.value("samples").toString().split(',', Qt::SkipEmptyParts);
+        for (const QString &value : values) {
+            bool ok = false;
+            const qint64 ms = value.toLongLong(&ok);
+            if (ok && ms >= 0) {
+                samples.values.append(ms);
+            }
+        }
+        // 只保留最近的样本（文件中按时间顺序保存）
+        if (samples.values.size() > MAX_SAMPLES) {
+            samples.values = samples.values.mid(samples.values.size() - MAX_SAMPLES);
+        }
+        if (!samples.values.isEmpty()) {
+            loaded.insert(name, samples);
+        }
+    }
+    settings.endArray();
+
+    QMutexLocker locker(&mutex);
+    transitions = loaded;
+}
+
+void TransitionModel::save(QSettings &settings) const
+{
+    QMutexLocker locker(&mutex);
+    settings.remove("transitions");
+    settings.beginWriteArray("transitions", transitions.size());
+    int index = 0;
+    for (auto it = transitions.constBegin(); it != transitions.constEnd(); ++it) {
+        // 按时间顺序保存（从最早的样本开始），读取时环形缓冲从头开始
+        const Samples &samples = it.value();
+        QStringList values;
+        for (int i = 0; i < samples.values.size(); ++i) {
+            values.append(QString::number(samples.values[(samples.next + i) % samples.values.size()]));
+        }
+        settings.setArrayIndex(index++);
+        settings.setValue("key", it.key());
+        settings.setValue("samples", values.join(','));
+    }
+    settings.endArray();
+}
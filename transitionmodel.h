@@ -0,0 +1,57 @@
+#ifndef TRANSITIONMODEL_H
+#define TRANSITIONMODEL_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+class QSettings;
+
+// 界面过渡耗时模型
+// 按"窗口/过渡"记录最近若干次过渡（如从点击按钮到进入咖啡厅1）实际花费的时间，给出分位数估计；
+// 调用方据此在预计到达的时间附近密集检查，并以p99乘以余量作为超时
+// 样本可以保存到QSettings，下次启动时直接使用；可以在任意线程调用
+class TransitionModel
+{
+public:
+    static constexpr int MAX_SAMPLES = 64;      // 每个过渡保留的最近样本数
+    static constexpr int MIN_SAMPLES = 5;       // 样本少于该值时估计不可用（调用方使用固定参数）
+
+    struct Estimate {
+        int samples = 0;
+        qint64 p10 = 0;
+        qint64 p50 = 0;
+        qint64 p90 = 0;
+        qint64 p99 = 0;
+        bool afterTimeout = false;  // 最近一次是超时
+        bool isWarm() const { return samples >= MIN_SAMPLES && !afterTimeout; }
+    };
+
+    static QString key(const QString &window, const QString &transition) { return window + "/" + transition; }
+
+    void record(const QString &key, qint64 elapsedMs);
+    // 过渡在elapsedMs内没有完成：作为删失样本记录（实际耗时至少为elapsedMs，按elapsedMs计入分位数），
+    // 并且在下一次完成的记录之前估计不可用，调用方退回固定参数的完整时长，较慢的过渡也能被学到
+    void recordTimeout(const QString &key, qint64 elapsedMs);
+    Estimate estimate(const QString &key) const;
+    void clear();
+
+    // 读写settings的当前组，每个过渡一项（过渡名称和以逗号分隔的样本）
+    void load(QSettings &settings);
+    void save(QSettings &settings) const;
+
+private:
+    struct Samples {
+        QVector<qint64> values;     // 环形缓冲
+        int next = 0;               // values已满时下一次覆盖的位置
+        bool timedOut = false;      // 最近一次是超时（不保存）
+    };
+
+    static void append(Samples &samples, qint64 elapsedMs);
+
+    mutable QMutex mutex;
+    QHash<QString, Samples> transitions;
+};
+
+#endif // TRANSITIONMODEL_H
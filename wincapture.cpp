@@ -0,0 +1,170 @@
+#include "wincapture.h"
+
+WindowCapture::WindowCapture(HWND hwnd, int poolSize)
+    : hwnd(hwnd)
+    , poolSize(qMax(1, poolSize))
+{
+    clock.start();
+}
+
+WindowCapture::~WindowCapture()
+{
+    for (Frame *frame : pool) {
+        orphanFrame(frame);
+    }
+    pool.clear();
+    if (memDC) {
+        DeleteDC(memDC);
+    }
+}
+
+QImage WindowCapture::capture()
+{
+    // 检查窗口是否有效
+    if (!IsWindow(hwnd)) {
+        errorString = "窗口句柄无效";
+        return QImage();
+    }
+
+    // 获取窗口矩形区域
+    RECT rect;
+    if (!GetWindowRect(hwnd, &rect)) {
+        errorString = "获取窗口矩形失败";
+        return QImage();
+    }
+    int width = rect.right - rect.left;
+    int height = rect.bottom - rect.top;
+    if (width <= 0 || height <= 0) {
+        errorString = "窗口尺寸无效";
+        return QImage();
+    }
+
+    // 内存DC只创建一次，与屏幕兼容即可（DIB的格式由位图自身决定）
+    if (!memDC) {
+        memDC = CreateCompatibleDC(NULL);
+        if (!memDC) {
+            errorString = "创建内存DC失败";
+            return QImage();
+        }
+    }
+
+    // 窗口尺寸变化：旧帧全部移出帧池
+    if (width != frameWidth || height != frameHeight) {
+        for (Frame *frame : pool) {
+            orphanFrame(frame);
+        }
+        pool.clear();
+        if (frameWidth != 0) {
+            counters.rebuilds++;
+        }
+        frameWidth = width;
+        frameHeight = height;
+    }
+
+    Frame *frame = acquireFrame(width, height);
+    if (!frame) {
+        errorString = "创建DIB位图失败";
+        return QImage();
+    }
+
+    // PrintWindow直接写入DIB内存；完成后换回原位图，保证帧可以在任意时刻被删除
+    HGDIOBJ oldBitmap = SelectObject(memDC, frame->bitmap);
+    BOOL printed = PrintWindow(hwnd, memDC, PW_RENDERFULLCONTENT);
+    SelectObject(memDC, oldBitmap);
+    GdiFlush();
+
+    if (!printed) {
+        releaseFrame(frame);
+        errorString = "PrintWindow失败";
+        return QImage();
+    }
+
+    // PrintWindow/BitBlt不保证alpha字节的值（复用的帧中还可能残留上一帧的值），而Format_RGB32要求为0xFF：
+    // 校验和等直接读取原始像素值的代码会因此把相同的画面当成变化，绘制和格式转换的结果也未定义
+    quint32 *pixels = reinterpret_cast<quint32 *>(frame->bits);
+    const qsizetype pixelCount = qsizetype(width) * height;
+    for (qsizetype i = 0; i < pixelCount; ++i) {
+        pixels[i] |= 0xFF000000u;
+    }
+
+    counters.frames++;
+    lastTimestamp = clock.elapsed();
+    // 自上而下的32位DIB与Format_RGB32的内存布局相同（每行width*4字节，无需对齐填充）
+    return QImage(frame->bits, width, height, width * 4, QImage::Format_RGB32, releaseFrame, frame);
+}
+
+WindowCapture::Frame *WindowCapture::acquireFrame(int width, int height)
+{
+    // 帧池中的空闲帧（只有本上下文会把帧从空闲改为使用中）
+    for (Frame *frame : pool) {
+        int expected = 0;
+        if (frame->state.compare_exchange_strong(expected, FrameInUse)) {
+            return frame;
+        }
+    }
+
+    Frame *frame = createFrame(width, height);
+    if (!frame) {
+        return nullptr;
+    }
+    counters.allocations++;
+    frame->state.store(FrameInUse);
+
+    if (pool.size() < poolSize) {
+        pool.append(frame);
+    } else {
+        // 帧池已满且全部被占用：临时帧不进入帧池，释放时直接销毁
+        frame->state.fetch_or(FrameOrphaned);
+    }
+    return frame;
+}
+
+WindowCapture::Frame *WindowCapture::createFrame(int width, int height)
+{
+    BITMAPINFO bmi;
+    ZeroMemory(&bmi, sizeof(bmi));
+    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    bmi.bmiHeader.biWidth = width;
+    bmi.bmiHeader.biHeight = -height;  // 负值表示自上而下，与QImage的扫描行顺序一致
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    void *bits = nullptr;
+    HBITMAP bitmap = CreateDIBSection(NULL, &bmi, DIB_RGB_COLORS, &bits, NULL, 0);
+    if (!bitmap || !bits) {
+        return nullptr;
+    }
+
+    Frame *frame = new Frame;
+    frame->bitmap = bitmap;
+    frame->bits = static_cast<uchar *>(bits);
+    frame->width = width;
+    frame->height = height;
+    return frame;
+}
+
+void WindowCapture::destroyFrame(Frame *frame)
+{
+    DeleteObject(frame->bitmap);
+    delete frame;
+}
+
+void WindowCapture::orphanFrame(Frame *frame)
+{
+    // 没有QImage引用时立即销毁，否则由releaseFrame在最后一个引用释放时销毁
+    int previous = frame->state.fetch_or(FrameOrphaned);
+    if (!(previous & FrameInUse)) {
+        destroyFrame(frame);
+    }
+}
+
+void WindowCapture::releaseFrame(void *info)
+{
+    // 可能在任意线程调用（QImage在哪个线程释放就在哪个线程调用）
+    Frame *frame = static_cast<Frame *>(info);
+    int previous = frame->state.fetch_and(~FrameInUse);
+    if (previous & FrameOrphaned) {
+        destroyFrame(frame);
+    }
+}
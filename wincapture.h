@@ -0,0 +1,74 @@
+#ifndef WINCAPTURE_H
+#define WINCAPTURE_H
+
+#include <QElapsedTimer>
+#include <QImage>
+#include <QString>
+#include <QVector>
+#include <atomic>
+#include <windows.h>
+#include "capturesource.h"
+
+// 单个游戏窗口的截图上下文（ICaptureSource的Win32实现）
+// 内存DC和DIB位图在多次截图之间保持不变，PrintWindow直接写入DIB的像素内存，
+// 返回的QImage直接引用这块内存（不复制）。QImage的最后一个引用释放时，帧自动回到帧池
+// 只有窗口尺寸变化时才重建DIB；此时仍被QImage引用的旧帧会在释放时自行销毁
+class WindowCapture : public ICaptureSource
+{
+public:
+    explicit WindowCapture(HWND hwnd, int poolSize = 3);
+    ~WindowCapture();
+
+    HWND window() const { return hwnd; }
+
+    // 截取窗口内容，失败返回空图像（原因见lastError）
+    // captureRegions使用基类实现：PrintWindow仍然渲染整个窗口（Win32没有局部渲染接口），
+    // 但只把ROI复制到紧凑缓冲区，整帧立即回到帧池
+    QImage capture() override;
+    qint64 frameTimestamp() const override { return lastTimestamp; }
+    QString lastError() const override { return errorString; }
+    QString sourceName() const override { return QString("HWND 0x%1").arg(quintptr(hwnd), 0, 16); }
+
+    // 统计信息（用于性能测试）
+    struct Stats {
+        quint64 frames = 0;         // 成功截图次数
+        quint64 allocations = 0;    // 创建DIB的次数（帧池未命中或尺寸变化）
+        quint64 rebuilds = 0;       // 因窗口尺寸变化重建帧池的次数
+    };
+    Stats stats() const { return counters; }
+
+private:
+    // 帧状态位：InUse = 被QImage引用，Orphaned = 已从帧池移除（尺寸变化或上下文销毁）
+    // 由最后一个清除自己状态位的一方销毁帧，两方可能位于不同线程
+    enum FrameState {
+        FrameInUse = 1,
+        FrameOrphaned = 2
+    };
+
+    struct Frame {
+        HBITMAP bitmap = NULL;
+        uchar *bits = nullptr;
+        int width = 0;
+        int height = 0;
+        std::atomic<int> state{0};
+    };
+
+    Frame *acquireFrame(int width, int height);
+    static Frame *createFrame(int width, int height);
+    static void destroyFrame(Frame *frame);
+    static void orphanFrame(Frame *frame);
+    static void releaseFrame(void *info);  // QImage清理函数
+
+    HWND hwnd;
+    int poolSize;
+    HDC memDC = NULL;
+    int frameWidth = 0;
+    int frameHeight = 0;
+    QVector<Frame *> pool;
+    QString errorString;
+    Stats counters;
+    QElapsedTimer clock;
+    qint64 lastTimestamp = 0;
+};
+
+#endif // WINCAPTURE_H